@@ -30,6 +30,15 @@ namespace arch {
     size_t copy_to_user(void *dst, const void *src, size_t length);
     size_t copy_from_user(void *dst, const void *src, size_t length);
 
+    // Single word accesses to user memory that never fault a page in, so they can be made under a spinlock.
+    // A page that isn't there (or isn't writable) gives -EFAULT, the caller drops its locks and uses fault_in_user.
+    // cmpxchg_user_u32 returns 1 and updates expected if the word held something else
+    int load_user_u32(const uint32_t *uaddr, uint32_t *value);
+    int store_user_u32(uint32_t *uaddr, uint32_t value);
+    int cmpxchg_user_u32(uint32_t *uaddr, uint32_t *expected, uint32_t desired);
+    // Touches the word as user space would, may sleep
+    int fault_in_user(uint32_t *uaddr, bool write);
+
     struct [[gnu::packed]] irq_regs;
     struct [[gnu::packed]] sched_regs;
     struct thread_ctx;
@@ -55,6 +64,7 @@ namespace arch {
     void route_irq(size_t irq, size_t vector);
 
     void init_context(sched::thread *task, void (*main)(), uint64_t rsp, uint8_t privilege);
+    void cleanup_context(sched::thread *task);
     void fork_context(sched::thread *original, sched::thread *task, irq_regs *r);
 
     void save_context(irq_regs *r, sched::thread *task);
@@ -72,8 +82,6 @@ namespace arch {
     void tick();
     void stop_all_cpus();
 
-    int do_futex(uintptr_t vaddr, int op, uint32_t expected, sched::timespec *timeout);
-
     void set_process(sched::process *process);
     void set_thread(sched::thread *task);
 
@@ -81,6 +89,7 @@ namespace arch {
     void start_thread(sched::thread *task);
     void stop_thread(sched::thread *task);
     void kill_thread(sched::thread *task);
+    void set_scheduler(sched::thread *task, int policy, int priority);
 
     tid_t get_idle_tid();
     sched::thread *get_idle();
@@ -92,6 +101,8 @@ namespace arch {
     pid_t get_pid();
 
     uint64_t get_cpu();
+    uint64_t get_cpu_number();
+    size_t get_cpu_count();
 
     pid_t allocate_pid();
     tid_t allocate_tid();
@@ -99,8 +110,16 @@ namespace arch {
     void set_errno(int errno);
     int get_errno();
 
-    void add_timer(sched::timer timer);
+    void add_timer(sched::timer *timer);
+    // False once the timer has fired or started firing
+    bool remove_timer(sched::timer *timer);
     void tick_clock(long nanos);
+
+    // Monotonic nanoseconds since the clock was calibrated at boot
+    uint64_t hrtime();
+    void add_hrtimer(sched::hrtimer *timer);
+    // False once the timer has fired or started firing
+    bool remove_hrtimer(sched::hrtimer *timer);
 };
 
 #endif
@@ -0,0 +1,38 @@
+#ifndef CLOCKSOURCE_HPP
+#define CLOCKSOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace clocksource {
+    constexpr uint64_t MSR_TSC_AUX = 0xC0000103;
+
+    // A free-running counter, mult converts counts since base to nanoseconds in 32.32 fixed point
+    struct source {
+        const char *name;
+        uint64_t (*read)();
+
+        uint64_t mult;
+        uint64_t base;
+    };
+
+    extern source *current;
+
+    // Nanoseconds between the monotonic clock and the realtime clock
+    extern uint64_t realtime_offset;
+
+    // Calibrates the TSC against the HPET or the PIT and picks the clock, BSP only
+    void init();
+    // Measures the local TSC against the BSP's so every CPU reads the same clock
+    void init_ap();
+    // BSP side of init_ap, answers the handshake of the AP being started
+    void sync_ap();
+
+    bool tsc_in_use();
+    // Local TSC value at which the monotonic clock reaches ns
+    uint64_t tsc_deadline(uint64_t ns);
+    // Converts a difference of TSC readings
+    uint64_t tsc_to_ns(uint64_t cycles);
+}
+
+#endif
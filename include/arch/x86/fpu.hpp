@@ -0,0 +1,62 @@
+#ifndef FPU_HPP
+#define FPU_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <arch/x86/types.hpp>
+
+namespace sched {
+    struct thread;
+}
+
+namespace x86 {
+    namespace fpu {
+        constexpr uint64_t XCR0_X87 = (1 << 0);
+        constexpr uint64_t XCR0_SSE = (1 << 1);
+        constexpr uint64_t XCR0_AVX = (1 << 2);
+        constexpr uint64_t XCR0_OPMASK = (1 << 5);
+        constexpr uint64_t XCR0_ZMM_HI256 = (1 << 6);
+        constexpr uint64_t XCR0_HI16_ZMM = (1 << 7);
+
+        constexpr uint64_t XCR0_USER_MASK = XCR0_X87 | XCR0_SSE | XCR0_AVX |
+            XCR0_OPMASK | XCR0_ZMM_HI256 | XCR0_HI16_ZMM;
+
+        constexpr size_t MSR_XSS = 0xDA0;
+
+        constexpr size_t LEGACY_AREA_SIZE = 512;
+        constexpr size_t AREA_ALIGNMENT = 64;
+
+        constexpr uint16_t DEFAULT_FCW = 0x33F;
+        constexpr uint32_t DEFAULT_MXCSR = 0x1F80;
+
+        enum class save_mode {
+            FXSAVE,
+            XSAVE,
+            XSAVEOPT,
+            XSAVES
+        };
+
+        extern size_t area_size;
+        extern save_mode mode;
+
+        void init();
+
+        char *alloc_area();
+        void free_area(char *area);
+        void init_area(char *area);
+        void copy_area(char *dst, char *src);
+
+        void save(char *area);
+        void restore(char *area);
+
+        // Write back a task's live registers if this CPU holds them, and release ownership
+        void flush(sched::thread *task);
+        // Release ownership without saving, for tasks whose state is about to be replaced
+        void drop(sched::thread *task);
+        void switch_to(sched::thread *task);
+
+        bool handle_nm(arch::irq_regs *r);
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PERCPU_HPP
+#define PERCPU_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace x86 {
+    namespace percpu {
+        template<typename T, size_t offset>
+        inline T read() {
+            static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+            if constexpr (sizeof(T) == 8) {
+                uint64_t value;
+                asm volatile("movq %%gs:%c1, %0" : "=r"(value) : "i"(offset) : "memory");
+                return (T) value;
+            } else if constexpr (sizeof(T) == 4) {
+                uint32_t value;
+                asm volatile("movl %%gs:%c1, %0" : "=r"(value) : "i"(offset) : "memory");
+                return (T) value;
+            } else if constexpr (sizeof(T) == 2) {
+                uint16_t value;
+                asm volatile("movw %%gs:%c1, %0" : "=r"(value) : "i"(offset) : "memory");
+                return (T) value;
+            } else {
+                uint8_t value;
+                asm volatile("movb %%gs:%c1, %0" : "=q"(value) : "i"(offset) : "memory");
+                return (T) value;
+            }
+        }
+
+        template<typename T, size_t offset>
+        inline void write(T value) {
+            static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+            if constexpr (sizeof(T) == 8) {
+                asm volatile("movq %0, %%gs:%c1" :: "r"((uint64_t) value), "i"(offset) : "memory");
+            } else if constexpr (sizeof(T) == 4) {
+                asm volatile("movl %0, %%gs:%c1" :: "r"((uint32_t) value), "i"(offset) : "memory");
+            } else if constexpr (sizeof(T) == 2) {
+                asm volatile("movw %0, %%gs:%c1" :: "r"((uint16_t) value), "i"(offset) : "memory");
+            } else {
+                asm volatile("movb %0, %%gs:%c1" :: "q"((uint8_t) value), "i"(offset) : "memory");
+            }
+        }
+
+        // Read-modify-write in one instruction, so it can't be split by an interrupt or a migration
+        template<typename T, size_t offset>
+        inline void add(T value) {
+            static_assert(sizeof(T) == 8);
+            asm volatile("addq %0, %%gs:%c1" :: "r"((uint64_t) value), "i"(offset) : "memory", "cc");
+        }
+    }
+}
+
+// Single instruction access to a field of the current CPU's x86::processor
+#define PERCPU_READ(field) \
+    x86::percpu::read<decltype(x86::processor::field), offsetof(x86::processor, field)>()
+#define PERCPU_WRITE(field, value) \
+    x86::percpu::write<decltype(x86::processor::field), offsetof(x86::processor, field)>(value)
+#define PERCPU_ADD(field, value) \
+    x86::percpu::add<decltype(x86::processor::field), offsetof(x86::processor, field)>(value)
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SMP_HPP
 #define SMP_HPP
 
+#include "arch/x86/percpu.hpp"
 #include "arch/x86/types.hpp"
 #include "frg/intrusive.hpp"
 #include "sys/sched/time.hpp"
@@ -57,14 +58,19 @@ namespace x86 {
     };
 
     constexpr size_t initialStackSize = 16;
+    constexpr size_t deferred_ipis = 16;
 
+    // 0 marks an empty message slot
     enum ipi_events {
-        INIT_TASK,
+        INIT_TASK = 1,
         START_TASK,
         STOP_TASK,
         KILL_TASK,
 
-        GIVE_OWNERSHIP
+        GIVE_OWNERSHIP,
+        SET_SCHEDULER,
+        RCU_QS,
+        PROF_START
     };
 
     struct thread_comparator {
@@ -79,12 +85,73 @@ namespace x86 {
         thread_comparator
     >;
 
+    constexpr uint64_t RT_PERIOD = 1000000000;
+    constexpr uint64_t RT_RUNTIME = 950000000;
+    constexpr uint64_t RR_TIMESLICE = 100000000;
+
+    using rt_list = prs::list<
+        sched::thread,
+        &sched::thread::rt_hook
+    >;
+
+    struct rt_queue {
+        uint64_t bitmap[2];
+        rt_list queues[sched::RT_PRIORITIES];
+        size_t nr_tasks;
+
+        uint64_t period_start;
+        uint64_t runtime;
+        uint64_t dispatched;
+
+        void enqueue(sched::thread *task) {
+            auto prio = task->rt_priority;
+            queues[prio].push_back(task);
+            bitmap[prio / 64] |= (1ULL << (prio % 64));
+            nr_tasks++;
+        }
+
+        void dequeue(sched::thread *task) {
+            if (!task->rt_hook.in_list) return;
+
+            auto prio = task->rt_priority;
+            queues[prio].erase(rt_list::iterator{task});
+            if (queues[prio].front() == nullptr) {
+                bitmap[prio / 64] &= ~(1ULL << (prio % 64));
+            }
+
+            nr_tasks--;
+        }
+
+        // Highest populated priority at or below limit, -1 if none
+        int highest(int limit = sched::RT_PRIORITIES - 1) {
+            for (int word = limit / 64; word >= 0; word--) {
+                uint64_t bits = bitmap[word];
+                if (word == limit / 64 && (limit % 64) != 63) {
+                    bits &= (1ULL << ((limit % 64) + 1)) - 1;
+                }
+
+                if (bits) {
+                    return word * 64 + (63 - __builtin_clzll(bits));
+                }
+            }
+
+            return -1;
+        }
+
+        bool throttled() {
+            return runtime >= RT_RUNTIME;
+        }
+    };
+
     struct [[gnu::packed]] processor {
+        processor *self;
+
         uintptr_t kstack;
         uintptr_t ustack;
         uint64_t errno;
 
         size_t processor_id;
+        size_t cpu_number;
 
         x86::tss::entry tss;
 
@@ -96,37 +163,113 @@ namespace x86 {
 
         void *ipi_data;
         size_t ipi_event;
+        bool ipi_busy;
 
         sched::thread   *current_task;
         sched::process *current_process;
         vmm::vmm_ctx *ctx;
 
         x86::run_tree *run_tree{};
+        x86::rt_queue *rt_queue{};
 
         uint64_t last_balance;
         uint64_t last_average;
         uint64_t load_average;
 
-        processor(size_t processor_id, x86::run_tree *run_tree) : processor_id(processor_id), run_tree(run_tree) { }
+        sched::thread *fpu_owner;
+        bool fpu_trapping;
+
+        bool isolated;
+
+        // RCU read-side nesting, the CPU is never switched away from while it's non-zero
+        size_t rcu_nesting;
+
+        // See sys/sched/preempt.hpp, swap_task defers to preempt_enable while the count is held
+        size_t preempt_count{};
+        bool need_resched{};
+
+        // Set around the single instruction of a no-fault user access, handle_pf leaves the fault to its fixup
+        bool nofault{};
+
+        // Messages taken out of the slot while this CPU waited on another's, run from its next message interrupt
+        size_t deferred_events[deferred_ipis];
+        void *deferred_data[deferred_ipis];
+        size_t deferred_count{};
+
+        processor(size_t processor_id, x86::run_tree *run_tree) : self(this), processor_id(processor_id), run_tree(run_tree) { }
     };
 
+    constexpr size_t max_cpus = sched::CPU_SETSIZE;
+
+    template<typename T>
+    struct per_cpu {
+        private:
+            struct alignas(64) slot {
+                T value;
+            };
+
+            slot slots[max_cpus];
+        public:
+            T &get() {
+                return slots[PERCPU_READ(cpu_number)].value;
+            }
+
+            T &operator[](size_t cpu_number) {
+                return slots[cpu_number].value;
+            }
+
+            T *operator->() {
+                return &get();
+            }
+    };
+
+    #define DEFINE_PER_CPU(type, name) x86::per_cpu<type> name
+
     extern prs::vector<x86::processor *, prs::allocator> cpus;
 
     void message_processor(ssize_t processor_id, size_t ipi_event, void *ipi_data);
     void calc_average_load(x86::processor *cpu);
-    x86::processor *least_loaded_cpu();
+    x86::processor *least_loaded_cpu(sched::cpu_set *mask = nullptr);
+
+    void enqueue_task(x86::processor *cpu, sched::thread *task);
+    void dequeue_task(x86::processor *cpu, sched::thread *task);
+    void set_scheduler(sched::thread *task);
+
+    inline x86::processor *get_locals() {
+        return PERCPU_READ(self);
+    }
+
+    inline sched::thread *get_thread() {
+        return PERCPU_READ(current_task);
+    }
+
+    inline sched::process *get_process() {
+        return PERCPU_READ(current_process);
+    }
+
+    inline size_t get_pid() {
+        return PERCPU_READ(pid);
+    }
+
+    inline int64_t get_tid() {
+        return PERCPU_READ(tid);
+    }
 
-    x86::processor *get_locals();
+    inline uint64_t get_cpu() {
+        return PERCPU_READ(processor_id);
+    }
 
-    sched::thread *get_thread();
-    sched::process *get_process();
+    inline size_t get_cpu_number() {
+        return PERCPU_READ(cpu_number);
+    }
 
-    size_t get_pid();
-    int64_t get_tid();
-    uint64_t get_cpu();
+    inline void set_errno(int errno) {
+        PERCPU_WRITE(errno, errno);
+    }
 
-    void set_errno(int errno);
-    int get_errno();
+    inline int get_errno() {
+        return PERCPU_READ(errno);
+    }
 
     void install_handlers();
     void stop_all_cpus();
@@ -2,9 +2,14 @@
 #define SYSCALL_HPP
 
 #include <arch/x86/types.hpp>
+#include <cstddef>
 
 namespace x86 {
     using syscall_handler = void (*)(arch::irq_regs *r);
+
+    size_t syscall_count();
+    // nullptr for a number that is out of range or not implemented
+    syscall_handler get_syscall(size_t nr);
 }
 
 #endif
\ No newline at end of file
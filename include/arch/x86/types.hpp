@@ -95,17 +95,12 @@ namespace arch {
         uint64_t fs, gs;
         uint64_t rflags;
         uint64_t cr3;
-
-        uint32_t mxcsr;
-        uint16_t fcw;
     };
 
     struct thread_ctx {
         sched_regs reg;
 
-        alignas(16)
-        char sse_region[512];
-
+        char *sse_region;
 
         uint8_t privilege;
         uint64_t cpu;
@@ -161,22 +156,19 @@ namespace x86 {
     void set_gate(uint8_t num, uint64_t base, uint8_t flags);
     void set_ist(uint8_t num, uint8_t idx);
 
-    uint16_t get_fcw();
-    void set_fcw(uint16_t fcw);
-
-    uint32_t get_mxcsr();
-    void set_mxcsr(uint32_t mxcsr);
-
-    void save_sse(char *sse_region);
-    void load_sse(char *sse_region);
-
     void handle_tick(arch::irq_regs *r);    
     void do_tick();
 
+    void init_hrtimers();
+    void start_hrtimers();
+    // The context the timer interrupt came in on, only valid from inside an hrtimer callback
+    arch::irq_regs *hrtimer_regs();
+
     void init_syscalls();
     void init_idle();
-    void init_sse();
 
+    // Points gs at a placeholder processor, before anything takes a spinlock
+    void init_boot_locals();
     void init_bsp();
     void init_ap();
     void init_smp();
@@ -190,8 +182,6 @@ namespace x86 {
     void stop_thread(sched::thread *task);
     void kill_thread(sched::thread *task);
 
-    ssize_t do_futex(uintptr_t vaddr, int op, uint32_t expected, sched::timespec *timeout);
-
     void sigreturn_kill(sched::process *proc, ssize_t status);
     void sigreturn_default(sched::process *proc, sched::thread *task);
     void sighandler_default(sched::process *proc, sched::thread *task, int sig);
@@ -210,6 +200,7 @@ namespace x86 {
     constexpr size_t MSR_FS_BASE = 0xC0000100;
     constexpr size_t MSR_GS_BASE = 0xC0000101;
     constexpr size_t KERNEL_GS_BASE = 0xC0000102;
+    constexpr size_t MSR_TSC_DEADLINE = 0x6E0;
 
     template<typename V>
     void wrmsr(uint64_t msr, V value) {
@@ -243,6 +234,61 @@ namespace x86 {
         return (rdx << 32) | rax;
     }
 
+    struct cpuid_regs {
+        uint32_t eax, ebx, ecx, edx;
+    };
+
+    inline cpuid_regs cpuid(uint32_t leaf, uint32_t subleaf = 0) {
+        cpuid_regs regs;
+        asm volatile(
+            "cpuid"
+            : "=a"(regs.eax), "=b"(regs.ebx), "=c"(regs.ecx), "=d"(regs.edx)
+            : "a"(leaf), "c"(subleaf)
+        );
+
+        return regs;
+    }
+
+    inline uint64_t read_cr0() {
+        uint64_t ret;
+        asm volatile("movq %%cr0, %0;" : "=r"(ret));
+        return ret;
+    }
+
+    inline void write_cr0(uint64_t cr0) {
+        asm volatile("movq %0, %%cr0;" ::"r"(cr0) : "memory");
+    }
+
+    inline uint64_t read_cr4() {
+        uint64_t ret;
+        asm volatile("movq %%cr4, %0;" : "=r"(ret));
+        return ret;
+    }
+
+    inline void write_cr4(uint64_t cr4) {
+        asm volatile("movq %0, %%cr4;" ::"r"(cr4) : "memory");
+    }
+
+    inline void clts() {
+        asm volatile("clts" ::: "memory");
+    }
+
+    inline void stts() {
+        write_cr0(read_cr0() | (1 << 3));
+    }
+
+    inline uint64_t xgetbv(uint32_t reg) {
+        uint32_t low, high;
+        asm volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(reg));
+        return ((uint64_t) high << 32) | low;
+    }
+
+    inline void xsetbv(uint32_t reg, uint64_t value) {
+        uint32_t low = value & 0xFFFFFFFF;
+        uint32_t high = value >> 32;
+        asm volatile("xsetbv" :: "a"(low), "d"(high), "c"(reg) : "memory");
+    }
+
     inline void swapgs() {
         asm volatile ("swapgs" ::: "memory");
     }
@@ -0,0 +1,21 @@
+#ifndef VDSO_HPP
+#define VDSO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <arch/x86/vvar.hpp>
+#include <mm/vmm.hpp>
+
+namespace vdso {
+    // Copies the vDSO image out of the kernel and sets up the vvar page
+    void init();
+    // Maps the vvar page and the vDSO into ctx, returns the vDSO's base for AT_SYSINFO_EHDR
+    uintptr_t map(vmm::vmm_ctx *ctx);
+
+    // Seqlock writer side, the page may only be changed between the two. write_end takes back
+    // the interrupt state write_begin saved
+    vvar *write_begin(bool &state);
+    void write_end(bool state);
+}
+
+#endif
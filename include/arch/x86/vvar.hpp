@@ -0,0 +1,34 @@
+#ifndef VVAR_HPP
+#define VVAR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Shared with the vDSO, which is built without the rest of the kernel headers
+namespace vdso {
+    constexpr size_t VVAR_CPUS = 256;
+
+    // The vDSO makes the syscall itself unless the clock can be read from user space
+    constexpr uint32_t CLOCK_MODE_NONE = 0;
+    constexpr uint32_t CLOCK_MODE_TSC = 1;
+
+    // Mapped read-only right below the vDSO. seq is odd while the kernel is updating the page,
+    // readers retry until they see the same even seq on both sides of their reads
+    struct vvar {
+        uint32_t seq;
+        uint32_t clock_mode;
+        uint32_t rdtscp;
+        uint32_t reserved;
+
+        // Same as the clocksource, ns = ((tsc + tsc_offsets[cpu] - base) * mult) >> 32
+        uint64_t mult;
+        uint64_t base;
+        uint64_t realtime_offset;
+
+        int64_t tsc_offsets[VVAR_CPUS];
+    };
+
+    static_assert(sizeof(vvar) <= 0x1000);
+}
+
+#endif
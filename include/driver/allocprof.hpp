@@ -0,0 +1,20 @@
+#ifndef ALLOCPROF_DEVICE_HPP
+#define ALLOCPROF_DEVICE_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace allocprof {
+    inline constexpr char device_name[] = "allocprof";
+
+    // /dev/allocprof, reads give live bytes per callsite, largest first, then each slab cache's
+    // occupancy. Any write resets the per-site allocation counts
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+}
+
+#endif
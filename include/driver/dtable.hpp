@@ -32,7 +32,16 @@ namespace dtable {
         { .match_data = {0}, .major=majors::PTS, .matcher = prs::construct<tty::pts::matcher>(allocator)},
         { .match_data = {0}, .major=majors::PTMX, .matcher = prs::construct<tty::ptmx::matcher>(allocator)},
         { .match_data = {0}, .major=majors::SELF_TTY, .matcher = prs::construct<tty::self::matcher>(allocator)},
-        { .match_data = {0}, .major=majors::VT, .matcher = prs::construct<vt::matcher>(allocator)}
+        { .match_data = {0}, .major=majors::VT, .matcher = prs::construct<vt::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::LOCKSTAT, .matcher = prs::construct<lockstat::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::TIMERLAT, .matcher = prs::construct<timerlat::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::WQSTAT, .matcher = prs::construct<wqstat::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::CGROUP, .matcher = prs::construct<sched::cgroup::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::PROF, .matcher = prs::construct<prof::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::TRACE, .matcher = prs::construct<tracing::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::SYSSTAT, .matcher = prs::construct<sysstat::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::ALLOCPROF, .matcher = prs::construct<allocprof::device::matcher>(allocator)},
+        { .match_data = {0}, .major=majors::FTRACE, .matcher = prs::construct<ftrace::device::matcher>(allocator)}
     };
 
     vfs::devfs::matcher *lookup_by_data(int *match_data, size_t len);
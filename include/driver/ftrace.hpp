@@ -0,0 +1,20 @@
+#ifndef FTRACE_DEVICE_HPP
+#define FTRACE_DEVICE_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace ftrace {
+    inline constexpr char device_name[] = "ftrace";
+
+    // /dev/ftrace, reads take records off the per-CPU rings as text lines, oldest first. Writes
+    // take "function", "graph", "stop", "filter <function>", "clear" or "reset"
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef LOCKSTAT_DEVICE_HPP
+#define LOCKSTAT_DEVICE_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace lockstat {
+    inline constexpr char device_name[] = "lockstat";
+
+    // /dev/lockstat, reads give a table of every tracked lock and any write resets the counters
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+}
+
+#endif
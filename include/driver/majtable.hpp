@@ -16,6 +16,15 @@ namespace dtable {
         constexpr size_t PTMX = 163;
         constexpr size_t SELF_TTY = 15;
         constexpr size_t VT = 164;
+        constexpr size_t LOCKSTAT = 16;
+        constexpr size_t TIMERLAT = 17;
+        constexpr size_t WQSTAT = 18;
+        constexpr size_t CGROUP = 19;
+        constexpr size_t PROF = 20;
+        constexpr size_t TRACE = 21;
+        constexpr size_t SYSSTAT = 22;
+        constexpr size_t ALLOCPROF = 23;
+        constexpr size_t FTRACE = 24;
     }
 }
 
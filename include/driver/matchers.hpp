@@ -7,5 +7,14 @@
 #include <driver/keyboard.hpp>
 #include <driver/tty/pty.hpp>
 #include <driver/video/vt.hpp>
+#include <driver/lockstat.hpp>
+#include <driver/timerlat.hpp>
+#include <driver/wqstat.hpp>
+#include <driver/prof.hpp>
+#include <driver/trace.hpp>
+#include <driver/sysstat.hpp>
+#include <driver/allocprof.hpp>
+#include <driver/ftrace.hpp>
+#include <sys/sched/cgroup.hpp>
 
 #endif
\ No newline at end of file
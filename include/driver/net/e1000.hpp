@@ -14,6 +14,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <arch/x86/types.hpp>
+#include <sys/sched/workqueue.hpp>
 
 namespace e1000 {
     constexpr size_t tx_max = 8;
@@ -177,7 +178,11 @@ namespace e1000 {
             void tx_init();
             void enable_irq();
 
+            // Receive processing runs from the workqueue, the interrupt only queues it
+            sched::wq::work rx_work;
+
             void rx_handle();
+            static void rx_worker(void *aux);
         public:
             friend void irq_handler(arch::irq_regs *r, void *aux);
 
@@ -198,7 +203,8 @@ namespace e1000 {
                 rx_desc_dma(net::device::allocator),
 
                 rx_dma(bus->get_dma(sizeof(rx_desc) * rx_max)),
-                tx_dma(bus->get_dma(sizeof(tx_desc) * tx_max))
+                tx_dma(bus->get_dma(sizeof(tx_desc) * tx_max)),
+                rx_work(rx_worker, this)
             {
                 net::setup_args *args = (net::setup_args *) aux;
 
@@ -0,0 +1,20 @@
+#ifndef PROF_DEVICE_HPP
+#define PROF_DEVICE_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace prof {
+    inline constexpr char device_name[] = "prof";
+
+    // /dev/prof, reads take samples off the per-CPU rings oldest first, one symbolized line each.
+    // Writes take "start [hz]", "stop" or "reset"
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SYSSTAT_DEVICE_HPP
+#define SYSSTAT_DEVICE_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace sysstat {
+    inline constexpr char device_name[] = "sysstat";
+
+    // /dev/sysstat, reads give each syscall's calls, errors and latency histogram summed over
+    // every CPU and any write resets them
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+}
+
+#endif
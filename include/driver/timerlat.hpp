@@ -0,0 +1,21 @@
+#ifndef TIMERLAT_HPP
+#define TIMERLAT_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace timerlat {
+    inline constexpr char device_name[] = "timerlat";
+
+    // /dev/timerlat, reads give how late each CPU's hrtimers fired past their deadline and any write resets it
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+
+    void init();
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef TRACE_DEVICE_HPP
+#define TRACE_DEVICE_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace tracing {
+    inline constexpr char device_name[] = "trace";
+
+    // /dev/trace, reads take whole tracing::record entries off the per-CPU rings, oldest first.
+    // Writes take "enable <point|all>", "disable <point|all>" or "reset"
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+}
+
+#endif
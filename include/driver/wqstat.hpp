@@ -0,0 +1,21 @@
+#ifndef WQSTAT_HPP
+#define WQSTAT_HPP
+
+#include <cstddef>
+#include <fs/dev.hpp>
+
+namespace wqstat {
+    inline constexpr char device_name[] = "wqstat";
+
+    // /dev/wqstat, reads give each workqueue's depth and latencies and any write resets them
+    struct device: vfs::devfs::filechardev<device_name> {
+        using filechardev::filechardev;
+
+        ssize_t read(void *buf, size_t len, size_t offset) override;
+        ssize_t write(void *buf, size_t len, size_t offset) override;
+    };
+
+    void init();
+}
+
+#endif
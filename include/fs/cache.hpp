@@ -8,6 +8,7 @@
 #include <frg/tuple.hpp>
 #include <ipc/link.hpp>
 #include <mm/mm.hpp>
+#include <sys/sched/mutex.hpp>
 #include <util/types.hpp>
 #include "mm/arena.hpp"
 #include "prs/allocator.hpp"
@@ -20,7 +21,8 @@ namespace cache {
 
     class holder {
         private:
-            util::spinlock lock;
+            // Held across block device I/O, so it has to be able to sleep
+            sched::mutex lock;
 
             prs::allocator allocator;
 
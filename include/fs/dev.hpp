@@ -6,6 +6,7 @@
 #include "mm/common.hpp"
 #include "prs/allocator.hpp"
 #include "util/types.hpp"
+#include <arch/types.hpp>
 #include <cstddef>
 #include <frg/hash.hpp>
 #include <frg/hash_map.hpp>
@@ -223,6 +224,58 @@ namespace vfs {
                     virtual ~chardev() {}
             };
 
+            // A device that is a single file directly under /dev, named after the device
+            template<const char *name>
+            struct file_matcher: matcher {
+                file_matcher(): matcher(true, true, name, nullptr, false, 0) {}
+            };
+
+            // Character device named name under /dev, only read and write are left to the subclass
+            template<const char *name>
+            struct filechardev: chardev {
+                using matcher = file_matcher<name>;
+
+                filechardev(devfs::busdev *bus, ssize_t major, ssize_t minor, void *aux): chardev(bus, major, minor, aux) {}
+            };
+
+            // Copies out whatever part of a text report falls inside [offset, offset + len). next(index, line, size)
+            // formats line index into line and returns its length, 0 to leave it out or -1 once there are no more.
+            // Lines are made one at a time, so nothing the formatter locks is held while copying
+            template<typename F>
+            static ssize_t copy_lines(void *buf, size_t len, size_t offset, char *line, size_t line_size, F next) {
+                size_t pos = 0;
+                size_t copied = 0;
+
+                for (size_t i = 0; copied < len; i++) {
+                    ssize_t line_len = next(i, line, line_size);
+                    if (line_len < 0) {
+                        break;
+                    } else if (line_len == 0) {
+                        continue;
+                    } else if ((size_t) line_len >= line_size) {
+                        line_len = line_size - 1;
+                    }
+
+                    if (pos + line_len > offset) {
+                        size_t skip = offset > pos ? offset - pos : 0;
+                        size_t count = line_len - skip;
+                        if (count > len - copied) {
+                            count = len - copied;
+                        }
+
+                        if (arch::copy_to_user((char *) buf + copied, line + skip, count) < count) {
+                            return -1;
+                        }
+
+                        copied += count;
+                    }
+
+                    pos += line_len;
+                }
+
+                return copied;
+            }
+
             struct dev_priv {
                 device *dev;
                 int part;
@@ -14,6 +14,7 @@
 #include <frg/hash.hpp>
 #include <frg/hash_map.hpp>
 #include <mm/mm.hpp>
+#include <sys/sched/mutex.hpp>
 #include <sys/sched/time.hpp>
 #include <util/lock.hpp>
 #include <util/log/log.hpp>
@@ -86,7 +87,8 @@ namespace vfs {
 
     struct node {
         public:
-            util::spinlock lock;
+            // Held across filesystem calls, which may sleep
+            sched::mutex lock;
 
             weak_ptr<filesystem> fs;
             shared_ptr<statinfo> meta;
@@ -490,7 +492,8 @@ namespace vfs {
 
     using fd_pair = frg::tuple<shared_ptr<fd>, shared_ptr<fd>>;
     struct fd {
-        util::spinlock lock;
+        // Serialises use of the descriptor's position, held across reads and writes
+        sched::mutex lock;
         shared_ptr<descriptor> desc;
         weak_ptr<fd_table> table;
         int fd_number;
@@ -501,6 +504,7 @@ namespace vfs {
     };
 
     struct fd_table {
+        // Only guards fd_list, callers keep a reference to the fd and drop it before using one
         util::spinlock lock;
         prs::allocator allocator;
         frg::hash_map<
@@ -0,0 +1,65 @@
+#ifndef WAIT_HPP
+#define WAIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <prs/list.hpp>
+#include <sys/sched/time.hpp>
+#include <util/lock.hpp>
+
+namespace sched {
+    struct thread;
+}
+
+namespace ipc {
+    struct wait_queue {
+        public:
+            struct entry {
+                sched::thread *task;
+                wait_queue *queue;
+
+                bool exclusive;
+                bool interruptible;
+
+                bool woken;
+                bool timed_out;
+                bool interrupted;
+                bool timer_pending;
+
+                sched::hrtimer timer;
+                prs::list_hook hook;
+
+                entry(sched::thread *task, wait_queue *queue, bool exclusive, bool interruptible):
+                    task(task), queue(queue), exclusive(exclusive), interruptible(interruptible),
+                    woken(false), timed_out(false), interrupted(false), timer_pending(false),
+                    timer(expire, this), hook() {}
+            };
+        private:
+            util::spinlock lock;
+            prs::list<entry, &entry::hook> waiters;
+
+            static void expire(void *aux);
+        public:
+            wait_queue(): lock(), waiters() {}
+
+            wait_queue(const wait_queue&) = delete;
+            wait_queue& operator=(const wait_queue&) = delete;
+
+            // Returns 0 once woken, -EINTR on an unmasked signal and -ETIMEDOUT when the timeout ran out.
+            // If release is given it is dropped after the caller is queued, so a waker serialised on it can't be missed.
+            // release_state is what its lock_irqsave returned, interrupts are back in that state on return
+            int wait(bool interruptible = true, sched::timespec *timeout = nullptr,
+                bool exclusive = false, util::spinlock *release = nullptr, bool release_state = false);
+
+            // Wakes every non-exclusive waiter and at most count exclusive ones
+            size_t wake(size_t count = 1);
+            size_t wake_one();
+            size_t wake_all();
+
+            bool empty();
+
+            static void interrupt(sched::thread *task);
+    };
+}
+
+#endif
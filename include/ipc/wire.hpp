@@ -9,6 +9,7 @@
 #include <cstddef>
 #include <util/lock.hpp>
 #include <frg/tuple.hpp>
+#include <ipc/wait.hpp>
 #include <sys/sched/time.hpp>
 
 namespace sched {
@@ -18,20 +19,16 @@ namespace sched {
 namespace ipc {
     struct  wire {
         private:
-            prs::vector<sched::thread *, prs::allocator> threads;
+            wait_queue waiters;
 
             ssize_t latest_event;
             sched::thread *latest_waker;
-            
-            util::spinlock lock;
-
-            void wait_for_wake(sched::thread *);
         public:
-            wire(): threads(slab::create_resource()), lock() {}
+            wire(): waiters(), latest_event(-1), latest_waker(nullptr) {}
 
-            wire(wire&& other): threads(std::move(other.threads)),
-                latest_event(std::move(other.latest_event)), latest_waker(std::move(other.latest_waker)),
-                lock() {}
+            // Only ever moved before anyone waits on it, waiters are not carried over
+            wire(wire&& other): waiters(),
+                latest_event(std::move(other.latest_event)), latest_waker(std::move(other.latest_waker)) {}
 
             frg::tuple<ssize_t, sched::thread *> wait(ssize_t event, bool allow_signals = false, sched::timespec *timeout = nullptr);
             void arise(ssize_t event);
@@ -0,0 +1,44 @@
+#ifndef ALLOCPROF_HPP
+#define ALLOCPROF_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Live kernel allocations by callsite, only tracked in ALLOCPROF builds. Every allocation from
+// an arena, a slab resource or pmm::alloc is keyed by its address with the short stack that
+// made it, and each distinct stack keeps a running count of what it still holds
+namespace allocprof {
+    enum kind: uint8_t {
+        ARENA,
+        SLAB,
+        PMM,
+        NR_KINDS
+    };
+
+    // Power of two, allocations past 3/4 of it are dropped rather than tracked
+    constexpr size_t MAX_LIVE = 32768;
+    constexpr size_t MAX_SITES = 1024;
+    constexpr size_t STACK_DEPTH = 4;
+
+    struct site {
+        uint64_t stack[STACK_DEPTH];
+        uint8_t depth;
+        kind type;
+
+        uint64_t live;
+        uint64_t live_bytes;
+        uint64_t allocs;
+        // Scratch for whoever holds the table lock
+        uint64_t oldest;
+    };
+
+    // Called by the allocators on their way out, the stack starts at whoever called them
+    void track(void *ptr, size_t size, kind type);
+    void untrack(void *ptr, kind type);
+
+    // Needs pmm, allocations made before this aren't seen
+    void init();
+    void init_device();
+}
+
+#endif
@@ -8,6 +8,8 @@ namespace memory {
     namespace x86 {
         constexpr size_t virtualBase = 0xFFFF800000000000;
         constexpr size_t kernelBase = 0xFFFFFFFF80000000;
+        // One top level entry, see mm/kstack.hpp
+        constexpr size_t stackBase = 0xFFFFFE0000000000;
     }
 
     constexpr size_t page_size = 0x1000;
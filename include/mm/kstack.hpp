@@ -0,0 +1,20 @@
+#ifndef KSTACK_HPP
+#define KSTACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kstack {
+    // Kernel stacks live in their own region of the kernel half, each with an unmapped guard page
+    // below it, so an overflow faults instead of running into whatever is allocated next to it
+    void init();
+
+    // Returns the top of a mapped x86::initialStackSize page stack, freed stacks stay mapped and
+    // are handed out again from a per-cpu cache before the shared free list
+    uintptr_t alloc();
+    void free(uintptr_t top);
+
+    bool in_guard(uintptr_t addr);
+}
+
+#endif
@@ -26,6 +26,23 @@ namespace slab {
     };
 
     struct slab_resource;
+
+    // What a cache holds right now. Slabs are never given back, so free objects in partial
+    // slabs are memory the cache keeps without being able to hand out in bulk
+    struct cache_stats {
+        size_t object_size;
+        size_t pages;
+
+        size_t empty;
+        size_t partial;
+        size_t full;
+
+        size_t objects;
+        size_t free_objects;
+        size_t partial_objects;
+        size_t partial_free;
+    };
+
     struct cache {
         private:
             util::spinlock lock;
@@ -56,6 +73,10 @@ namespace slab {
 
             static cache *create(size_t object_size);
             static cache *get_by_size(size_t object_size);
+
+            void get_stats(cache_stats *out);
+            // Fills out up to max entries, returns how many caches there are
+            static size_t collect_stats(cache_stats *out, size_t max);
     };
 
     struct slab_resource: prs::memory_resource {
@@ -10,10 +10,15 @@
 #include <stddef.h>
 #include <mm/pmm.hpp>
 #include <util/lock.hpp>
+#include <sys/sched/mutex.hpp>
 #include <frg/tuple.hpp>
 #include <arch/vmm.hpp>
 #include <arch/x86/types.hpp>
 
+namespace sched::cgroup {
+    struct group;
+}
+
 namespace vmm {
     class vmm_ctx;
 
@@ -80,9 +85,11 @@ namespace vmm {
                     mapping_perms perms;
                     
                     bool free_pages;
+                    // Backed by pages the mapping doesn't own, fork shares them instead of copying
+                    bool fixed_phys;
                     prs::rbtree_hook hook;
 
-                    mapping(void *addr, uint64_t len, vmm_ctx_map map) : addr(addr), len(len), map(map), perms(), free_pages(false) { };
+                    mapping(void *addr, uint64_t len, vmm_ctx_map map) : addr(addr), len(len), map(map), perms(), free_pages(false), fixed_phys(false) { };
             };
 
             struct mapping_comparator {
@@ -103,7 +110,7 @@ namespace vmm {
             void delete_mappings(void *addr, uint64_t len, mapping *start, mapping *end);
             void *delete_mappings(void *addr, uint64_t len);
 
-            void unmap_pages(void *addr, size_t len, bool free_pages);
+            size_t unmap_pages(void *addr, size_t len, bool free_pages);
 
             vmm_ctx_map page_map;
 
@@ -111,7 +118,14 @@ namespace vmm {
 
             prs::allocator allocator;
         public:
-            util::spinlock lock;
+            // Read for lookups and faults, write for anything that changes the mapping tree
+            sched::rwsem lock;
+            // Serialises page table updates made under the read side of lock
+            util::spinlock pt_lock;
+
+            // Group new pages are charged to and how many pages this address space holds against it
+            sched::cgroup::group *cgrp;
+            size_t charged;
 
             vmm_ctx();
             ~vmm_ctx();
@@ -121,6 +135,7 @@ namespace vmm {
             friend vmm_ctx *vmm::create();
 
             void *map(void *virt, uint64_t len, map_flags flags, bool fixed = false);
+            void *map_phys(void *virt, void *phys, uint64_t len, map_flags flags, bool fixed = false);
             void *stack(void *virt, uint64_t len, map_flags flags);
             void *unmap(void *virt, uint64_t len, bool stack = false);
             
@@ -80,7 +80,7 @@ namespace prs {
 
             void rotate_left(T *n) {
                 T *u = parent(n);
-                FRG_ASSERT(u != nullptr && right(u) == n);
+                prs::assert(u != nullptr && right(u) == n);
                 T *v = left(n);
                 T *w = parent(u);
 
@@ -7,6 +7,7 @@
 #include "mm/arena.hpp"
 #include "prs/allocator.hpp"
 #include "prs/vector.hpp"
+#include "sys/sched/mutex.hpp"
 #include "util/lock.hpp"
 #include "util/types.hpp"
 
@@ -81,13 +82,22 @@ namespace ns {
             weak_ptr<mount> parent;
             prs::vector<shared_ptr<mount>, prs::allocator>
                 children;
+
+            // Walk with the read side of lock held, symlinks recurse into these rather than the resolve_ entry points
+            weak_ptr<vfs::filesystem> lookup_fs(prs::string_view path,
+                shared_ptr<vfs::node> base, size_t& symlinks_traversed);
+            shared_ptr<vfs::node> lookup_at(prs::string_view path,
+                shared_ptr<vfs::node> base, bool follow_symlink, size_t& symlinks_traversed);
         public:
+            // Held for writing while filesystems are attached
+            sched::rwsem lock;
+
             mount(weak_ptr<ns::mount> self,
                 shared_ptr<vfs::node> resolve_root, weak_ptr<vfs::node> true_root,
                 weak_ptr<mount> parent):
                 self(self),
                 resolve_root(resolve_root), true_root(true_root),
-                parent(parent), children(arena::create_resource()) {}
+                parent(parent), children(arena::create_resource()), lock() {}
 
             weak_ptr<vfs::filesystem> resolve_fs(prs::string_view path, 
                 shared_ptr<vfs::node> base, size_t& symlinks_traversed = zero);
@@ -0,0 +1,112 @@
+#ifndef CGROUP_HPP
+#define CGROUP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fs/dev.hpp>
+#include <prs/list.hpp>
+#include <sys/sched/rcu.hpp>
+#include <util/lock.hpp>
+
+namespace vmm {
+    class vmm_ctx;
+}
+
+namespace sched {
+    struct thread;
+    struct process;
+
+    namespace cgroup {
+        constexpr uint64_t UNLIMITED = UINT64_MAX;
+
+        constexpr uint64_t DEFAULT_WEIGHT = 100;
+        constexpr uint64_t MIN_WEIGHT = 1;
+        constexpr uint64_t MAX_WEIGHT = 10000;
+        constexpr uint64_t DEFAULT_PERIOD = 100000000;
+
+        constexpr size_t NAME_MAX = 32;
+
+        // Limits apply to a group and everything below it, usage is charged to every ancestor
+        struct group {
+            char name[NAME_MAX];
+            group *parent;
+
+            // Pages charged by address spaces of attached processes
+            uint64_t memory_current;
+            uint64_t memory_peak;
+            uint64_t memory_max;
+            uint64_t memory_failcnt;
+
+            // Scales how fast tasks of the group advance in the run tree
+            uint64_t cpu_weight;
+
+            // Nanoseconds of fair class time the group may use per period, cpu_lock covers the period
+            util::spinlock cpu_lock;
+            uint64_t cpu_quota;
+            uint64_t cpu_period;
+            uint64_t period_start;
+            uint64_t period_runtime;
+            uint64_t cpu_usage;
+            uint64_t nr_throttled;
+
+            uint64_t pids_current;
+            uint64_t pids_max;
+
+            // Attached processes and child groups, a group with either can't be removed
+            size_t nr_procs;
+            size_t nr_children;
+
+            rcu::head rcu_head;
+            prs::list_hook hook;
+
+            group(const char *name, group *parent);
+        };
+
+        extern group *root;
+
+        // Paths are absolute and '/' separated, the root is "/"
+        group *lookup(const char *path);
+        group *create(const char *path);
+        // Fails with EBUSY while the group has processes or children
+        bool remove(group *grp);
+
+        // Moves a process along with its pid and the pages its address space has charged. Limits are
+        // only checked when something new is charged, a move never fails
+        void attach(process *proc, group *grp);
+        void detach(process *proc);
+        // Bills everything ctx has charged so far to grp, for an address space exec just built
+        void assign(vmm::vmm_ctx *ctx, group *grp);
+
+        // Counted in fork, false with EAGAIN set once any group up the tree is at pids_max
+        bool charge_pid(group *grp);
+        void uncharge_pid(group *grp);
+
+        // Charged to ctx's group when a page is allocated for it, false once a limit is in the way.
+        // force is for pages that have to be there, like the copies fork makes
+        bool charge_memory(vmm::vmm_ctx *ctx, size_t pages, bool force = false);
+        void uncharge_memory(vmm::vmm_ctx *ctx, size_t pages);
+
+        // Called when the task is switched out after running for ns
+        void charge_cpu(thread *task, uint64_t ns);
+        // True while the task's group or an ancestor has used up its quota for this period
+        bool throttled(thread *task);
+        uint64_t weight(thread *task);
+
+        inline constexpr char device_name[] = "cgroup";
+
+        // /dev/cgroup, reads list every group with its limits and counters. Writes take one command:
+        //   mkdir <path>, rmdir <path>, attach <path> <pid>
+        //   set <path> <memory.max|cpu.weight|cpu.max|cpu.period|pids.max> <value|max>
+        // memory.max is in bytes, cpu.max and cpu.period in microseconds
+        struct device: vfs::devfs::filechardev<device_name> {
+            using filechardev::filechardev;
+
+            ssize_t read(void *buf, size_t len, size_t offset) override;
+            ssize_t write(void *buf, size_t len, size_t offset) override;
+        };
+
+        void init();
+    }
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef MUTEX_HPP
+#define MUTEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ipc/wait.hpp>
+#include <util/lock.hpp>
+
+namespace sched {
+    struct thread;
+
+    // Sleeping lock for long critical sections. Lockers spin for a while as long as the
+    // owner is running on another CPU, then sleep on the wait queue until it unlocks
+    struct mutex {
+        private:
+            static constexpr size_t SPIN_LIMIT = 1024;
+
+            thread *owner;
+            size_t waiting;
+
+            util::spinlock wait_lock;
+            ipc::wait_queue waiters;
+
+            bool try_acquire(thread *task);
+            bool spin(thread *task);
+        public:
+            mutex(): owner(nullptr), waiting(0), wait_lock(), waiters() {}
+
+            mutex(const mutex&) = delete;
+            mutex& operator=(const mutex&) = delete;
+
+            void lock();
+            bool try_lock();
+            void unlock();
+
+            bool is_locked();
+            bool is_owner();
+    };
+
+    // Reader-writer semaphore for read-mostly data. Once a writer is waiting new readers
+    // queue up behind it, so read sides must not nest
+    struct rwsem {
+        private:
+            util::spinlock lock;
+
+            size_t readers;
+            size_t waiting_writers;
+            thread *writer;
+
+            ipc::wait_queue read_queue;
+            ipc::wait_queue write_queue;
+        public:
+            rwsem(): lock(), readers(0), waiting_writers(0), writer(nullptr), read_queue(), write_queue() {}
+
+            rwsem(const rwsem&) = delete;
+            rwsem& operator=(const rwsem&) = delete;
+
+            void read_lock();
+            bool try_read_lock();
+            void read_unlock();
+
+            void write_lock();
+            bool try_write_lock();
+            void write_unlock();
+
+            bool is_writer();
+    };
+
+    struct mutex_guard {
+        mutex_guard(sched::mutex &mutex): mutex{&mutex} {
+            this->mutex->lock();
+        }
+
+        mutex_guard(const mutex_guard &) = delete;
+        mutex_guard &operator= (const mutex_guard &) = delete;
+
+        ~mutex_guard() {
+            mutex->unlock();
+        }
+
+    private:
+        sched::mutex *mutex;
+    };
+
+    // Hands a guard a lock the caller already took with a try_ call
+    struct adopt_lock_t {};
+    constexpr adopt_lock_t adopt_lock{};
+
+    struct read_guard {
+        read_guard(rwsem &sem): sem{&sem} {
+            this->sem->read_lock();
+        }
+
+        read_guard(rwsem &sem, adopt_lock_t): sem{&sem} {}
+
+        read_guard(const read_guard &) = delete;
+        read_guard &operator= (const read_guard &) = delete;
+
+        ~read_guard() {
+            sem->read_unlock();
+        }
+
+    private:
+        rwsem *sem;
+    };
+
+    struct write_guard {
+        write_guard(rwsem &sem): sem{&sem} {
+            this->sem->write_lock();
+        }
+
+        write_guard(const write_guard &) = delete;
+        write_guard &operator= (const write_guard &) = delete;
+
+        ~write_guard() {
+            sem->write_unlock();
+        }
+
+    private:
+        rwsem *sem;
+    };
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PREEMPT_HPP
+#define PREEMPT_HPP
+
+#include <cstddef>
+
+namespace sched {
+    // Per-cpu nesting count of sections that must not be switched away from, spinlocks hold one.
+    // Nothing inside one may sleep
+    void preempt_disable();
+    // Reschedules once the count is back to zero if a reschedule came due in the meantime
+    void preempt_enable();
+    bool preemptible();
+
+    // Asks the current cpu to switch tasks at its next preemption point
+    void set_need_resched();
+    bool need_resched();
+
+    // Switches tasks if one is due, for long loops in process context
+    void cond_resched();
+
+    struct preempt_guard {
+        preempt_guard() {
+            preempt_disable();
+        }
+
+        preempt_guard(const preempt_guard &) = delete;
+        preempt_guard &operator= (const preempt_guard &) = delete;
+
+        ~preempt_guard() {
+            preempt_enable();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef RCU_HPP
+#define RCU_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sched {
+    namespace rcu {
+        // Embedded in objects handed to call(), fn runs once every reader that could see them is gone
+        struct head {
+            head *next;
+            void (*fn)(head *);
+        };
+
+        // Read-side sections nest and must not sleep. The CPU they run on is never switched away
+        // from, so any point outside one is a quiescent state
+        void read_lock();
+        void read_unlock();
+        bool in_read_side();
+
+        // Blocks until all readers that started before the call have finished
+        void synchronize();
+        // Same, but IPIs every CPU into a quiescent state instead of waiting for their ticks
+        void synchronize_expedited();
+
+        // Queues fn on this CPU's callbacks, ran in batches once a grace period has passed
+        void call(head *node, void (*fn)(head *));
+
+        // Reports a quiescent state for this CPU and advances its callbacks, with interrupts off
+        void quiescent();
+
+        struct read_guard {
+            read_guard() {
+                read_lock();
+            }
+
+            read_guard(const read_guard &) = delete;
+            read_guard &operator= (const read_guard &) = delete;
+
+            ~read_guard() {
+                read_unlock();
+            }
+        };
+    }
+}
+
+#endif
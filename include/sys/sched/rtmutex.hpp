@@ -0,0 +1,79 @@
+#ifndef RTMUTEX_HPP
+#define RTMUTEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ipc/wait.hpp>
+#include <prs/list.hpp>
+#include <sys/sched/time.hpp>
+#include <util/lock.hpp>
+
+namespace sched {
+    struct thread;
+    struct rt_mutex;
+
+    struct rt_mutex_waiter {
+        thread *task;
+        rt_mutex *lock;
+        // Changed with both lock's wait_lock and the task's pi_lock held
+        int prio;
+
+        ipc::wait_queue queue;
+        prs::list_hook hook;
+
+        rt_mutex_waiter(thread *task, rt_mutex *lock):
+            task(task), lock(lock), prio(0), queue(), hook() {}
+    };
+
+    // Sleeping lock with priority inheritance. While a task waits, the owner runs at
+    // least at the waiter's priority, and the boost follows the chain of owners that are blocked themselves.
+    // Unlocking hands the lock directly to the highest priority waiter
+    struct rt_mutex {
+        private:
+            static constexpr uintptr_t HAS_WAITERS = 1;
+
+            uintptr_t owner;
+
+            // Guards waiters and the HAS_WAITERS bit. top mirrors the first waiter's priority so
+            // owners can read it under their own pi_lock
+            util::spinlock wait_lock;
+            prs::list<rt_mutex_waiter, &rt_mutex_waiter::hook> waiters;
+            int top;
+
+            void queue_waiter(rt_mutex_waiter *waiter);
+            void dequeue_waiter(rt_mutex_waiter *waiter);
+
+            static int effective_prio(thread *task);
+            static void apply_prio(thread *task, int prio);
+            static int adjust_chain(thread *task, thread *orig = nullptr, bool force = false);
+        public:
+            // Links the lock into its owner's pi_held, under the owner's pi_lock
+            prs::list_hook pi_hook;
+
+            rt_mutex(): owner(0), wait_lock(), waiters(), top(0), pi_hook() {}
+            // Already held by owner, for locks taken outside the kernel like PI futexes
+            rt_mutex(thread *owner): owner((uintptr_t) owner), wait_lock(), waiters(), top(0), pi_hook() {}
+
+            rt_mutex(const rt_mutex&) = delete;
+            rt_mutex& operator=(const rt_mutex&) = delete;
+
+            void lock();
+            // 0 once owned, otherwise -EINTR, -ETIMEDOUT or -EDEADLK. release is dropped once the caller is queued,
+            // release_state is what its lock_irqsave returned and interrupts are back in that state on return
+            int lock(bool interruptible, timespec *timeout = nullptr, util::spinlock *release = nullptr,
+                bool release_state = false);
+            bool try_lock();
+            // Returns the task the lock was handed to, if any
+            thread *unlock();
+
+            thread *get_owner();
+            bool has_waiters();
+
+            friend void set_base_scheduler(thread *task, int policy, int priority);
+    };
+
+    // Changes the policy a task returns to once it no longer inherits a priority
+    void set_base_scheduler(thread *task, int policy, int priority);
+}
+
+#endif
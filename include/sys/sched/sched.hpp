@@ -4,6 +4,7 @@
 #include "arch/types.hpp"
 #include "mm/arena.hpp"
 #include "prs/allocator.hpp"
+#include "prs/list.hpp"
 #include "prs/rbtree.hpp"
 #include "sys/namespace.hpp"
 #include <arch/x86/types.hpp>
@@ -15,11 +16,18 @@
 #include <fs/vfs.hpp>
 #include <mm/mm.hpp>
 #include <mm/vmm.hpp>
+#include <sys/sched/rcu.hpp>
+#include <sys/sched/rtmutex.hpp>
 #include <sys/sched/signal.hpp>
+#include <sys/sched/time.hpp>
 #include <util/lock.hpp>
 #include <util/elf.hpp>
 #include <util/types.hpp>
 
+#ifdef CONFIG_FTRACE
+#include <util/ftrace.hpp>
+#endif
+
 namespace tty {
     struct device;
 }
@@ -55,35 +63,170 @@ namespace sched {
 
     constexpr size_t STATUS_CHANGED = (1ULL << 31);
 
-    constexpr size_t FUTEX_WAIT = 0;
-    constexpr size_t FUTEX_WAKE = 1;
+    constexpr int FUTEX_WAIT = 0;
+    constexpr int FUTEX_WAKE = 1;
+    constexpr int FUTEX_REQUEUE = 3;
+    constexpr int FUTEX_CMP_REQUEUE = 4;
+    constexpr int FUTEX_LOCK_PI = 6;
+    constexpr int FUTEX_UNLOCK_PI = 7;
+    constexpr int FUTEX_TRYLOCK_PI = 8;
+    constexpr int FUTEX_WAIT_BITSET = 9;
+    constexpr int FUTEX_WAKE_BITSET = 10;
+
+    constexpr int FUTEX_PRIVATE_FLAG = 128;
+    constexpr int FUTEX_CLOCK_REALTIME = 256;
+    constexpr int FUTEX_CMD_MASK = ~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
+
+    constexpr uint32_t FUTEX_BITSET_MATCH_ANY = 0xFFFFFFFF;
+
+    constexpr uint32_t FUTEX_WAITERS = 0x80000000;
+    constexpr uint32_t FUTEX_OWNER_DIED = 0x40000000;
+    constexpr uint32_t FUTEX_TID_MASK = 0x3FFFFFFF;
+
+    constexpr uint64_t CLONE_VM = 0x100;
+    constexpr uint64_t CLONE_FILES = 0x400;
+    constexpr uint64_t CLONE_SIGHAND = 0x800;
+    constexpr uint64_t CLONE_THREAD = 0x10000;
+    constexpr uint64_t CLONE_SETTLS = 0x80000;
+    constexpr uint64_t CLONE_PARENT_SETTID = 0x100000;
+    constexpr uint64_t CLONE_CHILD_CLEARTID = 0x200000;
+    constexpr uint64_t CLONE_CHILD_SETTID = 0x1000000;
+
+    constexpr size_t CPU_SETSIZE = 256;
+
+    constexpr int SCHED_OTHER = 0;
+    constexpr int SCHED_FIFO = 1;
+    constexpr int SCHED_RR = 2;
+
+    constexpr int RT_PRIORITIES = 100;
+    constexpr int RT_PRIORITY_MIN = 1;
+    constexpr int RT_PRIORITY_MAX = RT_PRIORITIES - 1;
+
+    struct sched_param {
+        int sched_priority;
+    };
+
+    constexpr int RUSAGE_SELF = 0;
+    constexpr int RUSAGE_CHILDREN = -1;
+    constexpr int RUSAGE_THREAD = 1;
+
+    struct rusage {
+        timeval ru_utime;
+        timeval ru_stime;
+        long ru_maxrss;
+        long ru_ixrss;
+        long ru_idrss;
+        long ru_isrss;
+        long ru_minflt;
+        long ru_majflt;
+        long ru_nswap;
+        long ru_inblock;
+        long ru_oublock;
+        long ru_msgsnd;
+        long ru_msgrcv;
+        long ru_nsignals;
+        long ru_nvcsw;
+        long ru_nivcsw;
+    };
+
+    struct tms {
+        long tms_utime;
+        long tms_stime;
+        long tms_cutime;
+        long tms_cstime;
+    };
+
+    // Times are in TSC cycles, converted to nanoseconds only when they are read
+    struct rusage_counters {
+        uint64_t utime;
+        uint64_t stime;
+
+        uint64_t nvcsw;
+        uint64_t nivcsw;
+        uint64_t minflt;
+        uint64_t majflt;
+
+        void add(const rusage_counters &other) {
+            utime += other.utime;
+            stime += other.stime;
+            nvcsw += other.nvcsw;
+            nivcsw += other.nivcsw;
+            minflt += other.minflt;
+            majflt += other.majflt;
+        }
+    };
 
     struct session;
     struct thread;
     struct process;
     struct process_group;
 
+    namespace wq {
+        struct worker;
+    }
+
+    namespace cgroup {
+        struct group;
+    }
+
     void init();
 
     thread *create_thread(void (*main)(), uint64_t rsp, vmm::vmm_ctx *ctx, uint8_t privilege, bool assign_tid = true);
+    // Returns a dead thread to the per-cpu thread cache along with its kernel stacks
+    void destroy_thread(thread *task);
+
+    // Charges the cycles since the thread's last charge to its user or system time. Called at syscall
+    // entry and exit and when the thread is switched out
+    void charge_time(thread *task, bool user);
+    // The calling thread's time up to now is charged first, so a running thread reads exact totals
+    rusage_counters thread_usage(thread *task);
+    rusage_counters process_usage(process *proc);
 
     thread *fork(thread *original, vmm::vmm_ctx *ctx, arch::irq_regs *r);
-    process *fork(process *original, thread *caller, arch::irq_regs *r);
+    process *fork(process *original, thread *caller, arch::irq_regs *r, uint64_t flags = 0);
+    // A new thread of the caller's process, running on stack with rax = 0
+    thread *clone(process *proc, thread *caller, arch::irq_regs *r, uintptr_t stack);
 
-    int do_futex(uintptr_t vaddr, int op, uint32_t expected, timespec *timeout);    
+    // Returns the op's result or a negative errno. timeout is a kernel copy, relative for FUTEX_WAIT and
+    // absolute for FUTEX_WAIT_BITSET and FUTEX_LOCK_PI, val2 is the requeue count
+    ssize_t do_futex(uintptr_t vaddr, int op, uint32_t val, timespec *timeout,
+        uint32_t val2, uintptr_t vaddr2, uint32_t val3);
 
     frg::tuple<tid_t, thread *> pick_task();
     void swap_task(arch::irq_regs *r);
     void balance_tasks();
 
-    struct futex {
-        util::spinlock lock;
-        uint64_t paddr;
-        ipc::wire wire;   
+    struct cpu_set {
+        uint64_t bits[CPU_SETSIZE / 64];
+
+        void zero() {
+            for (size_t i = 0; i < CPU_SETSIZE / 64; i++) bits[i] = 0;
+        }
+
+        void fill() {
+            for (size_t i = 0; i < CPU_SETSIZE / 64; i++) bits[i] = ~0ULL;
+        }
+
+        void set(size_t cpu) {
+            if (cpu < CPU_SETSIZE) bits[cpu / 64] |= (1ULL << (cpu % 64));
+        }
+
+        void clear(size_t cpu) {
+            if (cpu < CPU_SETSIZE) bits[cpu / 64] &= ~(1ULL << (cpu % 64));
+        }
 
-        int locked;
+        bool isset(size_t cpu) const {
+            if (cpu >= CPU_SETSIZE) return false;
+            return bits[cpu / 64] & (1ULL << (cpu % 64));
+        }
 
-        futex(uint64_t paddr): lock(), paddr(paddr), wire(), locked(0) {};
+        bool empty() const {
+            for (size_t i = 0; i < CPU_SETSIZE / 64; i++) {
+                if (bits[i]) return false;
+            }
+
+            return true;
+        }
     };
 
     struct [[gnu::packed]] thread_info {
@@ -129,13 +272,50 @@ namespace sched {
 
             uint8_t state;
             bool running;
+            bool on_rq;
 
             process *proc;
             tid_t tid;
             pid_t pid;
 
+            cpu_set affinity;
+
+            uint8_t policy;
+            uint8_t rt_priority;
+            uint8_t pending_policy;
+            uint8_t pending_priority;
+            uint64_t rr_started;
+
+            uint8_t base_policy;
+            uint8_t base_priority;
+            uint8_t pi_priority;
+            rt_mutex_waiter *pi_blocked_on;
+            prs::list<rt_mutex, &rt_mutex::pi_hook> pi_held;
+            // Guards the priority inheritance fields above, taken after the wait_lock of any rt_mutex
+            util::spinlock pi_lock;
+
             ipc::wire wire;
             prs::rbtree_hook hook;
+            prs::list_hook rt_hook;
+
+            ipc::wait_queue::entry *wait_entry;
+            util::spinlock wait_lock;
+
+            // Zeroed and woken as a futex when the thread exits, see set_tid_address
+            uintptr_t clear_child_tid;
+
+            // Set for workqueue workers
+            wq::worker *worker;
+
+            rusage_counters usage;
+            uint64_t acct_stamp;
+
+            // destroy_thread waits a grace period, the cpu it last ran on may still be on its stack
+            rcu::head rcu_head;
+
+#ifdef CONFIG_FTRACE
+            ftrace::call_stack calls{};
+#endif
 
             void start();
             void stop();
@@ -149,9 +329,13 @@ namespace sched {
                 kstack(kstack), ustack(ustack), mem_ctx(mem_ctx),
                 started(0), stopped(0), uptime(0),
                 pending_signal(false), dispatch_ready(false), in_syscall(false),
-                state(BLOCKED), running(false),
+                state(BLOCKED), running(false), on_rq(false),
 
-                proc(nullptr), pid(-1), wire(), hook() {
+                proc(nullptr), pid(-1), affinity(), policy(SCHED_OTHER), rt_priority(0),
+                pending_policy(SCHED_OTHER), pending_priority(0), rr_started(0),
+                base_policy(SCHED_OTHER), base_priority(0), pi_priority(0), pi_blocked_on(nullptr), pi_held(), pi_lock(),
+                wire(), hook(), rt_hook(), wait_entry(nullptr), wait_lock(), clear_child_tid(0), worker(nullptr), usage(), acct_stamp(x86::tsc()) {
+                affinity.fill();
                 if (assign_tid) arch::init_thread(this);
                 arch::init_context(this, main, rsp, privilege);
             }
@@ -161,13 +345,20 @@ namespace sched {
                 sig_ctx(), sig_kstack(sig_kstack), kstack(kstack), mem_ctx(ctx),
                 started(0), stopped(0), uptime(0),
                 pending_signal(original->pending_signal), dispatch_ready(original->dispatch_ready), in_syscall(original->in_syscall),
-                state(BLOCKED), running(false),
+                state(BLOCKED), running(false), on_rq(false),
                 
-                proc(nullptr), pid(-1), wire(), hook() { 
+                proc(nullptr), pid(-1), affinity(original->affinity), policy(original->base_policy), rt_priority(original->base_priority),
+                pending_policy(original->base_policy), pending_priority(original->base_priority), rr_started(0),
+                base_policy(original->base_policy), base_priority(original->base_priority), pi_priority(original->base_priority),
+                pi_blocked_on(nullptr), pi_held(), pi_lock(), wire(), hook(), rt_hook(), wait_entry(nullptr), wait_lock(), clear_child_tid(0), worker(nullptr), usage(), acct_stamp(x86::tsc()) { 
                 this->sig_ctx.sigmask = original->sig_ctx.sigmask;
                 arch::init_thread(this);
                 arch::fork_context(original, this, r);
             }
+
+            ~thread() {
+                arch::cleanup_context(this);
+            }
     };
 
     struct process_env {
@@ -187,6 +378,7 @@ namespace sched {
         } params;
 
         uint64_t entry;
+        uint64_t vdso_base;
         bool is_loaded;
 
         process *proc;
@@ -211,6 +403,8 @@ namespace sched {
             vmm::vmm_ctx *mem_ctx;
 
             prs::vector<thread *, prs::allocator> threads;
+            // Threads that are gone but not freed yet, their usage is already in exited_usage
+            prs::vector<thread *, prs::allocator> exited;
             prs::vector<process *, prs::allocator> children;
             prs::vector<process *, prs::allocator> zombies;            
             shared_ptr<vfs::fd_table> fds;
@@ -258,8 +452,16 @@ namespace sched {
 
             ipc::wire wire;
 
+            // Threads freed before the process is reaped, and reaped children with their own children
+            rusage_counters exited_usage;
+            rusage_counters child_usage;
+
+            cgroup::group *cgrp;
+
             void start();
             void kill(int exit_code = 0);
+            // Ends the calling thread alone, the last one out takes the process with it
+            void exit_thread(thread *task, int exit_code);
 
             void suspend();
             void cont();
@@ -273,10 +475,10 @@ namespace sched {
 
             process(shared_ptr<ns::pid> pid_ns): 
                 allocator(arena::create_resource()),
-                threads(allocator), children(allocator), zombies(allocator), 
+                threads(allocator), exited(allocator), children(allocator), zombies(allocator), 
                 pid_ns(pid_ns),
                 lock(), sig_lock(), env(allocator),
-                wire() {};
+                wire(), exited_usage(), child_usage(), cgrp(nullptr) {};
     };
 
     struct process_group {
@@ -3,6 +3,9 @@
 
 #include <mm/mm.hpp>
 #include <cstddef>
+#include <cstdint>
+#include <prs/list.hpp>
+#include <prs/rbtree.hpp>
 #include <util/types.hpp>
 
 namespace ipc {
@@ -12,11 +15,22 @@ namespace ipc {
 namespace sched {    
     struct thread;
 
-    constexpr long NANOS_PER_MILLI = 1000000000;
+    constexpr long NANOS_PER_MILLI = 1000000;
     constexpr long MILLIS_PER_SEC = 1000;
+    constexpr long NANOS_PER_SEC = 1000000000;
 
     constexpr size_t CLOCK_REALTIME = 0;
     constexpr size_t CLOCK_MONOTONIC = 1;
+    constexpr size_t CLOCK_PROCESS_CPUTIME_ID = 2;
+    constexpr size_t CLOCK_THREAD_CPUTIME_ID = 3;
+
+    // Unit of the times() syscall
+    constexpr long USER_HZ = 100;
+
+    struct timeval {
+        time_t tv_sec;
+        long tv_usec;
+    };
 
     struct timespec {
         public:
@@ -29,8 +43,8 @@ namespace sched {
                     .tv_nsec = this->tv_nsec + other.tv_nsec
                 };
 
-                if (res.tv_nsec > NANOS_PER_MILLI) {
-                    res.tv_nsec -= NANOS_PER_MILLI;
+                if (res.tv_nsec >= NANOS_PER_SEC) {
+                    res.tv_nsec -= NANOS_PER_SEC;
                     res.tv_sec++;
                 }
 
@@ -44,7 +58,7 @@ namespace sched {
                 };
 
                 if (res.tv_nsec < 0) {
-                    res.tv_nsec += NANOS_PER_MILLI;
+                    res.tv_nsec += NANOS_PER_SEC;
                     res.tv_sec--;
                 }
 
@@ -66,18 +80,66 @@ namespace sched {
             static timespec ms(int ms) {
                 return {
                     .tv_sec = ms / 1000,
-                    .tv_nsec = (ms % 1000) * 100000
+                    .tv_nsec = (ms % 1000) * NANOS_PER_MILLI
                 };
             }
+
+            static timespec ns(uint64_t ns) {
+                return {
+                    .tv_sec = (time_t) (ns / NANOS_PER_SEC),
+                    .tv_nsec = (long) (ns % NANOS_PER_SEC)
+                };
+            }
+
+            uint64_t to_ns() {
+                if (tv_sec < 0 || (tv_sec == 0 && tv_nsec <= 0)) {
+                    return 0;
+                }
+
+                return (uint64_t) tv_sec * NANOS_PER_SEC + tv_nsec;
+            }
     };
 
+    struct timer_wheel;
+
+    // Owned by the caller and armed with arch::add_timer, spec is relative to the time it is armed
     struct timer {
         timespec spec;
         ipc::wire *wire;
+
+        void (*fn)(void *aux);
+        void *aux;
+
+        uint64_t expires;
+        timer_wheel *wheel;
+        size_t level;
+        size_t slot;
+        prs::list_hook hook;
+
+        timer(timespec spec, ipc::wire *wire, void (*fn)(void *aux), void *aux):
+            spec(spec), wire(wire), fn(fn), aux(aux), expires(0), wheel(nullptr), level(0), slot(0), hook() {}
+    };
+
+    struct hrtimer_base;
+
+    // Armed with arch::add_hrtimer on the local CPU, deadline is absolute in arch::hrtime() nanoseconds.
+    // fn runs from the timer interrupt with interrupts off
+    struct hrtimer {
+        uint64_t deadline;
+
+        void (*fn)(void *aux);
+        void *aux;
+
+        hrtimer_base *base;
+        prs::rbtree_hook hook;
+
+        hrtimer(void (*fn)(void *aux), void *aux):
+            deadline(0), fn(fn), aux(aux), base(nullptr), hook() {}
     };
 
-    extern timespec clock_rt;
-    extern timespec clock_mono;
+    // Read from the clocksource on every call, with nanosecond resolution
+    timespec clock_rt();
+    timespec clock_mono();
 }
 
 #endif
\ No newline at end of file
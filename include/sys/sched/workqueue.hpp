@@ -0,0 +1,109 @@
+#ifndef WORKQUEUE_HPP
+#define WORKQUEUE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ipc/wait.hpp>
+#include <prs/list.hpp>
+#include <sys/sched/time.hpp>
+#include <util/lock.hpp>
+
+namespace sched {
+    struct thread;
+
+    namespace wq {
+        struct worker_pool;
+        struct worker;
+        struct workqueue;
+
+        // Runs on a cpu's bound pool by default, unbound queues share one pool that runs anywhere
+        constexpr int WQ_UNBOUND = 1;
+
+        // fn runs in a kernel thread and may sleep. Owned by the caller, who may free it from inside fn
+        struct work {
+            void (*fn)(void *aux);
+            void *aux;
+
+            // Set by whoever queues the work, cleared when a worker takes it
+            bool pending;
+            workqueue *queue;
+            worker_pool *pool;
+            uint64_t queued_at;
+            prs::list_hook hook;
+
+            work(void (*fn)(void *aux), void *aux): fn(fn), aux(aux),
+                pending(false), queue(nullptr), pool(nullptr), queued_at(0), hook() {}
+        };
+
+        // Queued once its timer runs out, on the cpu it was armed from
+        struct delayed_work {
+            work item;
+            sched::timer timer;
+
+            workqueue *queue;
+            size_t cpu;
+
+            static void expire(void *aux);
+
+            delayed_work(void (*fn)(void *aux), void *aux): item(fn, aux),
+                timer({}, nullptr, expire, this), queue(nullptr), cpu(0) {}
+        };
+
+        struct workqueue {
+            const char *name;
+            int flags;
+
+            util::spinlock lock;
+            ipc::wait_queue flushers;
+
+            // Waiting and running items, flush_queue waits for both to drain
+            size_t depth;
+            size_t active;
+
+            size_t max_depth;
+            uint64_t queued;
+            uint64_t executed;
+
+            // From queueing to a worker picking the item up, and the time fn ran for, in nanoseconds
+            uint64_t latency_total;
+            uint64_t latency_max;
+            uint64_t run_total;
+            uint64_t run_max;
+
+            prs::list_hook hook;
+
+            workqueue(const char *name, int flags): name(name), flags(flags), lock(), flushers(),
+                depth(0), active(0), max_depth(0), queued(0), executed(0),
+                latency_total(0), latency_max(0), run_total(0), run_max(0), hook() {}
+        };
+
+        extern workqueue *system;
+        extern workqueue *system_unbound;
+
+        // Starts the pools and the system queues, the scheduler and every cpu have to be up
+        void init();
+
+        workqueue *create(const char *name, int flags = 0);
+
+        // False if the work was already pending. Safe from interrupt context
+        bool queue(workqueue *queue, work *item);
+        bool queue_on(size_t cpu, workqueue *queue, work *item);
+        bool queue_delayed(workqueue *queue, delayed_work *dwork, timespec delay);
+
+        // Removes pending work and waits for a running fn to return, true if it was pending
+        bool cancel(work *item);
+        bool cancel_delayed(delayed_work *dwork);
+
+        // Waits until the work is neither pending nor running
+        void flush(work *item);
+        // Waits until the queue is idle, work that keeps requeueing itself holds this up
+        void flush_queue(workqueue *queue);
+
+        // Called when a thread blocks and when it runs again, so a pool whose workers all block
+        // in fn hands its remaining work to an idle worker
+        void sleeping(thread *task);
+        void waking(thread *task);
+    }
+}
+
+#endif
@@ -65,6 +65,10 @@ namespace apic {
     constexpr size_t LAPIC_LVT_TM = (1 << 15);
     constexpr size_t LAPIC_LVT_MASK = (1 << 16);
 
+    constexpr size_t LAPIC_TIMER_ONESHOT = (0 << 17);
+    constexpr size_t LAPIC_TIMER_PERIODIC = (1 << 17);
+    constexpr size_t LAPIC_TIMER_TSC_DEADLINE = (2 << 17);
+
     constexpr size_t LAPIC_BASE_MSR = 0x1B;
     constexpr size_t LAPIC_BASE_MSR_ENABLE = 0x800;
 
@@ -89,7 +93,6 @@ namespace apic {
         void write(uint32_t reg, uint32_t data);
         uint32_t read(uint32_t reg);
         void setup();
-        void set_timer(uint32_t ms);
         void *get_base();
 
         uint64_t id();
@@ -0,0 +1,71 @@
+#ifndef FTRACE_HPP
+#define FTRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <util/types.hpp>
+
+// Function tracing, only hooked up in FTRACE builds. -finstrument-functions makes every kernel
+// function call the hooks on entry and exit, which return straight away until tracing is started.
+// Function mode records each call with its call site, graph mode records entries and exits with
+// how long each call took. Records go into the CPU's ring and are dropped when it's full
+namespace ftrace {
+    enum mode: uint8_t {
+        OFF,
+        FUNCTION,
+        GRAPH
+    };
+
+    enum record_type: uint8_t {
+        CALL,
+        ENTRY,
+        EXIT
+    };
+
+    // Per CPU, a power of two
+    constexpr size_t RING_SIZE = 16384;
+    constexpr size_t MAX_FILTERS = 32;
+    constexpr size_t GRAPH_DEPTH = 48;
+
+    struct record {
+        uint64_t tsc;
+        uint64_t fn;
+        // The call site for CALL, the cycles the call took for EXIT
+        uint64_t arg;
+        tid_t tid;
+        uint16_t depth;
+        record_type type;
+        uint8_t cpu;
+    };
+
+    // Graph mode's view of a thread's calls, kept with the thread so a call it was switched out
+    // in the middle of is still matched up when it returns
+    struct call_stack {
+        // Anything left from before the current run is thrown away
+        uint64_t generation;
+        uint32_t depth;
+        // depth + 1 of the filtered call the thread is under, 0 when it isn't under one
+        uint32_t inside;
+
+        uint64_t fn[GRAPH_DEPTH];
+        uint64_t start[GRAPH_DEPTH];
+    };
+
+    bool start(mode how);
+    void stop();
+    bool running();
+
+    // With a filter, function mode only records the functions in it and graph mode only what
+    // runs under them. Changing it needs tracing to be stopped
+    bool filter(const char *name);
+    bool clear_filter();
+
+    // Takes the oldest record across all CPUs, false when there is none
+    bool pop(record *out);
+    void reset();
+    uint64_t lost();
+
+    void init();
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef KSYM_HPP
+#define KSYM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <util/stivale.hpp>
+
+// Kernel symbols, loaded from the "ksyms" boot module that scripts/post.py generates with nm
+namespace ksym {
+    struct symbol {
+        uint64_t addr;
+        // Zero when nm didn't know it, the symbol then runs up to the next one
+        uint64_t size;
+        const char *name;
+    };
+
+    // Copies the text symbols out of the module and sorts them, without one every lookup fails
+    void init(stivale::boot::tags::modules *modules);
+
+    // The symbol containing addr, nullptr if there is none
+    const symbol *lookup(uint64_t addr);
+    // The address of a symbol by its demangled name, 0 if there is no such symbol
+    uint64_t address(const char *name);
+    // Every symbol called name, in full or up to its parameter list so overloads all match.
+    // Returns how many there are, only the first max get written out
+    size_t find(const char *name, uint64_t *addrs, size_t max);
+
+    // "name+0x1f" when addr is inside a known symbol, the bare address otherwise
+    size_t format(uint64_t addr, char *buf, size_t len);
+}
+
+#endif
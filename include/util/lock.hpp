@@ -2,52 +2,135 @@
 #define LOCK_HPP
 
 #include <arch/types.hpp>
+#include <cstdint>
+#include <sys/sched/preempt.hpp>
+
+#ifdef CONFIG_LOCKSTAT
+#include <util/lockstat.hpp>
+#endif
 
 namespace util {
+    // Ticket lock, waiters are served in the order they arrived and back off in
+    // proportion to their distance from the head of the queue
     class spinlock {
         private:
-            volatile bool _lock;
-            bool interrupts;
-        public:            
-            void lock() {
-                interrupts = arch::get_irq_state();
+            static constexpr uint32_t BACKOFF_UNIT = 32;
+
+            volatile uint16_t owner;
+            volatile uint16_t next;
+#ifdef CONFIG_LOCKSTAT
+            lockstat::entry *stats;
+#endif
+
+            void acquire(void *site) {
+                uint16_t ticket = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+                uint16_t current = __atomic_load_n(&owner, __ATOMIC_ACQUIRE);
+#ifdef CONFIG_LOCKSTAT
+                bool contended = current != ticket;
+#endif
+
+                while (current != ticket) {
+                    uint32_t delay = (uint16_t) (ticket - current) * BACKOFF_UNIT;
+                    for (uint32_t i = 0; i < delay; i++) {
+                        asm volatile("pause");
+                    }
+
+                    current = __atomic_load_n(&owner, __ATOMIC_ACQUIRE);
+                }
+
+#ifdef CONFIG_LOCKSTAT
+                if (stats == nullptr) {
+                    stats = lockstat::get(this, site);
+                }
+
+                lockstat::acquired(stats, contended);
+#endif
+            }
+
+            void release() {
+#ifdef CONFIG_LOCKSTAT
+                lockstat::released(stats);
+#endif
+                __atomic_store_n(&owner, (uint16_t) (owner + 1), __ATOMIC_RELEASE);
+            }
+        public:
+            // Callers keep the interrupt state and hand it back to unlock_irqrestore
+            [[nodiscard]] bool lock_irqsave() {
+                bool state = arch::get_irq_state();
                 arch::irq_off();
-                while(__atomic_test_and_set(&this->_lock, __ATOMIC_ACQUIRE));
+                sched::preempt_disable();
+                acquire(__builtin_return_address(0));
+                return state;
             }
 
+            // Preemption comes back after interrupts, so a reschedule that came due while locked runs here
+            void unlock_irqrestore(bool state) {
+                release();
+                if (state) {
+                    arch::irq_on();
+                } else {
+                    arch::irq_off();
+                }
+
+                sched::preempt_enable();
+            }
+
+            // Interrupts are already off so nothing can preempt, and these don't touch the preempt count.
+            // That also lets a lock taken on one cpu be released on another, as the AP bootup lock is
             void lock_noirq() {
-                while(__atomic_test_and_set(&this->_lock, __ATOMIC_ACQUIRE));
+                acquire(__builtin_return_address(0));
             }
 
             void unlock_noirq() {
-                __atomic_clear(&this->_lock, __ATOMIC_RELEASE);
+                release();
             }
 
-            void await() {
-                while(__atomic_test_and_set(&this->_lock, __ATOMIC_ACQUIRE));
-                __atomic_clear(&this->_lock, __ATOMIC_RELEASE);
+            // Takes the lock only if nobody holds or waits for it, for going against the usual lock order
+            bool try_lock_noirq() {
+                uint16_t current = __atomic_load_n(&owner, __ATOMIC_RELAXED);
+                uint16_t ticket = current;
+                if (!__atomic_compare_exchange_n(&next, &ticket, (uint16_t) (current + 1), false,
+                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    return false;
+                }
+
+#ifdef CONFIG_LOCKSTAT
+                if (stats == nullptr) {
+                    stats = lockstat::get(this, __builtin_return_address(0));
+                }
+
+                lockstat::acquired(stats, false);
+#endif
+                return true;
             }
 
-            void unlock() {
-                __atomic_clear(&this->_lock, __ATOMIC_RELEASE);
-                if (interrupts) {
-                    arch::irq_on();
-                } else {
-                    arch::irq_off();
+            void await() {
+                uint16_t target = __atomic_load_n(&next, __ATOMIC_RELAXED);
+                while ((int16_t) (__atomic_load_n(&owner, __ATOMIC_ACQUIRE) - target) < 0) {
+                    asm volatile("pause");
                 }
             }
 
-            spinlock() : _lock(0), interrupts(false) {}
+            bool is_locked() {
+                return __atomic_load_n(&owner, __ATOMIC_RELAXED) != __atomic_load_n(&next, __ATOMIC_RELAXED);
+            }
+
+#ifdef CONFIG_LOCKSTAT
+            spinlock() : owner(0), next(0), stats(nullptr) {}
+#else
+            spinlock() : owner(0), next(0) {}
+#endif
             spinlock(const spinlock &other) = delete;
+#ifdef CONFIG_LOCKSTAT
             ~spinlock() {
-                if (this->_lock)
-                    this->unlock();
+                lockstat::put(stats);
             }
+#endif
     };
 
     struct lock_guard {
         lock_guard(util::spinlock &spinlock)
-        : spinlock{&spinlock}, locked{false} {
+        : spinlock{&spinlock}, locked{false}, interrupts{false} {
             lock();
         }
 
@@ -56,7 +139,7 @@ namespace util {
 
         void release() {
             if(locked && spinlock)
-                unlock();            
+                unlock();
             spinlock = nullptr;
         }
 
@@ -68,17 +151,18 @@ namespace util {
     private:
         util::spinlock *spinlock;
         bool locked;
+        bool interrupts;
 
         void lock() {
-            spinlock->lock();
+            interrupts = spinlock->lock_irqsave();
             locked = true;
         }
 
         void unlock() {
-            spinlock->unlock();
+            spinlock->unlock_irqrestore(interrupts);
             locked = false;
         }
     };
 };
 
-#endif
\ No newline at end of file
+#endif
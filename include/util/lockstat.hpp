@@ -0,0 +1,34 @@
+#ifndef LOCKSTAT_HPP
+#define LOCKSTAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-lock contention statistics, only collected in LOCKSTAT builds
+namespace lockstat {
+    constexpr size_t MAX_LOCKS = 512;
+
+    struct entry {
+        void *lock;
+        void *site;
+
+        uint64_t acquisitions;
+        uint64_t contentions;
+        uint64_t max_hold;
+        uint64_t acquired_at;
+    };
+
+    // Claims a slot for a lock on its first acquisition. Once the table is full every further lock
+    // shares one overflow entry, which only counts acquisitions and contentions
+    entry *get(void *lock, void *site);
+    void put(entry *stats);
+
+    // Called with the lock held
+    void acquired(entry *stats, bool contended);
+    void released(entry *stats);
+
+    void reset();
+    void init();
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef PROF_HPP
+#define PROF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <util/types.hpp>
+
+// Sampling profiler, driven by a per-CPU hrtimer on the LAPIC timer
+namespace prof {
+    constexpr size_t MAX_DEPTH = 16;
+    // Per CPU, a power of two
+    constexpr size_t RING_SIZE = 1024;
+
+    constexpr uint64_t DEFAULT_HZ = 1000;
+    constexpr uint64_t MAX_HZ = 10000;
+
+    struct sample {
+        uint64_t time;
+        pid_t pid;
+        tid_t tid;
+        uint32_t cpu;
+
+        // Interrupted in user mode, ip and callchain are then user addresses
+        bool user;
+        uint8_t depth;
+
+        uint64_t ip;
+        // Return addresses found by walking frame pointers, innermost first
+        uint64_t callchain[MAX_DEPTH];
+    };
+
+    // False with EBUSY if already running, or EINVAL for a frequency out of range
+    bool start(uint64_t hz);
+    // Timers notice on their next expiry and don't re-arm, samples taken so far stay readable
+    void stop();
+    bool running();
+
+    // Takes the oldest sample across all CPUs, false when every ring is empty
+    bool pop(sample *out);
+    // Drops unread samples and the lost count
+    void reset();
+    uint64_t lost();
+
+    // Arms the calling CPU's timer if profiling is on and it isn't armed yet, interrupts off
+    void arm();
+    void init();
+}
+
+#endif
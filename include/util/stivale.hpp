@@ -268,6 +268,16 @@ namespace stivale {
                 return nullptr;
             }
 
+            stivale::boot::tags::args *args() {
+                for (uint64_t tag = memory::add_virt(header)->tags; tag != 0; tag = (memory::add_virt(((stivale::tag *) tag))->next)) {
+                    if (memory::add_virt(((stivale::tag *) tag))->identifier == stivale::boot::tag_id::cmdline) {
+                        return memory::add_virt((stivale::boot::tags::args *) tag);
+                    }
+                }
+
+                return nullptr;
+            }
+
             stivale::boot::tags::rsdp *rsdp() {
                 for (uint64_t tag = header->tags; tag != 0; tag = ((stivale::tag *) tag)->next) {
                     if (((stivale::tag *) tag)->identifier == stivale::boot::tag_id::rsdp) {
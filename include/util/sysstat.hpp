@@ -0,0 +1,26 @@
+#ifndef SYSSTAT_HPP
+#define SYSSTAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-syscall counts and latencies, kept per CPU and summed when /dev/sysstat is read
+namespace sysstat {
+    // Bucket b counts calls that took [2^(b - 1), 2^b) TSC cycles, the last one everything longer
+    constexpr size_t BUCKETS = 32;
+
+    struct counters {
+        uint64_t calls;
+        uint64_t errors;
+        uint64_t cycles;
+        uint64_t hist[BUCKETS];
+    };
+
+    // Called on the way out of a syscall with interrupts off, nothing is kept before init
+    void record(uint64_t nr, uint64_t cycles, bool failed);
+
+    void reset();
+    void init();
+}
+
+#endif
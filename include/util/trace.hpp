@@ -0,0 +1,156 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <util/types.hpp>
+
+// Static tracepoints. A disabled point costs one load of a read-mostly flag and a branch
+// predicted not taken, the payload isn't even built. Enabled points copy a binary record into
+// the CPU's ring, oldest records are overwritten when it's full. /dev/trace hands the records
+// out as is and scripts/trace.py decodes them
+namespace tracing {
+    enum event: uint16_t {
+        SCHED_SWITCH,
+        SCHED_WAKEUP,
+        SCHED_MIGRATE,
+        SYS_ENTER,
+        SYS_EXIT,
+        PAGE_FAULT,
+        BLOCK_SUBMIT,
+        BLOCK_COMPLETE,
+        IRQ_ENTRY,
+        IRQ_EXIT,
+        NET_RX,
+        NET_TX,
+        NR_EVENTS
+    };
+
+    constexpr size_t PAYLOAD_MAX = 56;
+    // Per CPU, a power of two
+    constexpr size_t RING_SIZE = 2048;
+
+    // What a read of /dev/trace returns, one after another
+    struct [[gnu::packed]] record {
+        uint64_t time;
+        uint16_t id;
+        uint8_t size;
+        uint8_t cpu;
+        tid_t tid;
+        uint8_t payload[PAYLOAD_MAX];
+    };
+
+    struct sched_switch {
+        static constexpr event id = SCHED_SWITCH;
+        tid_t prev_tid;
+        tid_t next_tid;
+        int64_t prev_state;
+    };
+
+    struct sched_wakeup {
+        static constexpr event id = SCHED_WAKEUP;
+        tid_t tid;
+        uint32_t cpu;
+    };
+
+    struct sched_migrate {
+        static constexpr event id = SCHED_MIGRATE;
+        tid_t tid;
+        uint32_t from;
+        uint32_t to;
+    };
+
+    struct sys_enter {
+        static constexpr event id = SYS_ENTER;
+        uint64_t nr;
+        uint64_t args[6];
+    };
+
+    struct sys_exit {
+        static constexpr event id = SYS_EXIT;
+        uint64_t nr;
+        int64_t ret;
+        int64_t err;
+    };
+
+    struct page_fault {
+        static constexpr event id = PAGE_FAULT;
+        uint64_t addr;
+        uint64_t ip;
+        uint64_t err;
+    };
+
+    struct block_submit {
+        static constexpr event id = BLOCK_SUBMIT;
+        uint32_t major;
+        uint32_t minor;
+        uint64_t sector;
+        uint32_t count;
+        uint32_t write;
+    };
+
+    struct block_complete {
+        static constexpr event id = BLOCK_COMPLETE;
+        uint32_t major;
+        uint32_t minor;
+        uint64_t sector;
+        uint32_t count;
+        int32_t error;
+    };
+
+    struct irq_entry {
+        static constexpr event id = IRQ_ENTRY;
+        uint64_t vector;
+    };
+
+    struct irq_exit {
+        static constexpr event id = IRQ_EXIT;
+        uint64_t vector;
+    };
+
+    struct net_rx {
+        static constexpr event id = NET_RX;
+        uint32_t len;
+        uint32_t proto;
+    };
+
+    struct net_tx {
+        static constexpr event id = NET_TX;
+        uint32_t len;
+    };
+
+    extern bool keys[NR_EVENTS];
+    extern const char *names[NR_EVENTS];
+
+    inline bool on(event id) {
+        return __builtin_expect(__atomic_load_n(&keys[id], __ATOMIC_RELAXED), 0);
+    }
+
+    void write(event id, const void *payload, size_t size);
+
+    template<typename T>
+    inline void emit(const T &payload) {
+        static_assert(sizeof(T) <= PAYLOAD_MAX);
+        write(T::id, &payload, sizeof(T));
+    }
+
+    // False for an unknown name, "all" matches every point
+    bool enable(const char *name, bool on);
+
+    // Takes the oldest record across all CPUs, false when there is none. Records that were
+    // overwritten before they were read are counted instead
+    bool pop(record *out);
+    uint64_t overwritten();
+    void reset();
+
+    void init();
+}
+
+#define TRACE(name, ...) \
+    do { \
+        if (tracing::on(tracing::name::id)) { \
+            tracing::emit(tracing::name{__VA_ARGS__}); \
+        } \
+    } while (0)
+
+#endif
@@ -25,9 +25,15 @@ kernel_path = Path(args.kernel).resolve()
 image_path = Path(build_dir, f"{args.name}.img").resolve()
 persist_path = Path(build_dir, "persist.img").resolve()
 vmdk_path = Path(build_dir, f"{args.name}.vmdk").resolve()
+symbols_path = Path(build_dir, f"{args.name}.sym").resolve()
 
 qcow2_path = Path(source_dir, "..", "hades.qcow2").resolve()
 
+# Loaded as the "ksyms" module, the kernel symbolizes traces and profiles with it
+def do_symbols():
+    with open(symbols_path, "w") as out:
+        subprocess.run(["nm", "-n", "-S", "-C", "--defined-only", str(kernel_path)], stdout = out)
+
 def do_boot_disk():
     image_path.touch(exist_ok = True)
 
@@ -50,6 +56,7 @@ def do_boot_disk():
     """
 
     subprocess.run(["echfs-utils", "-m", "-p0", str(image_path), "import", str(kernel_path), kernel_path.name])
+    subprocess.run(["echfs-utils", "-m", "-p0", str(image_path), "import", str(symbols_path), symbols_path.name])
 def do_limine_install():
     subprocess.run([Path(source_dir, "misc", "limine-install").resolve(), str(image_path)])
 
@@ -59,6 +66,7 @@ def do_sysroot():
 def do_vmdk():
     subprocess.run(["qemu-img", "convert", "-O", "vmdk", str(image_path), str(vmdk_path)])
 
+do_symbols()
 do_boot_disk()
 do_limine_install()
 do_sysroot()
@@ -0,0 +1,43 @@
+#!/usr/bin/python3
+
+# Decodes what was read out of /dev/trace, the layouts follow include/util/trace.hpp
+
+import argparse
+import struct
+
+RECORD = struct.Struct("<QHBBi56s")
+
+EVENTS = [
+    ("sched_switch", "<iiq", ["prev_tid", "next_tid", "prev_state"]),
+    ("sched_wakeup", "<iI", ["tid", "cpu"]),
+    ("sched_migrate", "<iII", ["tid", "from", "to"]),
+    ("sys_enter", "<Q6Q", ["nr", "a0", "a1", "a2", "a3", "a4", "a5"]),
+    ("sys_exit", "<Qqq", ["nr", "ret", "errno"]),
+    ("page_fault", "<QQQ", ["addr", "ip", "err"]),
+    ("block_submit", "<IIQII", ["major", "minor", "sector", "count", "write"]),
+    ("block_complete", "<IIQIi", ["major", "minor", "sector", "count", "error"]),
+    ("irq_entry", "<Q", ["vector"]),
+    ("irq_exit", "<Q", ["vector"]),
+    ("net_rx", "<II", ["len", "proto"]),
+    ("net_tx", "<I", ["len"]),
+]
+
+HEX_FIELDS = {"addr", "ip", "a0", "a1", "a2", "a3", "a4", "a5", "proto"}
+
+parser = argparse.ArgumentParser()
+parser.add_argument("file", help = "Raw records copied out of /dev/trace")
+args = parser.parse_args()
+
+with open(args.file, "rb") as f:
+    data = f.read()
+
+for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+    time, event, size, cpu, tid, payload = RECORD.unpack_from(data, offset)
+    if event >= len(EVENTS):
+        print(f"{time / 1e9:.9f} [{cpu:02}] {tid:>6} unknown event {event}")
+        continue
+
+    name, layout, fields = EVENTS[event]
+    values = struct.unpack_from(layout, payload[:size])
+    text = " ".join(f"{field}={value:#x}" if field in HEX_FIELDS else f"{field}={value}" for field, value in zip(fields, values))
+    print(f"{time / 1e9:.9f} [{cpu:02}] {tid:>6} {name}: {text}")
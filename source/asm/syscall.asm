@@ -43,11 +43,11 @@ section .text
 	syscall_enter:
         swapgs
 
-        mov qword [gs:8], rsp
-        mov rsp, qword [gs:0]
+        mov qword [gs:16], rsp
+        mov rsp, qword [gs:8]
 
         push 0x23
-        push qword [gs:8]
+        push qword [gs:16]
         push r11
         push 0x1B
         push rcx
@@ -0,0 +1,11 @@
+[bits 64]
+
+section .note.GNU-stack noalloc noexec nowrite progbits
+section .rodata
+    align 4096
+
+    [global vdso_image_start]
+    [global vdso_image_end]
+    vdso_image_start:
+        incbin "vdso.so"
+    vdso_image_end:
@@ -1,7 +1,6 @@
 #include <mm/common.hpp>
 #include <cstddef>
 #include <cstdint>
-#include <arch/x86/hpet.hpp>
 #include <arch/x86/types.hpp>
 #include <sys/acpi.hpp>
 #include <sys/x86/apic.hpp>
@@ -139,19 +138,6 @@ namespace apic {
             lapic::write(LAPIC_REG_SIVR, apic::lapic::read(LAPIC_REG_SIVR) | 0x1FF);
         }
 
-        void set_timer(uint32_t ms) {
-            lapic::write(LAPIC_REG_DCR, 0x3);
-            lapic::write(LAPIC_REG_INTERNAL_CNTR, ~0);
-
-            hpet::msleep(20);
-
-            uint32_t ticks = ~0 - lapic::read(LAPIC_REG_CURR_CNTR);
-
-            lapic::write(LAPIC_REG_LVT_TIMR, 0x20 | (1 << 17));
-            lapic::write(LAPIC_REG_DCR, 0x3);
-            lapic::write(LAPIC_REG_INTERNAL_CNTR, ticks);
-        }
-
         uint64_t id() {
             return (lapic::read(LAPIC_REG_ID) >> 24);
         }
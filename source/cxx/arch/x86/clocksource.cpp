@@ -0,0 +1,242 @@
+#include <arch/types.hpp>
+#include <arch/x86/clocksource.hpp>
+#include <arch/x86/hpet.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <arch/x86/vdso.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <sys/sched/time.hpp>
+#include <util/io.hpp>
+#include <util/log/log.hpp>
+
+static log::subsystem logger = log::make_subsystem("CLOCK");
+
+constexpr uint64_t CALIBRATE_NANOS = 10 * sched::NANOS_PER_MILLI;
+constexpr uint64_t FEMTOS_PER_NANO = 1000000;
+constexpr uint64_t PIT_HZ = 1193182;
+constexpr size_t SYNC_SAMPLES = 16;
+
+static bool has_rdtscp = false;
+static uint64_t tsc_khz = 0;
+static uint64_t ns_to_tsc = 0;
+
+// Added to the local TSC to get the BSP's, indexed by cpu_number
+static int64_t tsc_offsets[x86::max_cpus];
+static bool tsc_synced = true;
+
+static uint64_t scale(uint64_t value, uint64_t mult) {
+    return (uint64_t) (((unsigned __int128) value * mult) >> 32);
+}
+
+// TSC_AUX holds the cpu number, so the counter and the offset always come from the same CPU
+static uint64_t read_tsc() {
+    if (has_rdtscp) {
+        uint32_t low, high, aux;
+        asm volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+        return (((uint64_t) high << 32) | low) + tsc_offsets[aux];
+    }
+
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    uint64_t value = x86::tsc() + tsc_offsets[PERCPU_READ(cpu_number)];
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    return value;
+}
+
+static uint64_t read_hpet() {
+    return hpet::hpet_regs->counter_value;
+}
+
+static clocksource::source tsc_source{"tsc", read_tsc, 0, 0};
+static clocksource::source hpet_source{"hpet", read_hpet, 0, 0};
+
+clocksource::source *clocksource::current = nullptr;
+uint64_t clocksource::realtime_offset = 0;
+
+uint64_t arch::hrtime() {
+    auto source = __atomic_load_n(&clocksource::current, __ATOMIC_ACQUIRE);
+    if (source == nullptr) {
+        return 0;
+    }
+
+    return scale(source->read() - source->base, source->mult);
+}
+
+// TSC ticks per millisecond
+static uint64_t calibrate_hpet() {
+    uint64_t period = hpet::hpet_regs->capabilities >> 32;
+
+    uint64_t hpet_start = hpet::hpet_regs->counter_value;
+    uint64_t tsc_start = x86::tsc();
+    uint64_t target = hpet_start + (CALIBRATE_NANOS * FEMTOS_PER_NANO) / period;
+
+    while (hpet::hpet_regs->counter_value < target) {
+        asm volatile("pause");
+    }
+
+    uint64_t hpet_end = hpet::hpet_regs->counter_value;
+    uint64_t tsc_end = x86::tsc();
+
+    uint64_t elapsed = (hpet_end - hpet_start) * period / FEMTOS_PER_NANO;
+    return (tsc_end - tsc_start) * sched::NANOS_PER_MILLI / elapsed;
+}
+
+// Channel 2 counts down once with its gate raised and the speaker off, OUT2 goes high at zero
+static uint64_t calibrate_pit() {
+    uint16_t count = PIT_HZ * CALIBRATE_NANOS / sched::NANOS_PER_SEC;
+
+    io::writeb(0x61, (io::readb(0x61) & ~0x02) | 0x01);
+    io::writeb(0x43, (0b10 << 6) | (0b11 << 4));
+    io::writeb(0x42, count & 0xFF);
+    io::writeb(0x42, count >> 8 & 0xFF);
+
+    uint64_t tsc_start = x86::tsc();
+    while ((io::readb(0x61) & 0x20) == 0) {
+        asm volatile("pause");
+    }
+
+    uint64_t tsc_end = x86::tsc();
+
+    uint64_t elapsed = count * sched::NANOS_PER_SEC / PIT_HZ;
+    return (tsc_end - tsc_start) * sched::NANOS_PER_MILLI / elapsed;
+}
+
+// Without rdtscp the vDSO can't tell which offset applies, so it only reads the TSC if none is needed
+static void publish() {
+    bool state;
+    auto page = vdso::write_begin(state);
+
+    bool readable = clocksource::tsc_in_use() && (has_rdtscp || tsc_synced);
+    page->clock_mode = readable ? vdso::CLOCK_MODE_TSC : vdso::CLOCK_MODE_NONE;
+    page->rdtscp = has_rdtscp;
+
+    page->mult = tsc_source.mult;
+    page->base = tsc_source.base;
+    page->realtime_offset = clocksource::realtime_offset;
+
+    for (size_t i = 0; i < x86::max_cpus; i++) {
+        page->tsc_offsets[i] = tsc_offsets[i];
+    }
+
+    vdso::write_end(state);
+}
+
+void clocksource::init() {
+    auto max_leaf = x86::cpuid(0x80000000).eax;
+    bool invariant = max_leaf >= 0x80000007 && ((x86::cpuid(0x80000007).edx >> 8) & 1);
+    has_rdtscp = max_leaf >= 0x80000001 && ((x86::cpuid(0x80000001).edx >> 27) & 1);
+
+    if (has_rdtscp) {
+        x86::wrmsr(MSR_TSC_AUX, x86::get_locals()->cpu_number);
+    }
+
+    tsc_khz = hpet::present ? calibrate_hpet() : calibrate_pit();
+    ns_to_tsc = (tsc_khz << 32) / sched::NANOS_PER_MILLI;
+    tsc_source.mult = ((uint64_t) sched::NANOS_PER_MILLI << 32) / tsc_khz;
+
+    if (hpet::present) {
+        uint64_t period = hpet::hpet_regs->capabilities >> 32;
+        hpet_source.mult = (period << 32) / FEMTOS_PER_NANO;
+        hpet_source.base = hpet::hpet_regs->counter_value;
+    }
+
+    tsc_source.base = x86::tsc();
+
+    // A TSC that stops or changes rate with the core clock can't keep time
+    auto source = (invariant || !hpet::present) ? &tsc_source : &hpet_source;
+    __atomic_store_n(&current, source, __ATOMIC_RELEASE);
+
+    kmsg(logger, "TSC at %lu kHz%s, using %s", tsc_khz, invariant ? "" : " (not invariant)", source->name);
+    publish();
+}
+
+// Rounds of the boot handshake, the AP posts a round number and the BSP answers it with its TSC
+static size_t sync_request;
+static size_t sync_response;
+static uint64_t sync_tsc;
+
+void clocksource::sync_ap() {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    for (size_t i = 1; i <= SYNC_SAMPLES; i++) {
+        while (__atomic_load_n(&sync_request, __ATOMIC_ACQUIRE) != i) {
+            asm volatile("pause");
+        }
+
+        __atomic_store_n(&sync_tsc, x86::tsc(), __ATOMIC_RELAXED);
+        __atomic_store_n(&sync_response, i, __ATOMIC_RELEASE);
+    }
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+}
+
+void clocksource::init_ap() {
+    auto cpu = x86::get_locals()->cpu_number;
+    if (has_rdtscp) {
+        x86::wrmsr(MSR_TSC_AUX, cpu);
+    }
+
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    // The BSP read its TSC somewhere inside each round trip, the shortest round bounds the error best
+    uint64_t best = UINT64_MAX;
+    int64_t offset = 0;
+    for (size_t i = 1; i <= SYNC_SAMPLES; i++) {
+        uint64_t before = x86::tsc();
+        __atomic_store_n(&sync_request, i, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&sync_response, __ATOMIC_ACQUIRE) != i) {
+            asm volatile("pause");
+        }
+        uint64_t after = x86::tsc();
+
+        if (after - before >= best) {
+            continue;
+        }
+
+        best = after - before;
+        offset = (int64_t) (__atomic_load_n(&sync_tsc, __ATOMIC_RELAXED) - (before + best / 2));
+    }
+
+    // The BSP is done answering, and the next AP isn't started until this one comes online
+    __atomic_store_n(&sync_request, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&sync_response, 0, __ATOMIC_RELAXED);
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    // Offsets within half a round trip can't be told apart from synchronised TSCs
+    int64_t noise = best / 2;
+    if (offset >= -noise && offset <= noise) {
+        offset = 0;
+    }
+
+    tsc_offsets[cpu] = offset;
+    if (offset != 0) {
+        tsc_synced = false;
+    }
+
+    publish();
+}
+
+bool clocksource::tsc_in_use() {
+    return current == &tsc_source;
+}
+
+uint64_t clocksource::tsc_deadline(uint64_t ns) {
+    return tsc_source.base + scale(ns, ns_to_tsc) - tsc_offsets[PERCPU_READ(cpu_number)];
+}
+
+uint64_t clocksource::tsc_to_ns(uint64_t cycles) {
+    return scale(cycles, tsc_source.mult);
+}
@@ -1,7 +1,10 @@
 #include <arch/types.hpp>
 #include <arch/x86/smp.hpp>
+#include <arch/x86/percpu.hpp>
 #include <arch/x86/types.hpp>
 #include <cstddef>
+#include <cstdint>
+#include <util/errors.hpp>
 
 inline size_t do_copy_user(void *dst, const void *src, size_t length) {
     size_t bytes_left = length;
@@ -84,4 +87,146 @@ size_t arch::copy_from_user(void *dst, const void *src, size_t length) {
 
 size_t arch::copy_to_user(void *dst, const void *src, size_t length) {
     return x86::copy_to_user(dst, src, length);
-}
\ No newline at end of file
+}
+
+static bool user_word(const uint32_t *uaddr) {
+    uintptr_t addr = (uintptr_t) uaddr;
+    return !(addr & (sizeof(uint32_t) - 1)) && addr + sizeof(uint32_t) < 0x7fffffffffff;
+}
+
+// Each access is one instruction with an exception table entry, a fault on it resumes at the fixup with -EFAULT
+static int load_word(const uint32_t *uaddr, uint32_t *value) {
+    int err = 0;
+    uint32_t out = 0;
+    asm volatile(
+        "1: movl %2, %1\n"
+        "2: \n"
+
+        ".section .fixup, \"ax\"\n"
+        "3: movl %3, %0\n"
+        "   jmp 2b\n"
+        ".previous\n"
+
+        ".section .ex_table, \"a\"\n"
+        ".align 8\n"
+        ".quad 1b, 3b\n"
+        ".previous"
+
+        : "+r"(err), "=r"(out)
+        : "m"(*uaddr), "i"(-EFAULT)
+        : "memory"
+    );
+
+    *value = out;
+    return err;
+}
+
+static int store_word(uint32_t *uaddr, uint32_t value) {
+    int err = 0;
+    asm volatile(
+        "1: movl %2, %1\n"
+        "2: \n"
+
+        ".section .fixup, \"ax\"\n"
+        "3: movl %3, %0\n"
+        "   jmp 2b\n"
+        ".previous\n"
+
+        ".section .ex_table, \"a\"\n"
+        ".align 8\n"
+        ".quad 1b, 3b\n"
+        ".previous"
+
+        : "+r"(err), "=m"(*uaddr)
+        : "r"(value), "i"(-EFAULT)
+        : "memory"
+    );
+
+    return err;
+}
+
+static int cmpxchg_word(uint32_t *uaddr, uint32_t *expected, uint32_t desired) {
+    int err = 0;
+    uint32_t prev = *expected;
+    uint32_t found = prev;
+    asm volatile(
+        "1: lock; cmpxchgl %3, %2\n"
+        "2: \n"
+
+        ".section .fixup, \"ax\"\n"
+        "3: movl %4, %0\n"
+        "   jmp 2b\n"
+        ".previous\n"
+
+        ".section .ex_table, \"a\"\n"
+        ".align 8\n"
+        ".quad 1b, 3b\n"
+        ".previous"
+
+        : "+r"(err), "+a"(found), "+m"(*uaddr)
+        : "r"(desired), "i"(-EFAULT)
+        : "memory", "cc"
+    );
+
+    if (err) {
+        return err;
+    }
+
+    *expected = found;
+    return found == prev ? 0 : 1;
+}
+
+// Interrupts stay off so the flag and the access are on the same CPU
+template<typename F>
+static int nofault(F access) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    PERCPU_WRITE(nofault, true);
+    int res = access();
+    PERCPU_WRITE(nofault, false);
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    return res;
+}
+
+int arch::load_user_u32(const uint32_t *uaddr, uint32_t *value) {
+    if (!user_word(uaddr)) {
+        return -EFAULT;
+    }
+
+    return nofault([&] { return load_word(uaddr, value); });
+}
+
+int arch::store_user_u32(uint32_t *uaddr, uint32_t value) {
+    if (!user_word(uaddr)) {
+        return -EFAULT;
+    }
+
+    return nofault([&] { return store_word(uaddr, value); });
+}
+
+int arch::cmpxchg_user_u32(uint32_t *uaddr, uint32_t *expected, uint32_t desired) {
+    if (!user_word(uaddr)) {
+        return -EFAULT;
+    }
+
+    return nofault([&] { return cmpxchg_word(uaddr, expected, desired); });
+}
+
+// A locked cmpxchg always writes, so the fault goes through the COW and demand paths even when it doesn't match
+int arch::fault_in_user(uint32_t *uaddr, bool write) {
+    if (!user_word(uaddr)) {
+        return -EFAULT;
+    }
+
+    uint32_t value = 0;
+    if (write) {
+        return cmpxchg_word(uaddr, &value, 0) < 0 ? -EFAULT : 0;
+    }
+
+    return load_word(uaddr, &value);
+}
@@ -12,7 +12,7 @@ struct [[gnu::packed]] exception_entry {
 };
 
 exception_entry *ex_table_begin = (exception_entry *) &_ex_table_begin;
-exception_entry *ex_table_end = (exception_entry *) &ex_table_end;
+exception_entry *ex_table_end = (exception_entry *) &_ex_table_end;
 
 exception_entry *search_exceptions(uint64_t rip) {
     exception_entry *current = ex_table_begin;
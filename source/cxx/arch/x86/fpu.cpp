@@ -0,0 +1,205 @@
+#include <arch/x86/fpu.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <mm/arena.hpp>
+#include <prs/allocator.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/log/log.hpp>
+#include <util/string.hpp>
+
+size_t x86::fpu::area_size = x86::fpu::LEGACY_AREA_SIZE;
+x86::fpu::save_mode x86::fpu::mode = x86::fpu::save_mode::FXSAVE;
+
+static log::subsystem logger = log::make_subsystem("FPU");
+static uint64_t xcr0 = 0;
+static char *default_area = nullptr;
+static prs::allocator area_allocator{
+    arena::create_resource()
+};
+
+static const char *mode_names[] = {
+    "fxsave",
+    "xsave",
+    "xsaveopt",
+    "xsaves"
+};
+
+void x86::fpu::init() {
+    uint64_t cr0 = read_cr0();
+    cr0 &= ~(1 << 2);
+    cr0 |= (1 << 1);
+    write_cr0(cr0);
+
+    uint64_t cr4 = read_cr4();
+    cr4 |= (1 << 9);
+    cr4 |= (1 << 10);
+
+    auto features = cpuid(1);
+    bool has_xsave = features.ecx & (1 << 26);
+    if (has_xsave) {
+        cr4 |= (1 << 18);
+    }
+
+    write_cr4(cr4);
+
+    if (has_xsave) {
+        auto xstate = cpuid(0xD, 0);
+        auto xstate_ext = cpuid(0xD, 1);
+
+        xcr0 = ((((uint64_t) xstate.edx) << 32) | xstate.eax) & XCR0_USER_MASK;
+        xsetbv(0, xcr0);
+
+        if (xstate_ext.eax & (1 << 3)) {
+            wrmsr(MSR_XSS, 0);
+            mode = save_mode::XSAVES;
+            area_size = cpuid(0xD, 1).ebx;
+        } else {
+            mode = (xstate_ext.eax & (1 << 0)) ? save_mode::XSAVEOPT : save_mode::XSAVE;
+            area_size = cpuid(0xD, 0).ebx;
+        }
+    }
+
+    if (default_area == nullptr) {
+        default_area = alloc_area();
+
+        uint16_t fcw = DEFAULT_FCW;
+        uint32_t mxcsr = DEFAULT_MXCSR;
+        asm volatile("fninit");
+        asm volatile("fldcw (%0)":: "r"(&fcw) : "memory");
+        asm volatile("ldmxcsr (%0)" :: "r"(&mxcsr) : "memory");
+
+        save(default_area);
+
+        kmsg(logger, "Using %s, state area of %lu bytes, xcr0: %lx", mode_names[(int) mode], area_size, xcr0);
+    }
+
+    stts();
+    get_locals()->fpu_owner = nullptr;
+    get_locals()->fpu_trapping = true;
+}
+
+char *x86::fpu::alloc_area() {
+    auto area = (char *) area_allocator.allocate(area_size, AREA_ALIGNMENT);
+    memset(area, 0, area_size);
+    return area;
+}
+
+void x86::fpu::free_area(char *area) {
+    if (area) {
+        area_allocator.deallocate(area);
+    }
+}
+
+void x86::fpu::init_area(char *area) {
+    memcpy(area, default_area, area_size);
+}
+
+void x86::fpu::copy_area(char *dst, char *src) {
+    memcpy(dst, src, area_size);
+}
+
+void x86::fpu::save(char *area) {
+    uint32_t low = xcr0 & 0xFFFFFFFF;
+    uint32_t high = xcr0 >> 32;
+
+    switch (mode) {
+        case save_mode::FXSAVE:
+            asm volatile("fxsaveq (%0)":: "r"(area) : "memory");
+            break;
+        case save_mode::XSAVE:
+            asm volatile("xsaveq (%0)":: "r"(area), "a"(low), "d"(high) : "memory");
+            break;
+        case save_mode::XSAVEOPT:
+            asm volatile("xsaveoptq (%0)":: "r"(area), "a"(low), "d"(high) : "memory");
+            break;
+        case save_mode::XSAVES:
+            asm volatile("xsaves64 (%0)":: "r"(area), "a"(low), "d"(high) : "memory");
+            break;
+    }
+}
+
+void x86::fpu::restore(char *area) {
+    uint32_t low = xcr0 & 0xFFFFFFFF;
+    uint32_t high = xcr0 >> 32;
+
+    switch (mode) {
+        case save_mode::FXSAVE:
+            asm volatile("fxrstorq (%0)":: "r"(area) : "memory");
+            break;
+        case save_mode::XSAVE:
+        case save_mode::XSAVEOPT:
+            asm volatile("xrstorq (%0)":: "r"(area), "a"(low), "d"(high) : "memory");
+            break;
+        case save_mode::XSAVES:
+            asm volatile("xrstors64 (%0)":: "r"(area), "a"(low), "d"(high) : "memory");
+            break;
+    }
+}
+
+static void set_trapping(bool trapping) {
+    auto locals = x86::get_locals();
+    if (locals->fpu_trapping == trapping) {
+        return;
+    }
+
+    if (trapping) {
+        x86::stts();
+    } else {
+        x86::clts();
+    }
+
+    locals->fpu_trapping = trapping;
+}
+
+void x86::fpu::flush(sched::thread *task) {
+    auto locals = get_locals();
+    if (locals->fpu_owner != task) {
+        return;
+    }
+
+    set_trapping(false);
+    save(task->ctx.sse_region);
+
+    locals->fpu_owner = nullptr;
+    set_trapping(true);
+}
+
+void x86::fpu::drop(sched::thread *task) {
+    auto locals = get_locals();
+    if (locals->fpu_owner != task) {
+        return;
+    }
+
+    locals->fpu_owner = nullptr;
+    set_trapping(true);
+}
+
+void x86::fpu::switch_to(sched::thread *task) {
+    set_trapping(get_locals()->fpu_owner != task);
+}
+
+bool x86::fpu::handle_nm(arch::irq_regs *r) {
+    auto locals = get_locals();
+    auto task = locals->current_task;
+    if (task == nullptr || task->ctx.sse_region == nullptr) {
+        return false;
+    }
+
+    set_trapping(false);
+
+    auto owner = locals->fpu_owner;
+    if (owner == task) {
+        return true;
+    }
+
+    if (owner) {
+        save(owner->ctx.sse_region);
+    }
+
+    restore(task->ctx.sse_region);
+    locals->fpu_owner = task;
+
+    return true;
+}
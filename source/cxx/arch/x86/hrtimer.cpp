@@ -0,0 +1,277 @@
+#include <arch/types.hpp>
+#include <arch/x86/clocksource.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/timerlat.hpp>
+#include <fs/dev.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <prs/rbtree.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <sys/x86/apic.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+#include <util/log/log.hpp>
+#include <util/log/nanoprintf.h>
+
+static log::subsystem logger = log::make_subsystem("HRTIMER");
+
+// Same period the periodic LAPIC timer used to run the scheduler at
+constexpr uint64_t TICK_NANOS = 20 * sched::NANOS_PER_MILLI;
+constexpr uint64_t CALIBRATE_NANOS = 10 * sched::NANOS_PER_MILLI;
+
+struct hrtimer_less {
+    bool operator() (sched::hrtimer &a, sched::hrtimer &b) {
+        return a.deadline < b.deadline;
+    };
+};
+
+using hrtimer_tree = prs::rbtree<sched::hrtimer, &sched::hrtimer::hook, hrtimer_less>;
+
+struct sched::hrtimer_base {
+    util::spinlock lock;
+    hrtimer_tree tree;
+
+    sched::hrtimer tick;
+    bool tick_due;
+
+    // What the timer interrupt interrupted, while callbacks run
+    arch::irq_regs *regs;
+
+    // How late timers fired, from the deadline to the interrupt handler
+    uint64_t fired;
+    uint64_t overshoot_total;
+    uint64_t overshoot_max;
+
+    hrtimer_base(): lock(), tree(), tick(nullptr, nullptr), tick_due(false), regs(nullptr),
+        fired(0), overshoot_total(0), overshoot_max(0) {}
+};
+
+static DEFINE_PER_CPU(sched::hrtimer_base, bases);
+
+static size_t timer_vector = 0;
+static bool tsc_deadline = false;
+
+// LAPIC timer ticks per nanosecond in 32.32 fixed point
+static uint64_t ns_to_lapic = 0;
+
+static uint64_t scale(uint64_t value, uint64_t mult) {
+    return (uint64_t) (((unsigned __int128) value * mult) >> 32);
+}
+
+// Base lock held, only ever called on the CPU that owns the base
+static void program(sched::hrtimer_base *base) {
+    auto first = base->tree.first();
+
+    if (tsc_deadline) {
+        x86::wrmsr(x86::MSR_TSC_DEADLINE, first ? clocksource::tsc_deadline(first->deadline) : 0);
+        return;
+    }
+
+    if (first == nullptr) {
+        apic::lapic::write(apic::LAPIC_REG_INTERNAL_CNTR, 0);
+        return;
+    }
+
+    uint64_t now = arch::hrtime();
+    uint64_t count = first->deadline > now ? scale(first->deadline - now, ns_to_lapic) : 1;
+    if (count == 0) {
+        count = 1;
+    } else if (count > UINT32_MAX) {
+        count = UINT32_MAX;
+    }
+
+    apic::lapic::write(apic::LAPIC_REG_INTERNAL_CNTR, count);
+}
+
+void arch::add_hrtimer(sched::hrtimer *timer) {
+    auto state = arch::get_irq_state();
+    arch::irq_off();
+
+    auto base = &bases.get();
+    base->lock.lock_noirq();
+
+    timer->base = base;
+    base->tree.insert(timer);
+    if (base->tree.first() == timer) {
+        program(base);
+    }
+
+    base->lock.unlock_noirq();
+
+    if (state) {
+        arch::irq_on();
+    }
+}
+
+// A cancelled timer may still be the one programmed, the interrupt then finds nothing due and re-arms
+bool arch::remove_hrtimer(sched::hrtimer *timer) {
+    auto base = __atomic_load_n(&timer->base, __ATOMIC_ACQUIRE);
+    if (base == nullptr) {
+        return false;
+    }
+
+    util::lock_guard guard{base->lock};
+    if (timer->base != base) {
+        return false;
+    }
+
+    base->tree.remove(timer);
+    __atomic_store_n(&timer->base, nullptr, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void tick_fn(void *aux) {
+    auto base = (sched::hrtimer_base *) aux;
+    base->tick_due = true;
+
+    // Stay on the period grid, but don't try to catch up on ticks that were missed
+    uint64_t now = arch::hrtime();
+    base->tick.deadline += TICK_NANOS;
+    if (base->tick.deadline <= now) {
+        base->tick.deadline = now + TICK_NANOS;
+    }
+
+    arch::add_hrtimer(&base->tick);
+}
+
+static void hrtimer_handler(arch::irq_regs *r) {
+    auto base = &bases.get();
+    base->lock.lock_noirq();
+    base->regs = r;
+
+    uint64_t now = arch::hrtime();
+    while (auto timer = base->tree.first()) {
+        if (timer->deadline > now) {
+            break;
+        }
+
+        base->tree.remove(timer);
+        __atomic_store_n(&timer->base, nullptr, __ATOMIC_RELEASE);
+
+        uint64_t overshoot = now - timer->deadline;
+        base->fired++;
+        base->overshoot_total += overshoot;
+        if (overshoot > base->overshoot_max) {
+            base->overshoot_max = overshoot;
+        }
+
+        // Callbacks take wait queue locks that are held around add_hrtimer, so fire them unlocked
+        base->lock.unlock_noirq();
+        timer->fn(timer->aux);
+        base->lock.lock_noirq();
+
+        now = arch::hrtime();
+    }
+
+    program(base);
+
+    base->regs = nullptr;
+    bool tick = base->tick_due;
+    base->tick_due = false;
+    base->lock.unlock_noirq();
+
+    if (tick) {
+        sched::swap_task(r);
+    }
+}
+
+arch::irq_regs *x86::hrtimer_regs() {
+    return bases.get().regs;
+}
+
+// The clocksource has to be up, the LAPIC timer is calibrated against it
+void x86::init_hrtimers() {
+    apic::lapic::write(apic::LAPIC_REG_LVT_TIMR, apic::LAPIC_LVT_MASK);
+    apic::lapic::write(apic::LAPIC_REG_DCR, 0x3);
+    apic::lapic::write(apic::LAPIC_REG_INTERNAL_CNTR, ~0);
+
+    uint64_t start = arch::hrtime();
+    uint64_t end;
+    while ((end = arch::hrtime()) - start < CALIBRATE_NANOS) {
+        asm volatile("pause");
+    }
+
+    uint64_t lapic_ticks = (uint32_t) ~0 - apic::lapic::read(apic::LAPIC_REG_CURR_CNTR);
+    apic::lapic::write(apic::LAPIC_REG_INTERNAL_CNTR, 0);
+
+    uint64_t lapic_khz = lapic_ticks * sched::NANOS_PER_MILLI / (end - start);
+    ns_to_lapic = (lapic_khz << 32) / sched::NANOS_PER_MILLI;
+
+    // Deadlines are in TSC ticks, so the TSC has to be what the clock runs on
+    tsc_deadline = ((x86::cpuid(1).ecx >> 24) & 1) && clocksource::tsc_in_use();
+
+    timer_vector = x86::alloc_vector();
+    x86::install_vector(timer_vector, hrtimer_handler);
+
+    kmsg(logger, "LAPIC timer at %lu kHz, %s mode", lapic_khz, tsc_deadline ? "TSC-deadline" : "one-shot");
+}
+
+void x86::start_hrtimers() {
+    if (tsc_deadline) {
+        apic::lapic::write(apic::LAPIC_REG_LVT_TIMR, timer_vector | apic::LAPIC_TIMER_TSC_DEADLINE);
+        // The LVT write has to land before the first deadline MSR write
+        asm volatile("mfence" ::: "memory");
+    } else {
+        apic::lapic::write(apic::LAPIC_REG_DCR, 0x3);
+        apic::lapic::write(apic::LAPIC_REG_LVT_TIMR, timer_vector | apic::LAPIC_TIMER_ONESHOT);
+    }
+
+    auto base = &bases.get();
+    base->tick.fn = tick_fn;
+    base->tick.aux = base;
+    base->tick.deadline = arch::hrtime() + TICK_NANOS;
+    arch::add_hrtimer(&base->tick);
+}
+
+void timerlat::init() {
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::TIMERLAT, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::TIMERLAT);
+}
+
+// One line per CPU
+ssize_t timerlat::device::read(void *buf, size_t len, size_t offset) {
+    char line[128];
+
+    return vfs::devfs::copy_lines(buf, len, offset, line, sizeof(line), [](size_t i, char *out, size_t size) -> ssize_t {
+        if (i == 0) {
+            return npf_snprintf(out, size, "%-4s %12s %14s %14s\n",
+                "cpu", "fired", "avg_late_ns", "max_late_ns");
+        } else if (i > x86::cpus.size()) {
+            return -1;
+        }
+
+        auto base = &bases[x86::cpus[i - 1]->cpu_number];
+
+        bool state = base->lock.lock_irqsave();
+        uint64_t fired = base->fired;
+        uint64_t total = base->overshoot_total;
+        uint64_t max = base->overshoot_max;
+        base->lock.unlock_irqrestore(state);
+
+        return npf_snprintf(out, size, "%-4lu %12lu %14lu %14lu\n",
+            i - 1, fired, fired ? total / fired : 0, max);
+    });
+}
+
+ssize_t timerlat::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto base = &bases[x86::cpus[i]->cpu_number];
+
+        util::lock_guard guard{base->lock};
+        base->fired = 0;
+        base->overshoot_total = 0;
+        base->overshoot_max = 0;
+    }
+
+    return len;
+}
@@ -1,17 +1,22 @@
 #include "mm/common.hpp"
 #include <cstddef>
 #include <cstdint>
+#include <mm/kstack.hpp>
 #include <mm/mm.hpp>
 #include <mm/vmm.hpp>
 #include <sys/x86/apic.hpp>
 #include <util/log/log.hpp>
 #include <util/log/panic.hpp>
 #include <util/io.hpp>
+#include <util/ksym.hpp>
+#include <util/trace.hpp>
 #include <arch/types.hpp>
 #include <arch/x86/types.hpp>
+#include <sys/sched/preempt.hpp>
 #include <sys/sched/signal.hpp>
 #include <sys/sched/sched.hpp>
 #include <arch/x86/smp.hpp>
+#include <arch/x86/fpu.hpp>
 
 const char *exceptions[] = {
 	"Divide by zero",
@@ -106,7 +111,10 @@ void x86::install_vector(size_t vector, irq_ext handler, void *aux) {
 
 static log::subsystem logger = log::make_subsystem("IRQ");
 void trace(arch::irq_regs *r) {
+    char sym[128];
+    ksym::format(r->rip, sym, sizeof(sym));
     kmsg(logger, "stracktrace: ");
+    kmsg(logger, "  rip %lx %s", r->rip, sym);
 
     size_t max_frames = 10;
     size_t parsed = 0;
@@ -120,7 +128,8 @@ void trace(arch::irq_regs *r) {
         }
 
         rbp = memory::add_virt(stack[0]);
-        kmsg(logger, "  rip %lx, rbp: %lx", stack[1], stack[0]);
+        ksym::format(stack[1], sym, sizeof(sym));
+        kmsg(logger, "  rip %lx %s, rbp: %lx", stack[1], sym, stack[0]);
 
         parsed++;
         if (!rbp || parsed == max_frames) {
@@ -139,6 +148,12 @@ extern "C" {
         uint64_t cr2 = 0;
         asm volatile("movq %%cr2, %0" : "=r"(cr2));
 
+        if (r->int_no == 7) {
+            if (x86::fpu::handle_nm(r)) {
+                goto end_isr;
+            }
+        }
+
         if (r->int_no == 14) {
             if (x86::handle_pf(r) || x86::handle_user_exception(r)) {
                 x86::write_cr3(cr3);
@@ -171,6 +186,10 @@ extern "C" {
                                 r->err, r->rip,
                                 cr2, cr3,
                                 r->cs, r->ss, r->rflags);                
+                if ((r->int_no == 14 || r->int_no == 8) && kstack::in_guard(cr2)) {
+                    kmsg(logger, log::level::ERR, "Kernel stack overflow into the guard page at %lx", cr2 & ~(memory::page_size - 1));
+                }
+
                 if (r->int_no == 14) {
                     kmsg(logger, "# PF Flags: ");
                     if (r->err & (1 << 0)) { kmsg(logger, "  P"); } else { kmsg(logger, "  NP"); }
@@ -227,11 +246,19 @@ extern "C" {
         }
 
         if (handlers[r->int_no].fn.reg || handlers[r->int_no].fn.ext) {
+            TRACE(irq_entry, r->int_no);
             if (handlers[r->int_no].aux) {
                 handlers[r->int_no].fn.ext(r, handlers[r->int_no].aux);
             } else {
                 handlers[r->int_no].fn.reg(r);
             }
+            TRACE(irq_exit, r->int_no);
+        }
+
+        // A reschedule that came due while the interrupted code held the preempt count is picked
+        // up on its next interrupt return, or by preempt_enable
+        if (sched::need_resched() && sched::preemptible() && (r->rflags & 0x200)) {
+            sched::swap_task(r);
         }
 
         end_isr:
@@ -556,7 +583,8 @@ void x86::init_irqs() {
     x86::set_ist(11, 2);
     x86::set_ist(12, 2);
     x86::set_ist(13, 2);
-    x86::set_ist(14, 2);
+    // #PF stays on the faulting task's stack, handle_pf may sleep. A fault on a stack's
+    // guard page can't push its frame and ends up as #DF, which has its own
     x86::set_ist(15, 2);
     x86::set_ist(16, 2);
     x86::set_ist(17, 2);
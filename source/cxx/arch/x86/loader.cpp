@@ -2,6 +2,7 @@
 #include "util/types.hpp"
 #include <sys/sched/sched.hpp>
 #include <arch/x86/types.hpp>
+#include <arch/x86/vdso.hpp>
 #include <arch/types.hpp>
 #include <sys/namespace.hpp>
 
@@ -44,6 +45,7 @@ bool sched::process_env::load_elf(const char *path, shared_ptr<vfs::fd> fd) {
 
     entry = file.aux.at_entry;
     has_interp = file.load_interp(&interp_path);
+    vdso_base = vdso::map(proc->mem_ctx);
 
     vfs::close(fd);
 
@@ -105,7 +107,7 @@ uint64_t *sched::process_env::place_args(uint64_t *location) {
 }
 
 uint64_t *sched::process_env::place_auxv(uint64_t *location) {
-    location -= 10;
+    location -= 12;
 
     location[0] = ELF_AT_PHNUM;
     location[1] = file.aux.at_phnum;
@@ -119,7 +121,10 @@ uint64_t *sched::process_env::place_auxv(uint64_t *location) {
     location[6] = ELF_AT_ENTRY;
     location[7] = file.aux.at_entry;
 
-    location[8] = 0; location[9] = 0;
+    location[8] = ELF_AT_SYSINFO_EHDR;
+    location[9] = vdso_base;
+
+    location[10] = 0; location[11] = 0;
 
     return location;
 }
@@ -1,5 +1,8 @@
+#include "arch/x86/clocksource.hpp"
+#include "arch/x86/fpu.hpp"
 #include "arch/x86/hpet.hpp"
 #include "arch/x86/pit.hpp"
+#include "arch/x86/vdso.hpp"
 #include "ipc/evtable.hpp"
 #include "mm/arena.hpp"
 #include "mm/mm.hpp"
@@ -13,21 +16,35 @@
 #include <arch/x86/types.hpp>
 #include <arch/x86/smp.hpp>
 #include <cstddef>
+#include <sys/sched/cgroup.hpp>
+#include <sys/sched/preempt.hpp>
 #include <sys/sched/sched.hpp>
+#include <util/trace.hpp>
 #include <atomic>
 
-arch::sched_regs default_kernel_regs{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10, 0x8, 0, 0, 0x202, 0, 0x1F80, 0x33F };
-arch::sched_regs default_user_regs{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x23, 0x1B, 0, 0, 0x202, 0, 0x1F80, 0x33F };
-
-alignas(16)
-char default_sse_region[512] {};
+arch::sched_regs default_kernel_regs{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10, 0x8, 0, 0, 0x202, 0 };
+arch::sched_regs default_user_regs{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x23, 0x1B, 0, 0, 0x202, 0 };
 
 extern "C" {
     extern void syscall_enter();
 }
 
+static void restore_irqs(bool irqs_enabled) {
+    if (irqs_enabled) {
+        arch::irq_on();
+    } else {
+        arch::irq_off();
+    }
+}
+
 static void _idle() {
-    while (1) { asm volatile("hlt"); };
+    while (1) {
+        x86::irq_off();
+        sched::rcu::quiescent();
+        x86::irq_on();
+
+        asm volatile("hlt");
+    };
 }
 
 void x86::handle_tick(arch::irq_regs *r) {
@@ -42,52 +59,6 @@ void x86::do_tick() {
     apic::lapic::ipi(x86::get_cpu(), 32);
 }
 
-void x86::save_sse(char *sse_region) {
-    asm volatile("fxsaveq (%0)":: "r"(sse_region));
-}
-
-void x86::load_sse(char *sse_region) {
-    asm volatile("fxrstor (%0)":: "r"(sse_region));
-}
-
-uint16_t x86::get_fcw() {
-    uint16_t fcw;
-    asm volatile("fnstcw (%0)":: "r"(&fcw) : "memory");
-    return fcw;
-}
-
-void x86::set_fcw(uint16_t fcw) {
-    asm volatile("fldcw (%0)":: "r"(&fcw) : "memory");
-}
-
-uint32_t x86::get_mxcsr() {
-    uint32_t fcw;
-    asm volatile("stmxcsr (%0)" :: "r"(&fcw) : "memory");
-    return fcw;
-}
-
-void x86::set_mxcsr(uint32_t fcw) {
-    asm volatile("ldmxcsr (%0)" :: "r"(&fcw) : "memory");
-}
-
-void x86::init_sse() {
-    uint64_t cr0;
-    asm volatile("mov %%cr0, %0": "=r"(cr0));
-
-    cr0 &= ~(1 << 2);
-    cr0 |= (1 << 1);
-
-    asm volatile("mov %0, %%cr0":: "r"(cr0));
-
-    uint64_t cr4;
-    asm volatile("mov %%cr4, %0": "=r"(cr4));
-
-    cr4 |= (1 << 9);
-    cr4 |= (1 << 10);
-
-    asm volatile("mov %0, %%cr4":: "r"(cr4));
-}
-
 void arch::init_sched() {
     x86::install_handlers();
     apic::init();
@@ -100,8 +71,10 @@ void x86::init_bsp() {
     auto processor = prs::construct<x86::processor>(prs::allocator{slab::create_resource()}, apic::lapic::id(),
         prs::construct<x86::run_tree>(prs::allocator{slab::create_resource()}));
 
+    processor->rt_queue = prs::construct<x86::rt_queue>(prs::allocator{slab::create_resource()});
     processor->kstack = (size_t) pmm::stack(x86::initialStackSize);
     processor->ctx = vmm::boot;
+    processor->cpu_number = cpus.size();
     processor->last_balance = 0;
 
     x86::wrmsr(x86::MSR_GS_BASE, processor);
@@ -110,21 +83,24 @@ void x86::init_bsp() {
     arch::irq_on();
 
     init_syscalls();
-    init_sse();
-    save_sse(default_sse_region);
+    fpu::init();
     init_idle();
 
     hpet::init();
     pit::init();
 
     x86::install_vector(32, x86::handle_tick);
-    apic::lapic::set_timer(1);
+    vdso::init();
+    clocksource::init();
+    x86::init_hrtimers();
+    x86::start_hrtimers();
 }
 
 void x86::init_ap() {
     x86::get_locals()->last_balance = 0;
+    clocksource::init_ap();
     init_syscalls();
-    init_sse();
+    fpu::init();
     init_idle();
 }
 
@@ -165,73 +141,219 @@ void x86::cleanup_vmm_ctx(sched::process *process) {
     vmm::destroy(old_ctx);
 }
 
-x86::processor *x86::least_loaded_cpu() {
+static x86::processor *pick_least_loaded(sched::cpu_set *mask, bool allow_isolated) {
     x86::processor *lowest_load = nullptr;
     for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto cpu = x86::cpus[i];
+        if (mask && !mask->isset(cpu->cpu_number)) continue;
+        if (cpu->isolated && !allow_isolated) continue;
+
         if (lowest_load) {
-            if (lowest_load->load_average > x86::cpus[i]->load_average) lowest_load = x86::cpus[i];
+            if (lowest_load->load_average > cpu->load_average) lowest_load = cpu;
         } else {
-            lowest_load = x86::cpus[i];
+            lowest_load = cpu;
         }
     }
 
     return lowest_load;
 }
 
+x86::processor *x86::least_loaded_cpu(sched::cpu_set *mask) {
+    auto lowest_load = pick_least_loaded(mask, false);
+    if (lowest_load == nullptr) {
+        lowest_load = pick_least_loaded(mask, true);
+    }
+
+    return lowest_load;
+}
+
 void arch::init_thread(sched::thread *task) {
-    auto lowest_load = x86::least_loaded_cpu();
+    auto lowest_load = x86::least_loaded_cpu(&task->affinity);
+    if (lowest_load == nullptr) {
+        lowest_load = x86::least_loaded_cpu();
+    }
+
+    // Run queues are only touched on their own CPU with interrupts off, syscalls (fork, clone)
+    // get here with them on and could be preempted or moved between the check and the enqueue
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
 
     if (lowest_load->processor_id == x86::get_cpu()) 
         x86::init_thread(task);
     else 
         x86::message_processor(lowest_load->processor_id, x86::ipi_events::INIT_TASK, task);
+
+    restore_irqs(irqs_enabled);
 }
 
 void arch::start_thread(sched::thread *task) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
     if (task->ctx.cpu == x86::get_cpu()) 
         x86::start_thread(task);
     else 
         x86::message_processor(task->ctx.cpu, x86::ipi_events::START_TASK, task);
+
+    restore_irqs(irqs_enabled);
 }
 
 void arch::stop_thread(sched::thread *task) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
     if (task->ctx.cpu == x86::get_cpu()) 
         x86::stop_thread(task);
     else 
         x86::message_processor(task->ctx.cpu, x86::ipi_events::STOP_TASK, task);
+
+    restore_irqs(irqs_enabled);
 }
 
 void arch::kill_thread(sched::thread *task) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
     if (task->ctx.cpu == x86::get_cpu()) 
         x86::kill_thread(task);
     else 
         x86::message_processor(task->ctx.cpu, x86::ipi_events::KILL_TASK, task);
+
+    restore_irqs(irqs_enabled);
+}
+
+static uint64_t mono_nanos() {
+    return arch::hrtime();
+}
+
+void x86::enqueue_task(x86::processor *cpu, sched::thread *task) {
+    if (task->on_rq) {
+        return;
+    }
+
+    task->on_rq = true;
+    if (task->policy == sched::SCHED_OTHER) {
+        cpu->run_tree->insert(task);
+    } else {
+        task->rr_started = mono_nanos();
+        cpu->rt_queue->enqueue(task);
+    }
+}
+
+void x86::dequeue_task(x86::processor *cpu, sched::thread *task) {
+    if (!task->on_rq) {
+        return;
+    }
+
+    task->on_rq = false;
+    if (task->policy == sched::SCHED_OTHER) {
+        cpu->run_tree->remove(task);
+    } else {
+        cpu->rt_queue->dequeue(task);
+    }
+}
+
+static bool should_preempt(sched::thread *task) {
+    if (task->policy == sched::SCHED_OTHER) {
+        return false;
+    }
+
+    auto current = x86::get_thread();
+    if (current == nullptr || current->tid == arch::get_idle_tid() || current->policy == sched::SCHED_OTHER) {
+        return !x86::get_locals()->rt_queue->throttled();
+    }
+
+    return task->rt_priority > current->rt_priority;
 }
 
 void x86::init_thread(sched::thread *task) {
-    auto run_tree = get_locals()->run_tree;
     auto tid = arch::allocate_tid();
 
     task->tid = tid;
     task->ctx.cpu = get_cpu();
-    run_tree->insert(task);
+    enqueue_task(get_locals(), task);
 }
 
 void x86::start_thread(sched::thread *task) {
+    if (task->state == sched::thread::DEAD) {
+        return;
+    }
+
     task->state = sched::thread::READY;
+    enqueue_task(get_locals(), task);
+    TRACE(sched_wakeup, task->tid, (uint32_t) get_cpu_number());
+
+    // start_thread runs on the task's CPU, remote wakeups arrive here through START_TASK
+    if (should_preempt(task)) {
+        sched::set_need_resched();
+        do_tick();
+    }
+}
+
+void x86::set_scheduler(sched::thread *task) {
+    auto cpu = get_locals();
+    bool queued = task->on_rq;
+    dequeue_task(cpu, task);
+
+    task->policy = task->pending_policy;
+    task->rt_priority = task->policy == sched::SCHED_OTHER ? 0 : task->pending_priority;
+
+    if (queued) {
+        enqueue_task(cpu, task);
+    }
+
+    if (task->state == sched::thread::READY && should_preempt(task)) {
+        sched::set_need_resched();
+        do_tick();
+    }
+}
+
+void arch::set_scheduler(sched::thread *task, int policy, int priority) {
+    task->pending_policy = policy;
+    task->pending_priority = priority;
+
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    if (task->ctx.cpu == x86::get_cpu())
+        x86::set_scheduler(task);
+    else
+        x86::message_processor(task->ctx.cpu, x86::ipi_events::SET_SCHEDULER, task);
+
+    restore_irqs(irqs_enabled);
 }
 
 void x86::stop_thread(sched::thread *task) {
+    if (task->state == sched::thread::DEAD) {
+        return;
+    }
+
+    // Blocked tasks leave the run queue entirely, a wakeup puts them back through start_thread
     task->state = sched::thread::BLOCKED;
+    dequeue_task(get_locals(), task);
 }
 
 void x86::kill_thread(sched::thread *task) {
-    auto run_tree = get_locals()->run_tree;
-    run_tree->remove(task);
+    dequeue_task(get_locals(), task);
+    fpu::drop(task);
 
     task->state = sched::thread::DEAD;
 }
 
+void arch::cleanup_context(sched::thread *task) {
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        if (x86::cpus[i]->fpu_owner == task) {
+            x86::cpus[i]->fpu_owner = nullptr;
+        }
+    }
+
+    x86::fpu::free_area(task->ctx.sse_region);
+    x86::fpu::free_area(task->ucontext.ctx.sse_region);
+
+    task->ctx.sse_region = nullptr;
+    task->ucontext.ctx.sse_region = nullptr;
+}
+
 void arch::init_context(sched::thread *task, void (*main)(), uint64_t rsp, uint8_t privilege) {
     if (privilege == 3) {
         task->ctx.reg = default_user_regs;
@@ -239,7 +361,12 @@ void arch::init_context(sched::thread *task, void (*main)(), uint64_t rsp, uint8
         task->ctx.reg = default_kernel_regs;
     }
 
-    memcpy(task->ctx.sse_region, default_sse_region, 512);
+    if (task->ctx.sse_region == nullptr) {
+        task->ctx.sse_region = x86::fpu::alloc_area();
+    }
+
+    x86::fpu::drop(task);
+    x86::fpu::init_area(task->ctx.sse_region);
 
     task->ctx.reg.rip = (uint64_t) main;
     task->ctx.reg.rsp = rsp;
@@ -277,7 +404,12 @@ void arch::fork_context(sched::thread *original, sched::thread *task, irq_regs *
     task->ctx.reg.fs = original->ctx.reg.fs;
     task->ctx.reg.gs = original->ctx.reg.gs;
 
-    memcpy(task->ctx.sse_region, original->ctx.sse_region, 512);
+    if (task->ctx.sse_region == nullptr) {
+        task->ctx.sse_region = x86::fpu::alloc_area();
+    }
+
+    x86::fpu::flush(original);
+    x86::fpu::copy_area(task->ctx.sse_region, original->ctx.sse_region);
 
     task->ctx.privilege = original->ctx.privilege;
     task->ctx.reg.cr3 = x86::get_cr3(task->mem_ctx->get_page_map());
@@ -310,15 +442,18 @@ void arch::save_context(irq_regs *r, sched::thread *task) {
     task->ctx.reg.fs = x86::get_user_fs();
     task->ctx.reg.gs = x86::get_user_gs();
 
-    x86::save_sse(task->ctx.sse_region);
-    task->ctx.reg.mxcsr = x86::get_mxcsr();
-    task->ctx.reg.fcw = x86::get_fcw();
-
     task->kstack = x86::get_locals()->kstack;
     task->ustack = x86::get_locals()->ustack;
 
     task->stopped = x86::tsc();
-    task->uptime += task->stopped - task->started;
+    uint64_t ran = task->stopped - task->started;
+
+    // A heavier group's tasks advance slower through the run tree and so get picked more often
+    task->uptime += ran * sched::cgroup::DEFAULT_WEIGHT / sched::cgroup::weight(task);
+    sched::charge_time(task, r->cs & 0x3);
+    if (task->tid != get_idle_tid()) {
+        sched::cgroup::charge_cpu(task, clocksource::tsc_to_ns(ran));
+    }
 
     task->ctx.reg.cr3 = x86::read_cr3();
 
@@ -331,9 +466,25 @@ void arch::save_context(irq_regs *r, sched::thread *task) {
     }
 
     if (task->tid != get_idle_tid()) {
-        auto run_tree = x86::get_locals()->run_tree;
-        run_tree->remove(task);
-        run_tree->insert(task);
+        auto cpu = x86::get_locals();
+        if (task->policy == sched::SCHED_OTHER) {
+            if (task->on_rq) {
+                cpu->run_tree->remove(task);
+                cpu->run_tree->insert(task);
+            }
+        } else {
+            auto now = mono_nanos();
+            if (cpu->rt_queue->dispatched) {
+                cpu->rt_queue->runtime += now - cpu->rt_queue->dispatched;
+                cpu->rt_queue->dispatched = 0;
+            }
+
+            // FIFO tasks keep their place until they block, RR tasks rotate on slice expiry
+            if (task->on_rq && task->policy == sched::SCHED_RR && now - task->rr_started >= x86::RR_TIMESLICE) {
+                x86::dequeue_task(cpu, task);
+                x86::enqueue_task(cpu, task);
+            }
+        }
     }
 }
 
@@ -364,91 +515,24 @@ void arch::rstor_context(sched::thread *task, irq_regs *r) {
     x86::set_user_fs(task->ctx.reg.fs);
     x86::set_user_gs(task->ctx.reg.gs);
 
-    x86::load_sse(task->ctx.sse_region);
-    x86::set_mxcsr(task->ctx.reg.mxcsr);
-    x86::set_fcw(task->ctx.reg.fcw);
+    x86::fpu::switch_to(task);
+
+    if (task->policy != sched::SCHED_OTHER && task->tid != get_idle_tid()) {
+        x86::get_locals()->rt_queue->dispatched = mono_nanos();
+    }
 
     x86::get_locals()->kstack = task->kstack;
     x86::get_locals()->tss.rsp0 = task->kstack;
     x86::get_locals()->ustack = task->ustack;
 
     task->started = x86::tsc();
+    task->acct_stamp = task->started;
 
     if (x86::read_cr3() != task->ctx.reg.cr3) {
         x86::write_cr3(task->ctx.reg.cr3);
     }
 }
 
-int arch::do_futex(uintptr_t vaddr, int op, uint32_t expected, sched::timespec *timeout) {
-    return x86::do_futex(vaddr, op, expected, timeout);
-}
-
-static frg::hash_map<uint64_t, sched::futex *, frg::hash<uint64_t>, prs::allocator> 
-    futex_list{
-        frg::hash<uint64_t>(),
-        arena::create_resource()
-    };
-ssize_t x86::do_futex(uintptr_t vaddr, int op, uint32_t expected, sched::timespec *timeout) {
-    auto process = x86::get_process();
-
-    uint64_t vpage = vaddr & ~(0xFFF);
-    uint64_t ppage = (uint64_t) process->mem_ctx->resolve((void *) vpage);
-
-    if (!ppage) {
-        return -EFAULT;
-    }
-
-    uint64_t paddr = ppage + (vaddr & 0xFFF);
-    uint64_t uaddr = paddr + memory::x86::virtualBase;
-    switch (op) {
-        case sched::FUTEX_WAIT: {
-            if (*(uint32_t *) uaddr != expected) {
-                return -EAGAIN;
-            }
-
-            sched::futex *futex;
-            if (!futex_list.contains(paddr)) {
-                futex = prs::construct<sched::futex>(prs::allocator{slab::create_resource()}, paddr);
-                futex_list[paddr] = futex;
-            } else {
-                futex = futex_list[paddr];
-            }
-
-            futex->locked = 1;
-            for (;;) {
-                if (futex->locked == 0) {
-                    break;
-                }
-
-                auto [evt, _] = futex->wire.wait(evtable::FUTEX_WAKE, true);
-                if (evt < 0) {
-                    return -1;
-                }
-            }
-
-            break;
-        }
-
-        case sched::FUTEX_WAKE: {
-            sched::futex *futex;
-            if (!futex_list.contains(paddr)) {
-                return 0;
-            } else {
-                futex = futex_list[paddr];
-            }
-
-            futex_list.remove(futex->paddr);
-
-            futex->locked = 0;
-            futex->wire.arise(evtable::FUTEX_WAKE);
-
-            break;
-        }
-    }
-
-    return 0;
-}
-
 static std::atomic<pid_t> last_pid = 0;
 static std::atomic<tid_t> last_tid = 0;
 
@@ -470,7 +554,7 @@ size_t calc_total_tasks() {
         current = run_tree->successor(current);
     }
 
-    return total_tasks;
+    return total_tasks + x86::get_locals()->rt_queue->nr_tasks;
 }
 
 // Exponential moving average load average, ripped from Linux
@@ -484,15 +568,93 @@ void x86::calc_average_load(x86::processor *cpu) {
     cpu->load_average >>= fixed_precision;
 }
 
+static void migrate_task(sched::thread *task, x86::processor *target) {
+    TRACE(sched_migrate, task->tid, (uint32_t) x86::get_cpu_number(), (uint32_t) target->cpu_number);
+    x86::dequeue_task(x86::get_locals(), task);
+    x86::fpu::flush(task);
+    x86::message_processor(target->processor_id, x86::GIVE_OWNERSHIP, task);
+}
+
+static bool affinity_migrate(sched::thread *task, size_t cpu_number) {
+    if (task->affinity.isset(cpu_number)) {
+        return false;
+    }
+
+    auto target = x86::least_loaded_cpu(&task->affinity);
+    if (target == nullptr || target == x86::get_locals()) {
+        return false;
+    }
+
+    migrate_task(task, target);
+    return true;
+}
+
+static sched::thread *pick_rt_task(x86::rt_queue *rt, size_t cpu_number, bool& migrated) {
+    for (int prio = rt->highest(); prio >= 0; prio = rt->highest(prio - 1)) {
+        auto task = rt->queues[prio].front();
+        while (task) {
+            auto next = rt->queues[prio].next(task);
+
+            if (!migrated && affinity_migrate(task, cpu_number)) {
+                migrated = true;
+            } else if (task->state == sched::thread::READY || task->dispatch_ready) {
+                return task;
+            }
+
+            task = next;
+        }
+
+        if (prio == 0) break;
+    }
+
+    return nullptr;
+}
+
 frg::tuple<tid_t, sched::thread *> sched::pick_task() {
     sched::balance_tasks();
 
-    auto run_tree = x86::get_locals()->run_tree;
+    auto locals = x86::get_locals();
+    auto run_tree = locals->run_tree;
+    auto rt = locals->rt_queue;
+    auto cpu_number = x86::get_cpu_number();
+    bool migrated = false;
+
+    auto now = mono_nanos();
+    if (now - rt->period_start >= x86::RT_PERIOD) {
+        rt->period_start = now;
+        rt->runtime = 0;
+    }
+
+    // Throttled RT tasks still run when the fair class has nothing ready
+    bool throttled = rt->throttled();
+    if (rt->nr_tasks && !throttled) {
+        auto task = pick_rt_task(rt, cpu_number, migrated);
+        if (task) return {task->tid, task};
+    }
+
     auto next_task = run_tree->first();
     while (next_task != nullptr) {
-        if (next_task->state == thread::READY || next_task->dispatch_ready) return {next_task->tid, next_task};
+        auto successor = run_tree->successor(next_task);
+
+        // Affinity changed since the task was placed here, hand it to an allowed CPU
+        if (!migrated && affinity_migrate(next_task, cpu_number)) {
+            migrated = true;
+
+            next_task = successor;
+            continue;
+        }
+
+        // Over its group's quota, the tick comes back for it once the period rolls over
+        if ((next_task->state == thread::READY || next_task->dispatch_ready) && !cgroup::throttled(next_task)) {
+            return {next_task->tid, next_task};
+        }
+
+        next_task = successor;
+    }
 
-        next_task = run_tree->successor(next_task);
+    if (rt->nr_tasks && throttled) {
+        auto task = pick_rt_task(rt, cpu_number, migrated);
+        if (task) return {task->tid, task};
     }
 
     return {-1, arch::get_idle()};
@@ -503,29 +665,27 @@ constexpr size_t AVERAGE_INTERVAL = 60;
 constexpr size_t BALANCE_THRESHOLD = 500;
 void sched::balance_tasks() {
     x86::calc_average_load(x86::get_locals());
-    if (clock_mono.tv_sec > x86::get_locals()->last_balance + BALANCE_INTERVAL) {
+    if (clock_mono().tv_sec > x86::get_locals()->last_balance + BALANCE_INTERVAL) {
         if (x86::get_locals()->load_average > BALANCE_THRESHOLD) {
             auto least_loaded = x86::least_loaded_cpu();
             auto run_tree = x86::get_locals()->run_tree;
             auto task = run_tree->last();
             while (task) {
-                if (task->ctx.privilege == 3) break;
-                task = run_tree->successor(task);
+                if (task->ctx.privilege == 3 && task->affinity.isset(least_loaded->cpu_number)) break;
+                task = run_tree->predecessor(task);
             }
 
-            if (least_loaded->processor_id != x86::get_cpu() &&
-                (task && task->ctx.privilege == 3)) {
-                run_tree->remove(task);
-                x86::message_processor(least_loaded->processor_id, x86::GIVE_OWNERSHIP, task);                
+            if (least_loaded->processor_id != x86::get_cpu() && task) {
+                migrate_task(task, least_loaded);
             }
         }
 
-        x86::get_locals()->last_balance = clock_mono.tv_sec;
+        x86::get_locals()->last_balance = clock_mono().tv_sec;
     }
 
-    if (clock_mono.tv_sec > x86::get_locals()->last_average + AVERAGE_INTERVAL) {
+    if (clock_mono().tv_sec > x86::get_locals()->last_average + AVERAGE_INTERVAL) {
         debug("CPU Load Average: %d", x86::get_locals()->load_average);
-        x86::get_locals()->last_average = clock_mono.tv_sec;
+        x86::get_locals()->last_average = clock_mono().tv_sec;
         x86::get_locals()->load_average = 0;
     }    
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "ipc/evtable.hpp"
 #include "mm/common.hpp"
 #include "util/lock.hpp"
+#include <arch/x86/fpu.hpp>
 #include <arch/x86/smp.hpp>
 #include <arch/x86/types.hpp>
 #include <arch/types.hpp>
@@ -25,12 +26,12 @@ void x86::sigreturn_default(sched::process *proc, sched::thread *task) {
     irq_off();
 
     auto ctx = &task->sig_ctx;
-    ctx->lock.lock();
+    bool state = ctx->lock.lock_irqsave();
 
     ctx->sigdelivered |= SIGMASK(task->ucontext.signum);
     ctx->wire.arise(evtable::SIGNAL);
 
-    ctx->lock.unlock();
+    ctx->lock.unlock_irqrestore(state);
 
     auto regs = &task->ucontext.ctx.reg;
     task->ctx.reg = *regs;
@@ -40,9 +41,8 @@ void x86::sigreturn_default(sched::process *proc, sched::thread *task) {
 
     auto iretq_regs = x86::sched_to_irq(regs);
 
-    x86::set_fcw(regs->fcw);
-    x86::set_mxcsr(regs->mxcsr);
-    x86::load_sse(task->ucontext.ctx.sse_region);
+    x86::fpu::drop(task);
+    x86::fpu::copy_area(task->ctx.sse_region, task->ucontext.ctx.sse_region);
     
     x86::set_user_fs(regs->fs);
     x86::set_user_gs(regs->gs);
@@ -104,7 +104,12 @@ void arch::init_default_sigreturn(sched::thread *task, sched::signal::signal *si
     auto ctx = &task->ctx;
 
     context->ctx.reg = ctx->reg;
-    memcpy(context->ctx.sse_region, ctx->sse_region, 512);
+    if (context->ctx.sse_region == nullptr) {
+        context->ctx.sse_region = x86::fpu::alloc_area();
+    }
+
+    x86::fpu::flush(task);
+    x86::fpu::copy_area(context->ctx.sse_region, ctx->sse_region);
 
     context->signum = signal->signum;
     memset(&ctx->reg, 0, sizeof(sched_regs));
@@ -121,9 +126,7 @@ void arch::init_default_sigreturn(sched::thread *task, sched::signal::signal *si
 
     ctx->reg.cr3 = x86::get_cr3(task->proc->mem_ctx->get_page_map());
 
-    ctx->reg.mxcsr = 0x1F80;
-    ctx->reg.fcw = 0x33F;
-    memset(ctx->sse_region, 0, 512);
+    x86::fpu::init_area(ctx->sse_region);
 }
 
 void arch::init_user_sigreturn(sched::thread *task,
@@ -132,7 +135,12 @@ void arch::init_user_sigreturn(sched::thread *task,
     auto ctx = &task->ctx;
 
     context->ctx.reg = ctx->reg;
-    memcpy(context->ctx.sse_region, ctx->sse_region, 512);
+    if (context->ctx.sse_region == nullptr) {
+        context->ctx.sse_region = x86::fpu::alloc_area();
+    }
+
+    x86::fpu::flush(task);
+    x86::fpu::copy_area(context->ctx.sse_region, ctx->sse_region);
 
     context->signum = signal->signum;
     memset(&ctx->reg, 0, sizeof(sched_regs));
@@ -149,6 +157,7 @@ void arch::init_user_sigreturn(sched::thread *task,
     stack -= sizeof(sched::signal::ucontext);
     sched::signal::ucontext *uctx = (sched::signal::ucontext *) stack;
     *uctx = *context;
+    uctx->ctx.sse_region = nullptr;
 
     stack -= sizeof(uint64_t);
     *(uint64_t *) stack = (uint64_t) action->sa_restorer;
@@ -161,9 +170,7 @@ void arch::init_user_sigreturn(sched::thread *task,
     ctx->reg.rflags = 0x202;
     ctx->reg.cr3 = x86::get_cr3(task->proc->mem_ctx->get_page_map());
 
-    ctx->reg.mxcsr = 0x1F80;
-    ctx->reg.fcw = 0x33F;
-    memset(ctx->sse_region, 0, 512);
+    x86::fpu::init_area(ctx->sse_region);
 
     // [[noreturn]] sigenter_handler(void *handler_rip, bool is_sigaction, int sig, siginfo *info, ucontext_t *ctx)
     if (task->proc->trampoline) {
@@ -1,5 +1,6 @@
 #include "mm/arena.hpp"
 #include "util/types.hpp"
+#include <arch/x86/clocksource.hpp>
 #include <arch/x86/types.hpp>
 #include <arch/types.hpp>
 #include <atomic>
@@ -15,6 +16,7 @@
 #include <sys/sched/sched.hpp>
 #include <util/io.hpp>
 #include <util/lock.hpp>
+#include <util/prof.hpp>
 #include <util/log/log.hpp>
 #include <util/stivale.hpp>
 #include <util/string.hpp>
@@ -51,6 +53,15 @@ void x86::tss::init() {
 
 static log::subsystem logger = log::make_subsystem("SMP");
 static util::spinlock cpuBootupLock{};
+
+// Zeroed stand-in for the BSP's processor until init_bsp installs the real one, spinlocks keep
+// their preempt count in it from the very first kmsg
+alignas(64) static char boot_locals[sizeof(x86::processor)];
+
+void x86::init_boot_locals() {
+    x86::wrmsr(x86::MSR_GS_BASE, boot_locals);
+}
+
 extern "C" {
     void processorEntry(stivale::boot::info::processor *entry_ctx) {
         auto *cpu = (x86::processor *) entry_ctx->extra_argument;
@@ -68,7 +79,7 @@ extern "C" {
         kmsg(logger, "[CPU %u online]", x86::get_cpu());
 
         cpuBootupLock.unlock_noirq();
-        apic::lapic::set_timer(1);
+        x86::start_hrtimers();
         while (true) {
             asm volatile("pause");
         }
@@ -105,40 +116,123 @@ static inline void processorPanic(arch::irq_regs *r) {
     }
 }
 
-static inline void processorMessage(arch::irq_regs *r) {
-    switch(x86::get_locals()->ipi_event) {
+// Takes the pending message out of this CPU's slot, so a sender spinning on it can go ahead
+static size_t take_message(void **data) {
+    auto locals = x86::get_locals();
+
+    auto event = __atomic_load_n(&locals->ipi_event, __ATOMIC_ACQUIRE);
+    if (event == 0) {
+        return 0;
+    }
+
+    *data = locals->ipi_data;
+    locals->ipi_data = nullptr;
+    locals->ipi_event = 0;
+    __atomic_store_n(&locals->ipi_busy, false, __ATOMIC_RELEASE);
+
+    return event;
+}
+
+static void run_message(size_t event, void *data) {
+    switch(event) {
         case  x86::INIT_TASK: {
-            x86::init_thread((sched::thread *) x86::get_locals()->ipi_data);
+            x86::init_thread((sched::thread *) data);
             break;
         }
 
         case x86::START_TASK: {
-            x86::start_thread((sched::thread *) x86::get_locals()->ipi_data);
+            x86::start_thread((sched::thread *) data);
             break;
         }
 
         case x86::STOP_TASK: {
-            x86::stop_thread((sched::thread *) x86::get_locals()->ipi_data);
+            x86::stop_thread((sched::thread *) data);
             break;
         }
 
         case x86::KILL_TASK: {
-            x86::kill_thread((sched::thread *) x86::get_locals()->ipi_data);
+            x86::kill_thread((sched::thread *) data);
             break;
         }
 
         case x86::GIVE_OWNERSHIP: {
-            auto run_tree = x86::get_locals()->run_tree;
-            auto task = (sched::thread *) x86::get_locals()->ipi_data;
+            auto task = (sched::thread *) data;
+
+            if (!task->affinity.isset(x86::get_cpu_number())) {
+                auto target = x86::least_loaded_cpu(&task->affinity);
+                if (target && target != x86::get_locals()) {
+                    x86::message_processor(target->processor_id, x86::GIVE_OWNERSHIP, task);
+                    break;
+                }
+            }
 
             task->ctx.cpu = x86::get_cpu();
-            run_tree->insert(task);
+            x86::enqueue_task(x86::get_locals(), task);
+            break;
+        }
+
+        case x86::SET_SCHEDULER: {
+            x86::set_scheduler((sched::thread *) data);
+            break;
+        }
+
+        case x86::RCU_QS: {
+            sched::rcu::quiescent();
+            break;
+        }
+
+        case x86::PROF_START: {
+            prof::arm();
             break;
         }
     }
+}
+
+// Runs in the message interrupt, where nothing on this CPU is halfway through its run queues
+static void dispatch_message() {
+    auto locals = x86::get_locals();
+
+    // Forwarding may defer more while this runs, those are picked up by the same loop
+    for (size_t i = 0; i < locals->deferred_count; i++) {
+        run_message(locals->deferred_events[i], locals->deferred_data[i]);
+    }
+
+    locals->deferred_count = 0;
+
+    void *data = nullptr;
+    if (auto event = take_message(&data)) {
+        run_message(event, data);
+    }
+}
 
-    x86::get_locals()->ipi_data = nullptr;
-    x86::get_locals()->ipi_event = 0;
+// A CPU waiting on another's slot with interrupts off may be in the middle of a run queue update,
+// so only messages that don't touch the run queues run there. The rest wait for the message interrupt
+static void drain_message() {
+    auto locals = x86::get_locals();
+
+    auto event = __atomic_load_n(&locals->ipi_event, __ATOMIC_ACQUIRE);
+    bool reentrant = event == x86::RCU_QS || event == x86::PROF_START;
+    if (event == 0 || (!reentrant && locals->deferred_count == x86::deferred_ipis)) {
+        return;
+    }
+
+    void *data = nullptr;
+    event = take_message(&data);
+    if (reentrant) {
+        run_message(event, data);
+        return;
+    }
+
+    locals->deferred_events[locals->deferred_count] = event;
+    locals->deferred_data[locals->deferred_count] = data;
+    locals->deferred_count++;
+
+    // Delivered once interrupts are back on
+    apic::lapic::ipi(x86::get_cpu(), 220);
+}
+
+static inline void processorMessage(arch::irq_regs *r) {
+    dispatch_message();
 }
 
 void x86::install_handlers() {
@@ -146,6 +240,51 @@ void x86::install_handlers() {
     x86::install_vector(220, processorMessage);
 }
 
+// isolcpus=<n>[,<n>|<n>-<m>...] takes CPUs out of default placement and balancing,
+// they then only run threads whose affinity names them
+static void isolate_cpus() {
+    auto args = stivale::parser.args();
+    if (args == nullptr || args->cmdline == 0) {
+        return;
+    }
+
+    const char *cmdline = (const char *) memory::add_virt(args->cmdline);
+    const char *option = "isolcpus=";
+    size_t option_len = strlen(option);
+
+    for (const char *p = cmdline; *p; p++) {
+        if ((p != cmdline && *(p - 1) != ' ') || strncmp(p, option, option_len) != 0) {
+            continue;
+        }
+
+        p += option_len;
+        while (*p && *p != ' ') {
+            size_t first = 0, last = 0;
+            while (*p >= '0' && *p <= '9') first = first * 10 + (*p++ - '0');
+
+            last = first;
+            if (*p == '-') {
+                p++;
+                last = 0;
+                while (*p >= '0' && *p <= '9') last = last * 10 + (*p++ - '0');
+            }
+
+            for (size_t cpu = first; cpu <= last && cpu < x86::cpus.size(); cpu++) {
+                // Keep at least the BSP available for general work
+                if (cpu == 0) continue;
+
+                x86::cpus[cpu]->isolated = true;
+                kmsg(logger, "CPU %lu isolated", cpu);
+            }
+
+            if (*p == ',') p++;
+            else if (*p && *p != ' ') break;
+        }
+
+        break;
+    }
+}
+
 void x86::init_smp() {
     auto procs = stivale::parser.smp();
     for (auto stivale_cpu = procs->begin(); stivale_cpu != procs->end(); stivale_cpu++) {
@@ -154,9 +293,11 @@ void x86::init_smp() {
 
         auto processor = prs::construct<x86::processor>(prs::allocator{slab::create_resource()}, lapic_id,
         prs::construct<x86::run_tree>(prs::allocator{slab::create_resource()}));
+        processor->rt_queue = prs::construct<x86::rt_queue>(prs::allocator{slab::create_resource()});
         
         processor->kstack = (size_t) pmm::stack(x86::initialStackSize);
         processor->ctx = vmm::boot;
+        processor->cpu_number = cpus.size();
         cpus.push_back(processor);
 
         cpuBootupLock.lock_noirq();
@@ -165,16 +306,26 @@ void x86::init_smp() {
         stivale_cpu->target_stack = processor->kstack;
         stivale_cpu->goto_address = (size_t) &smp64_start;
 
+        clocksource::sync_ap();
         cpuBootupLock.await();
     }
+
+    isolate_cpus();
 }
 
 void x86::message_processor(ssize_t processor_id, size_t ipi_event, void *ipi_data) {
     for (size_t i = 0; i < cpus.size(); i++) {
         auto cpu = cpus[i];
         if (cpu->processor_id == processor_id) {
+            // Wakeups must not overwrite each other. While waiting for the slot, empty our own
+            // so two CPUs messaging each other with interrupts off can't deadlock
+            while (__atomic_test_and_set(&cpu->ipi_busy, __ATOMIC_ACQUIRE)) {
+                if (!arch::get_irq_state()) drain_message();
+                asm volatile("pause");
+            }
+
             cpu->ipi_data = ipi_data;
-            cpu->ipi_event = ipi_event;
+            __atomic_store_n(&cpu->ipi_event, ipi_event, __ATOMIC_RELEASE);
             apic::lapic::ipi(processor_id, 220);
 
             return;
@@ -182,38 +333,6 @@ void x86::message_processor(ssize_t processor_id, size_t ipi_event, void *ipi_da
     }
 }
 
-x86::processor *x86::get_locals() {
-    return x86::rdmsr<x86::processor *>(x86::MSR_GS_BASE);
-}
-
-sched::thread *x86::get_thread() {
-    return get_locals()->current_task;
-}
-
-sched::process *x86::get_process() {
-    return get_locals()->current_process;
-}
-
-size_t x86::get_pid() {
-    return get_locals()->pid;
-}
-
-int64_t x86::get_tid() {
-    return get_locals()->tid;
-}
-
-uint64_t x86::get_cpu() {
-    return apic::lapic::id();
-}
-
-void x86::set_errno(int errno) {
-    get_locals()->errno = errno;
-}
-
-int x86::get_errno() {
-    return get_locals()->errno;
-}
-
 void arch::set_errno(int errno) {
     x86::set_errno(errno);
 }
@@ -235,11 +354,11 @@ tid_t arch::get_tid() {
 }
 
 tid_t arch::get_idle_tid() {
-    return x86::get_locals()->idle_tid;
+    return PERCPU_READ(idle_tid);
 }
 
 sched::thread *arch::get_idle() {
-    return x86::get_locals()->idle_task;
+    return PERCPU_READ(idle_task);
 }
 
 pid_t arch::get_pid() {
@@ -250,13 +369,21 @@ uint64_t arch::get_cpu() {
     return x86::get_cpu();
 }
 
+uint64_t arch::get_cpu_number() {
+    return x86::get_cpu_number();
+}
+
+size_t arch::get_cpu_count() {
+    return x86::cpus.size();
+}
+
 void arch::set_process(sched::process *process) {
-    x86::get_locals()->current_process = process;
-    if (process) x86::get_locals()->pid = process->pid;
-    else x86::get_locals()->pid = -1;
+    PERCPU_WRITE(current_process, process);
+    if (process) PERCPU_WRITE(pid, process->pid);
+    else PERCPU_WRITE(pid, -1);
 }
 
 void arch::set_thread(sched::thread *task) {
-    x86::get_locals()->current_task = task;
-    x86::get_locals()->tid = task->tid;
+    PERCPU_WRITE(current_task, task);
+    PERCPU_WRITE(tid, task->tid);
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include <arch/x86/smp.hpp>
 #include <arch/x86/types.hpp>
 #include <arch/x86/syscall.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/sysstat.hpp>
+#include <util/trace.hpp>
 #include <cstdint>
 #include <util/log/log.hpp>
 
@@ -39,6 +42,18 @@ extern void syscall_clock_get(arch::irq_regs *);
 extern void syscall_getpid(arch::irq_regs *);
 extern void syscall_getppid(arch::irq_regs *);
 extern void syscall_gettid(arch::irq_regs *);
+extern void syscall_sched_setaffinity(arch::irq_regs *);
+extern void syscall_sched_getaffinity(arch::irq_regs *);
+extern void syscall_sched_getcpu(arch::irq_regs *);
+extern void syscall_sched_setscheduler(arch::irq_regs *);
+extern void syscall_sched_getscheduler(arch::irq_regs *);
+extern void syscall_sched_getparam(arch::irq_regs *);
+extern void syscall_clone(arch::irq_regs *);
+extern void syscall_set_tid_address(arch::irq_regs *);
+extern void syscall_exit_thread(arch::irq_regs *);
+
+extern void syscall_getrusage(arch::irq_regs *);
+extern void syscall_times(arch::irq_regs *);
 extern void syscall_setpgid(arch::irq_regs *);
 extern void syscall_getpgid(arch::irq_regs *);
 extern void syscall_setsid(arch::irq_regs *);
@@ -179,8 +194,30 @@ static x86::syscall_handler syscalls_list[] = {
 
     syscall_sethostname,
     syscall_gethostname,
+
+    syscall_sched_setaffinity,
+    syscall_sched_getaffinity,
+    syscall_sched_getcpu,
+    syscall_sched_setscheduler,
+    syscall_sched_getscheduler,
+    syscall_sched_getparam,
+
+    syscall_clone,
+    syscall_set_tid_address,
+    syscall_exit_thread,
+
+    syscall_getrusage,
+    syscall_times,
 };
 
+size_t x86::syscall_count() {
+    return util::lengthof(syscalls_list);
+}
+
+x86::syscall_handler x86::get_syscall(size_t nr) {
+    return nr < util::lengthof(syscalls_list) ? syscalls_list[nr] : nullptr;
+}
+
 extern "C" {
     void syscall_handler(arch::irq_regs *r) {
         uint64_t syscall_num = r->rax;
@@ -194,15 +231,29 @@ extern "C" {
         // TODO: signal queue
         auto thread = x86::get_thread();
         thread->in_syscall = true;
-
+        sched::charge_time(thread, true);
+        TRACE(sys_enter, syscall_num, {r->rdi, r->rsi, r->rdx, r->r10, r->r8, r->r9});
+
+        // Entered with interrupts masked by SFMASK, handlers run preemptible. The ones that
+        // leave through their own iretq mask them again first, and never get counted
+        size_t start_cpu = x86::get_cpu_number();
+        uint64_t start = x86::tsc();
+        x86::irq_on();
         if (syscalls_list[syscall_num] != nullptr) {
             syscalls_list[syscall_num](r);
         }
+        x86::irq_off();
 
+        // TSCs aren't synchronised between CPUs, a call that migrated has no meaningful latency
+        if (x86::get_cpu_number() == start_cpu) {
+            sysstat::record(syscall_num, x86::tsc() - start, (int64_t) r->rax < 0);
+        }
+        TRACE(sys_exit, syscall_num, (int64_t) r->rax, x86::get_errno());
         if (r->rax >= 0) {
             x86::set_errno(0);
         }
 
         thread->in_syscall = false;
+        sched::charge_time(thread, false);
     }
 }
\ No newline at end of file
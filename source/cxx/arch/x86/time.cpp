@@ -1,39 +1,172 @@
 #include "ipc/evtable.hpp"
 #include "mm/arena.hpp"
 #include "mm/mm.hpp"
+#include <arch/x86/clocksource.hpp>
 #include <arch/x86/smp.hpp>
 #include <cstddef>
+#include <cstdint>
 #include <sys/sched/sched.hpp>
 #include <arch/x86/pit.hpp>
 #include <sys/x86/apic.hpp>
 #include <sys/sched/time.hpp>
 #include <arch/types.hpp>
+#include <ipc/wire.hpp>
+#include <prs/list.hpp>
+#include <util/lock.hpp>
 
-sched::timespec sched::clock_rt{};
-sched::timespec sched::clock_mono{};
-static prs::vector<sched::timer, prs::allocator> timers{
-    arena::create_resource()
+sched::timespec sched::clock_rt() {
+    return sched::timespec::ns(arch::hrtime() + clocksource::realtime_offset);
+}
+
+sched::timespec sched::clock_mono() {
+    return sched::timespec::ns(arch::hrtime());
+}
+
+// Four levels of 64 slots, each level's slot spans a whole turn of the level below
+constexpr size_t WHEEL_BITS = 6;
+constexpr size_t WHEEL_SLOTS = 1 << WHEEL_BITS;
+constexpr size_t WHEEL_MASK = WHEEL_SLOTS - 1;
+constexpr size_t WHEEL_LEVELS = 4;
+constexpr uint64_t WHEEL_RANGE = 1ULL << (WHEEL_BITS * WHEEL_LEVELS);
+
+using timer_list = prs::list<sched::timer, &sched::timer::hook>;
+
+struct sched::timer_wheel {
+    util::spinlock lock;
+
+    // Next tick to run, everything due before it has fired
+    uint64_t clk;
+    timer_list slots[WHEEL_LEVELS][WHEEL_SLOTS];
 };
 
-void arch::add_timer(sched::timer timer) {
-    timers.push_back(timer);
+// Timers are armed on the local CPU's wheel, so arming and cancelling rarely share a lock
+static DEFINE_PER_CPU(sched::timer_wheel, wheels);
+
+static uint64_t jiffies = 0;
+static long tick_nanos = 1000000;
+
+// Wheel lock held
+static void enqueue_timer(sched::timer_wheel *wheel, sched::timer *timer) {
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires - wheel->clk;
+
+    size_t level = 0;
+    size_t slot;
+    if ((int64_t) delta < 0) {
+        // Already due, runs with the current tick
+        slot = wheel->clk & WHEEL_MASK;
+    } else {
+        if (delta >= WHEEL_RANGE) {
+            expires = wheel->clk + WHEEL_RANGE - 1;
+            delta = WHEEL_RANGE - 1;
+        }
+
+        while (delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+            level++;
+        }
+
+        slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    }
+
+    timer->level = level;
+    timer->slot = slot;
+    wheel->slots[level][slot].push_back(timer);
 }
 
-void arch::tick_clock(long nanos) {
-    sched::timespec interval = { .tv_sec = 0, .tv_nsec = nanos };
+// Moves a slot of level down a level, returns the slot index so the caller knows whether to go further up
+static size_t cascade(sched::timer_wheel *wheel, size_t level) {
+    size_t slot = (wheel->clk >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    auto &list = wheel->slots[level][slot];
+
+    while (auto timer = list.front()) {
+        list.erase(timer);
+        enqueue_timer(wheel, timer);
+    }
+
+    return slot;
+}
+
+static void fire_timer(sched::timer *timer) {
+    if (timer->fn)
+        timer->fn(timer->aux);
+    if (timer->wire)
+        timer->wire->arise(evtable::TIME_WAKE);
+}
 
-    sched::clock_rt = sched::clock_rt + interval;
-    sched::clock_mono = sched::clock_mono + interval;
+static void run_wheel(sched::timer_wheel *wheel, uint64_t now) {
+    bool state = wheel->lock.lock_irqsave();
 
-    for (auto timer = timers.begin(); timer != timers.end();) {
-        timer->spec = timer->spec - interval;
-        if (timer->spec.tv_nsec == 0 && timer->spec.tv_sec == 0) {
-            if (timer->wire)
-                timer->wire->arise(evtable::TIME_WAKE);
+    while (wheel->clk <= now) {
+        size_t index = wheel->clk & WHEEL_MASK;
+        if (index == 0) {
+            for (size_t level = 1; level < WHEEL_LEVELS; level++) {
+                if (cascade(wheel, level) != 0) {
+                    break;
+                }
+            }
+        }
+
+        // Callbacks take wait queue locks that are held around add_timer, so fire them unlocked
+        auto &bucket = wheel->slots[0][index];
+        while (auto timer = bucket.front()) {
+            bucket.erase(timer);
+            timer->wheel = nullptr;
 
-            timer = timers.erase(timer);
-        } else {
-            ++timer;
+            wheel->lock.unlock_irqrestore(state);
+            fire_timer(timer);
+            state = wheel->lock.lock_irqsave();
         }
+
+        wheel->clk++;
+    }
+
+    wheel->lock.unlock_irqrestore(state);
+}
+
+void arch::add_timer(sched::timer *timer) {
+    uint64_t nanos = timer->spec.tv_sec * sched::NANOS_PER_SEC + timer->spec.tv_nsec;
+    uint64_t ticks = (nanos + tick_nanos - 1) / tick_nanos;
+
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    auto wheel = &wheels.get();
+    bool state = wheel->lock.lock_irqsave();
+
+    timer->expires = __atomic_load_n(&jiffies, __ATOMIC_ACQUIRE) + ticks;
+    timer->wheel = wheel;
+    enqueue_timer(wheel, timer);
+
+    wheel->lock.unlock_irqrestore(state);
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+}
+
+bool arch::remove_timer(sched::timer *timer) {
+    auto wheel = __atomic_load_n(&timer->wheel, __ATOMIC_ACQUIRE);
+    if (wheel == nullptr) {
+        return false;
+    }
+
+    util::lock_guard guard{wheel->lock};
+    if (timer->wheel != wheel || !timer->hook.in_list) {
+        return false;
+    }
+
+    wheel->slots[timer->level][timer->slot].erase(timer);
+    timer->wheel = nullptr;
+    return true;
+}
+
+// Only drives the timer wheel, the clocks are read from the clocksource
+void arch::tick_clock(long nanos) {
+    tick_nanos = nanos;
+    auto now = __atomic_add_fetch(&jiffies, 1, __ATOMIC_RELEASE);
+
+    // Only slots that came due are visited, empty wheels cost a compare each
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        run_wheel(&wheels[i], now);
     }
 }
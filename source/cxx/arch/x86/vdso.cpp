@@ -0,0 +1,64 @@
+#include <arch/vmm.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/vdso.hpp>
+#include <arch/x86/vvar.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <mm/common.hpp>
+#include <mm/pmm.hpp>
+#include <mm/vmm.hpp>
+#include <util/lock.hpp>
+#include <util/string.hpp>
+
+static_assert(vdso::VVAR_CPUS >= x86::max_cpus);
+
+extern "C" {
+    // Linked in by source/asm/vdso.asm
+    extern char vdso_image_start[];
+    extern char vdso_image_end[];
+}
+
+// One physically contiguous block, the vvar page followed by the image
+static void *vvar_phys = nullptr;
+static size_t image_pages = 0;
+
+static vdso::vvar *data = nullptr;
+static util::spinlock write_lock{};
+
+void vdso::init() {
+    size_t len = vdso_image_end - vdso_image_start;
+    image_pages = memory::page_count(len);
+
+    vvar_phys = pmm::phys(1 + image_pages);
+    char *block = (char *) memory::add_virt(vvar_phys);
+
+    memset(block, 0, (1 + image_pages) * memory::page_size);
+    memcpy(block + memory::page_size, vdso_image_start, len);
+
+    data = (vvar *) block;
+}
+
+uintptr_t vdso::map(vmm::vmm_ctx *ctx) {
+    sched::write_guard guard{ctx->lock};
+
+    // Reserve both at once so the vDSO lands right after the vvar page, then give it exec
+    char *base = (char *) ctx->map_phys(nullptr, vvar_phys, (1 + image_pages) * memory::page_size,
+        vmm::map_flags::READ | vmm::map_flags::USER);
+    ctx->map_phys(base + memory::page_size, (char *) vvar_phys + memory::page_size, image_pages * memory::page_size,
+        vmm::map_flags::READ | vmm::map_flags::USER | vmm::map_flags::EXEC, true);
+
+    return (uintptr_t) base + memory::page_size;
+}
+
+vdso::vvar *vdso::write_begin(bool &state) {
+    state = write_lock.lock_irqsave();
+
+    __atomic_store_n(&data->seq, data->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return data;
+}
+
+void vdso::write_end(bool state) {
+    __atomic_store_n(&data->seq, data->seq + 1, __ATOMIC_RELEASE);
+    write_lock.unlock_irqrestore(state);
+}
@@ -76,7 +76,7 @@ void syscall_mmap(arch::irq_regs *r) {
         }
     }
 
-    util::lock_guard guard{ctx->lock};
+    sched::write_guard guard{ctx->lock};
     if (prot & PROT_NONE) {
         if (flags & MAP_FIXED) {
             ctx->unmap(addr, pages);
@@ -101,6 +101,13 @@ void syscall_mmap(arch::irq_regs *r) {
     }
 
     auto base = ctx->map(addr, pages, translate_flags(flags) | translate_prot(prot), flags & MAP_FIXED);
+    if (base == nullptr) {
+        // Populating the mapping would take the cgroup over its memory limit
+        arch::set_errno(ENOMEM);
+        r->rax = MAP_FAILED;
+        return;
+    }
+
     r->rax = (uint64_t) base;
 }
 
@@ -124,7 +131,7 @@ void syscall_munmap(arch::irq_regs *r) {
         return;
     }
 
-    util::lock_guard guard{ctx->lock};
+    sched::write_guard guard{ctx->lock};
     auto res = ctx->unmap(addr, pages);
     if (res == nullptr) {
         arch::set_errno(EINVAL);
@@ -159,5 +166,6 @@ void syscall_mprotect(arch::irq_regs *r) {
         }
     }
 
+    sched::read_guard guard{ctx->lock};
     ctx->modify(addr, pages, translate_prot(prot));
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <mm/vmm.hpp>
 #include <arch/x86/types.hpp>
 #include <arch/vmm.hpp>
+#include <sys/sched/cgroup.hpp>
+#include <util/trace.hpp>
 
 namespace vmm {
     vmm_ctx_map new_pagemap() {
@@ -450,8 +452,22 @@ namespace x86 {
         asm volatile("mov %%cr2, %0": "=a"(faulting_addr));
 
         uint64_t faulting_page = faulting_addr & addr_mask;
+        TRACE(page_fault, faulting_addr, r->rip, r->err);
 
-        util::lock_guard guard{ctx->lock};
+        // A no-fault user access, its exception table fixup reports the fault instead
+        if (PERCPU_READ(nofault)) {
+            return false;
+        }
+
+        // #PF runs on the faulting task's stack, so it sleeps for the context lock if the code it interrupted
+        // could have. Otherwise it only takes the lock uncontended, and a fault it can't handle goes to its fixup
+        if ((r->rflags & 0x200) && sched::preemptible()) {
+            ctx->lock.read_lock();
+        } else if (!ctx->lock.try_read_lock()) {
+            return false;
+        }
+
+        sched::read_guard guard{ctx->lock, sched::adopt_lock};
 
         auto mapping = ctx->get_mapping((void *) faulting_page);
         if (mapping == nullptr) {
@@ -459,11 +475,18 @@ namespace x86 {
             return false;
         }
 
+        util::lock_guard pt_guard{ctx->pt_lock};
+
         vmm::page_flags perms = vmm::resolve_perms_4k((void *) faulting_page, ctx->page_map);
         if ((uint64_t) (perms & vmm::page_flags::SHARED)) {
             return false;
         }
 
+        // Without reclaim a group at its limit can't make room, the fault goes unhandled instead
+        if ((uint64_t) (perms & (vmm::page_flags::COW | vmm::page_flags::DEMAND)) && !sched::cgroup::charge_memory(ctx, 1)) {
+            return false;
+        }
+
         if ((uint64_t) (perms & vmm::page_flags::COW)) {
             void *phys = pmm::phys(1);
             void *prev = vmm::resolve_single_4k((void *) faulting_page, ctx->page_map);
@@ -481,6 +504,7 @@ namespace x86 {
             vmm::remap_single_4k((void *) faulting_page, phys, perms, ctx->page_map);
 
             invlpg(faulting_page);
+            task->usage.minflt++;
             return true;
         }
 
@@ -494,6 +518,7 @@ namespace x86 {
     //        vmm::ref[phys] = 1;
 
             invlpg(faulting_page);
+            task->usage.minflt++;
             return true;
         }
 
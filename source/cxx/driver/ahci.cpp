@@ -16,6 +16,7 @@
 #include <util/log/log.hpp>
 #include <util/log/panic.hpp>
 #include <util/string.hpp>
+#include <util/trace.hpp>
 
 static log::subsystem logger = log::make_subsystem("AHCI");
 void ahci::device::await_ready() {
@@ -278,8 +279,10 @@ ssize_t ahci::device::do_sector_io(void *buf, uint16_t count, size_t offset, boo
     auto slot = issue_read_write(buf, count, offset, false);
     await_ready();
 
+    TRACE(block_submit, (uint32_t) major, (uint32_t) minor, offset, count, rw);
     issue_command(slot.idx);
     int err = wait_command(slot.idx);
+    TRACE(block_complete, (uint32_t) major, (uint32_t) minor, offset, count, err);
 
     if (err) {
         uint8_t error = (uint8_t) (port->tfd >> 8);
@@ -14,6 +14,7 @@
 #include <cstddef>
 #include <util/io.hpp>
 #include <driver/net/e1000.hpp>
+#include <util/trace.hpp>
 
 static log::subsystem logger = log::make_subsystem("E1000");
 
@@ -180,6 +181,7 @@ void e1000::device::rx_handle() {
 
         size_t pkt_len = len - sizeof(net::eth);
         void *pkt_data = ((char *) eth_hdr) + sizeof(net::eth);
+        TRACE(net_rx, len, net::ntohs(eth_hdr->type));
 
         switch(net::ntohs(eth_hdr->type)) {
             case 0x0806:
@@ -201,6 +203,11 @@ void e1000::device::rx_handle() {
     }
 }
 
+void e1000::device::rx_worker(void *aux) {
+    auto dev = (e1000::device *) aux;
+    dev->rx_handle();
+}
+
 bool e1000::device::setup() {
     this->ipv4_gateway_addr = (char *) "192.168.100.1";
     this->ipv4_host_addr = (char *) "192.168.100.2";
@@ -275,6 +282,7 @@ uint32_t e1000::device::route(uint32_t dest) {
 }
 
 void e1000::device::send(const void *buf, size_t len) {
+    TRACE(net_tx, (uint32_t) len);
     auto tx_dma = bus->get_dma(len);
     memcpy((void *) tx_dma->vaddr(), buf, len);
 
@@ -303,6 +311,6 @@ void e1000::irq_handler(arch::irq_regs *r, void *aux) {
     } else if (status & 0x10) {
         // TODO: allocate more rx buffers
     } else if (status & 0x80) {
-        dev->rx_handle();
+        sched::wq::queue(sched::wq::system, &dev->rx_work);
     }
 }
\ No newline at end of file
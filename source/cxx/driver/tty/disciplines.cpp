@@ -129,9 +129,9 @@ ssize_t tty::device::read_canon(void *buf, size_t len) {
                 if (new_line(termios, c)) {
                     line_queue->push(c);
                     items++;
-                    out_lock.lock();
+                    bool state = out_lock.lock_irqsave();
                     echo_char(this, c);
-                    out_lock.unlock();
+                    out_lock.unlock_irqrestore(state);
 
                     if (driver && driver->has_flush)
                         driver->flush(this);
@@ -148,11 +148,11 @@ ssize_t tty::device::read_canon(void *buf, size_t len) {
                         items--;
                         char special2[] = { '\b', ' ', '\b' };
 
-                        out_lock.lock();
+                        bool state = out_lock.lock_irqsave();
                         out.push(special2[0]);
                         out.push(special2[1]);
                         out.push(special2[2]);
-                        out_lock.unlock();
+                        out_lock.unlock_irqrestore(state);
 
                         if (driver && driver->has_flush)
                             driver->flush(this);
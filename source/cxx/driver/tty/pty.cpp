@@ -53,7 +53,7 @@ ssize_t tty::ptm::read(void *buf, size_t len, size_t offset) {
     char *chars = (char *) allocator.allocate(len);
     char *chars_ptr = chars;
 
-    in_lock.lock();
+    bool state = in_lock.lock_irqsave();
     for (count = 0; count < len; count++) {
         if (!in.pop(chars_ptr)) {
             break;
@@ -62,7 +62,7 @@ ssize_t tty::ptm::read(void *buf, size_t len, size_t offset) {
         chars_ptr++;
     }
 
-    in_lock.unlock();
+    in_lock.unlock_irqrestore(state);
 
     auto copied = arch::copy_to_user(buf, chars, count);
     if (copied < count) {
@@ -123,27 +123,26 @@ ssize_t tty::device::write(void *buf, size_t count, size_t offset) {
     }
 
     // TODO: nonblock support in vfs
-    out_lock.lock();
-
     char *chars = (char *) allocator.allocate(count);
     char *chars_ptr = chars;
     auto copied = arch::copy_from_user(chars, buf, count);
     if (copied < count) {
         allocator.deallocate(chars);
-        out_lock.unlock();
         return count - copied;
     }
 
+    bool state = out_lock.lock_irqsave();
+
     size_t bytes = 0;
     for (bytes = 0; bytes < count; bytes++) {
         if (!out.push(*chars_ptr++)) {
-            out_lock.unlock();
+            out_lock.unlock_irqrestore(state);
             driver->flush(this);
-            out_lock.lock();
+            state = out_lock.lock_irqsave();
         }
     }
 
-    out_lock.unlock();
+    out_lock.unlock_irqrestore(state);
     driver->flush(this);
 
     allocator.deallocate(chars);
@@ -5,20 +5,31 @@
 #include "driver/tty/tty.hpp"
 #include "driver/tty/pty.hpp"
 #include "driver/video/vt.hpp"
+#include "driver/timerlat.hpp"
+#include "driver/wqstat.hpp"
+#include "sys/sched/cgroup.hpp"
 #include "fs/cache.hpp"
 #include "lai/core.h"
 #include "lai/helpers/sci.h"
+#include "mm/allocprof.hpp"
 #include "mm/arena.hpp"
 #include "mm/common.hpp"
 #include "mm/slab.hpp"
 #include "sys/sched/signal.hpp"
 #include "util/types.hpp"
+#include "util/lockstat.hpp"
+#include "util/ftrace.hpp"
+#include "util/ksym.hpp"
+#include "util/prof.hpp"
+#include "util/trace.hpp"
+#include "util/sysstat.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <driver/ahci.hpp>
 #include <prs/construct.hpp>
 #include <fs/vfs.hpp>
 #include <fs/dev.hpp>
+#include <mm/kstack.hpp>
 #include <mm/mm.hpp>
 #include <mm/pmm.hpp>
 #include <mm/vmm.hpp>
@@ -85,6 +96,8 @@ static void kern_task() {
     lai_create_namespace();
     lai_enable_acpi(1);
 
+    sched::wq::init();
+
     vfs::init();
     cache::init();
     
@@ -97,6 +110,21 @@ static void kern_task() {
     vt::init(fbinfo);
     tty::self::init();
     tty::ptmx::init();
+#ifdef CONFIG_LOCKSTAT
+    lockstat::init();
+#endif
+#ifdef CONFIG_ALLOCPROF
+    allocprof::init_device();
+#endif
+#ifdef CONFIG_FTRACE
+    ftrace::init();
+#endif
+    timerlat::init();
+    wqstat::init();
+    sched::cgroup::init();
+    prof::init();
+    tracing::init();
+    sysstat::init();
     
     auto boot_table = vfs::make_table();
     tty::set_active("/dev/tty0", boot_table);
@@ -130,6 +158,7 @@ static void run_constructors() {
 extern "C" {
     [[noreturn]]
     void arch_entry(stivale::boot::header *header) {
+        x86::init_boot_locals();
         run_constructors();
 
         stivale::parser = {header};
@@ -143,13 +172,18 @@ extern "C" {
         arch::init_irqs();
 
         pmm::init(stivale::parser.mmap());
+#ifdef CONFIG_ALLOCPROF
+        allocprof::init();
+#endif
         vmm::init();
+        kstack::init();
+        ksym::init(stivale::parser.modules());
 
         acpi::madt::init();
 
         sched::init();
 
-        auto kern_thread = sched::create_thread(kern_task, (uint64_t) pmm::stack(4), vmm::boot, 0);
+        auto kern_thread = sched::create_thread(kern_task, kstack::alloc(), vmm::boot, 0);
 
         kern_thread->start();        
         while (true) {
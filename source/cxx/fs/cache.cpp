@@ -7,6 +7,7 @@
 #include "mm/vmm.hpp"
 #include "prs/list.hpp"
 #include "smarter/smarter.hpp"
+#include "sys/sched/mutex.hpp"
 #include "sys/sched/sched.hpp"
 #include "sys/sched/time.hpp"
 #include "util/lock.hpp"
@@ -15,6 +16,7 @@
 #include <util/log/panic.hpp>
 #include <cstddef>
 #include <fs/cache.hpp>
+#include <mm/kstack.hpp>
 #include <mm/mm.hpp>
 #include <mm/pmm.hpp>
 
@@ -31,7 +33,7 @@ frg::tuple<
     ssize_t,
     void *
 > cache::holder::read_page(size_t offset) {
-    util::lock_guard guard{lock};
+    sched::mutex_guard guard{lock};
 
     uintptr_t *page = address_tree.find(offset);
     void *out_page = page == nullptr ? pmm::alloc(1) : (void *) *page;
@@ -52,7 +54,7 @@ frg::tuple<
     ssize_t,
     void *
 > cache::holder::write_page(size_t offset) {
-    util::lock_guard guard{lock};
+    sched::mutex_guard guard{lock};
 
     uintptr_t *page = address_tree.find(offset);
     void *out_page = page == nullptr ? pmm::alloc(1) : (void *) *page;
@@ -75,7 +77,7 @@ frg::tuple<
 
 // TODO: add disk flushing
 ssize_t cache::holder::release_page(size_t offset) {
-    util::lock_guard guard{lock};
+    sched::mutex_guard guard{lock};
 
     uintptr_t *page = address_tree.find(offset);
     if (page == nullptr) return -1;
@@ -199,6 +201,6 @@ void cache::sync_worker() {
 
 sched::thread *sync_thread;
 void cache::init() {
-    sync_thread = sched::create_thread(sync_worker, (uint64_t) pmm::stack(x86::initialStackSize), vmm::boot, 0);
+    sync_thread = sched::create_thread(sync_worker, kstack::alloc(), vmm::boot, 0);
     sync_thread->start();
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <util/types.hpp>
 #include <cstdint>
 #include <fs/ext2.hpp>
+#include <sys/sched/preempt.hpp>
 #include <utility>
 
 static log::subsystem logger = log::make_subsystem("EXT2");
@@ -86,6 +87,9 @@ weak_ptr<vfs::node> vfs::ext2fs::lookup(shared_ptr<node> parent, prs::string_vie
 
     auto file = private_data->head;
     while (file) {
+        // Every entry costs an inode read, large directories would otherwise hold the cpu for milliseconds
+        sched::cond_resched();
+
         ext2fs::inode inode;
         if (read_inode_entry(&inode, file->dent.inode_index) == -1) {
             return {};
@@ -66,6 +66,10 @@ frg::tuple<
             goto wait_for_event;
     }
 
+    if (evt == evtable::TIME_WAKE) {
+        return {{}, 0};
+    }
+
     util::lock_guard guard{lock};
 
     auto return_producer = latest_producer;
@@ -8,6 +8,13 @@
 #include <fs/vfs.hpp>
 #include <arch/types.hpp>
 #include <arch/x86/types.hpp>
+#include <sys/sched/mutex.hpp>
+
+// The table lock only covers the lookup, the reference keeps the fd alive once it's dropped
+static shared_ptr<vfs::fd> get_fd(sched::process *process, int fd_number) {
+    util::lock_guard guard{process->fds->lock};
+    return process->fds->fd_list[fd_number];
+}
 
 shared_ptr<vfs::node> resolve_dirfd(int dirfd, prs::string_view path, sched::process *process) {
     bool is_relative = path != '/';
@@ -16,7 +23,7 @@ shared_ptr<vfs::node> resolve_dirfd(int dirfd, prs::string_view path, sched::pro
             return process->cwd;
         }
 
-        auto fd = process->fds->fd_list[dirfd];
+        auto fd = get_fd(process, dirfd);
         if (!fd || !fd->desc->node) {
             arch::set_errno(EBADF);
 
@@ -271,8 +278,6 @@ void syscall_pipe(arch::irq_regs *r) {
     int *fd_nums = (int *) r->rdi;
 
     auto process = arch::get_process();
-    util::lock_guard fd_guard{process->fds->lock};
-
     auto [fd_read, fd_write] = vfs::open_pipe(process->fds, 0);
 
     fd_nums[0] = fd_read->fd_number;
@@ -287,15 +292,14 @@ void syscall_lseek(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[r->rdi];
+    auto fd = get_fd(process, r->rdi);
     if (!fd || (fd->desc->node && fd->desc->node->type == vfs::node::type::DIRECTORY)) {
         arch::set_errno(ESPIPE);
         r->rax = -1;
         return;
     }
 
-    util::lock_guard guard{fd->lock};
+    sched::mutex_guard guard{fd->lock};
     r->rax = vfs::lseek(fd, offset, whence);
 }
 
@@ -305,14 +309,14 @@ void syscall_dup2(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    auto oldfd = process->fds->fd_list[oldfd_num];
+    auto oldfd = get_fd(process, oldfd_num);
     if (!oldfd) {
         arch::set_errno(EBADF);
         r->rax = -1;
         return;
     }
 
-    util::lock_guard guard{oldfd->lock};
+    sched::mutex_guard guard{oldfd->lock};
     auto newfd = vfs::dup(oldfd, false, newfd_num);
 
     r->rax = newfd->fd_number;
@@ -322,8 +326,7 @@ void syscall_close(arch::irq_regs *r) {
     int fd_number = r->rdi;
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd) {
         arch::set_errno(EBADF);
         r->rax = -1;
@@ -341,8 +344,7 @@ void syscall_read(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd || (fd->desc->node && fd->desc->node->type == vfs::node::type::DIRECTORY)) {
         arch::set_errno(ESPIPE);
         r->rax = -1;
@@ -356,7 +358,7 @@ void syscall_read(arch::irq_regs *r) {
         return;
     }
 
-    util::lock_guard guard{fd->lock};
+    sched::mutex_guard guard{fd->lock};
     if (fd->desc->node) {
         fd->desc->node->lock.lock();
     }
@@ -376,8 +378,7 @@ void syscall_pread(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd || (fd->desc->node && fd->desc->node->type == vfs::node::type::DIRECTORY)) {
         arch::set_errno(ESPIPE);
         r->rax = -1;
@@ -391,7 +392,7 @@ void syscall_pread(arch::irq_regs *r) {
         return;
     }
 
-    util::lock_guard guard{fd->lock};
+    sched::mutex_guard guard{fd->lock};
     if (fd->desc->node) {
         fd->desc->node->lock.lock();
     }
@@ -410,8 +411,7 @@ void syscall_write(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd || (fd->desc->node && fd->desc->node->type == vfs::node::type::DIRECTORY)) {
         arch::set_errno(ESPIPE);
         r->rax = -1;
@@ -425,7 +425,7 @@ void syscall_write(arch::irq_regs *r) {
         return;
     }
 
-    util::lock_guard guard{fd->lock};
+    sched::mutex_guard guard{fd->lock};
     if (fd->desc->node) {
         fd->desc->node->lock.lock();
     }
@@ -445,8 +445,7 @@ void syscall_pwrite(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd || (fd->desc->node && fd->desc->node->type == vfs::node::type::DIRECTORY)) {
         arch::set_errno(ESPIPE);
         r->rax = -1;
@@ -460,7 +459,7 @@ void syscall_pwrite(arch::irq_regs *r) {
         return;
     }
 
-    util::lock_guard guard{fd->lock};
+    sched::mutex_guard guard{fd->lock};
     if (fd->desc->node) {
         fd->desc->node->lock.lock();
     }
@@ -479,15 +478,14 @@ void syscall_ioctl(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd || (fd->desc->node && fd->desc->node->type == vfs::node::type::DIRECTORY)) {
         arch::set_errno(ESPIPE);
         r->rax = -1;
         return;
     }
 
-    util::lock_guard guard{fd->lock};
+    sched::mutex_guard guard{fd->lock};
     if (fd->desc->node) {
         fd->desc->node->lock.lock();
     }
@@ -610,7 +608,7 @@ void syscall_mkdirat(arch::irq_regs *r) {
         new_gid = process->effective_gid;
     }
 
-    util::lock_guard guard{dir->lock};
+    sched::mutex_guard guard{dir->lock};
     auto err = vfs::mkdir(dir, path, 0, new_mode, new_uid, new_gid);
     if (err < 0) {
         arch::set_errno(-err);
@@ -677,10 +675,10 @@ void syscall_renameat(arch::irq_regs *r) {
 
     auto dst = resolve_at(new_path, new_base);
 
-    util::lock_guard old_guard{old_dir->lock};
-    util::lock_guard new_guard{new_dir->lock};
+    sched::mutex_guard old_guard{old_dir->lock};
+    sched::mutex_guard new_guard{new_dir->lock};
 
-    util::lock_guard src_guard{src->lock};
+    sched::mutex_guard src_guard{src->lock};
     if (dst) {
         dst->lock.lock();
 
@@ -786,10 +784,10 @@ void syscall_linkat(arch::irq_regs *r) {
         return;
     }
 
-    util::lock_guard old_guard{old_dir->lock};
-    util::lock_guard new_guard{new_dir->lock};
+    sched::mutex_guard old_guard{old_dir->lock};
+    sched::mutex_guard new_guard{new_dir->lock};
 
-    util::lock_guard src_guard{src->lock};
+    sched::mutex_guard src_guard{src->lock};
 
     auto res = vfs::link(old_base, old_path, new_base, new_path, false);
 
@@ -845,8 +843,8 @@ void syscall_unlinkat(arch::irq_regs *r) {
     }
 
     auto dir = res.lock();
-    util::lock_guard dir_guard{dir->lock};
-    util::lock_guard guard{node->lock};
+    sched::mutex_guard dir_guard{dir->lock};
+    sched::mutex_guard guard{node->lock};
 
     auto err = vfs::unlink(base, path);
     if (err < 0) {
@@ -864,8 +862,7 @@ void syscall_readdir(arch::irq_regs *r) {
 
     auto process = arch::get_process();
 
-    util::lock_guard fd_guard{process->fds->lock};
-    auto fd = process->fds->fd_list[fd_number];
+    auto fd = get_fd(process, fd_number);
     if (!fd || !fd->desc->node || fd->desc->node->type != vfs::node::type::DIRECTORY) {
         arch::set_errno(EBADF);
         r->rax = 1;
@@ -874,8 +871,8 @@ void syscall_readdir(arch::irq_regs *r) {
 
     auto node = fd->desc->node;
 
-    util::lock_guard guard{fd->lock};
-    util::lock_guard node_guard{node->lock};
+    sched::mutex_guard guard{fd->lock};
+    sched::mutex_guard node_guard{node->lock};
 
     if ((node->children.size() >= fd->desc->current_ent) && node->children.size() != fd->desc->dirent_list.size()) {
         for (auto dirent: fd->desc->dirent_list) {
@@ -915,7 +912,7 @@ void syscall_readdir(arch::irq_regs *r) {
 
 void syscall_fcntl(arch::irq_regs *r) {
     auto process = arch::get_process();
-    auto fd = process->fds->fd_list[r->rdi];
+    auto fd = get_fd(process, r->rdi);
 
     if (!fd) {
         arch::set_errno(EBADF);
@@ -937,13 +934,13 @@ void syscall_fcntl(arch::irq_regs *r) {
         }
 
         case F_GETFD: {
-            util::lock_guard guard{fd->lock};
+            sched::mutex_guard guard{fd->lock};
             r->rax = fd->flags;
             break;
         }
 
         case F_SETFD: {
-            util::lock_guard guard{fd->lock};
+            sched::mutex_guard guard{fd->lock};
             fd->flags = r->rdx;
             r->rax = 0;
             break;
@@ -956,7 +953,7 @@ void syscall_fcntl(arch::irq_regs *r) {
                 return;
             }
 
-            util::lock_guard guard{fd->desc->node->lock};
+            sched::mutex_guard guard{fd->desc->node->lock};
             r->rax = fd->desc->node->flags;
             break;
         }
@@ -974,7 +971,7 @@ void syscall_fcntl(arch::irq_regs *r) {
                 return;
             }
 
-            util::lock_guard guard{fd->desc->node->lock};
+            sched::mutex_guard guard{fd->desc->node->lock};
 
             fd->desc->node->flags = r->rdx;
             r->rax = 0;
@@ -1000,8 +997,6 @@ void syscall_poll(arch::irq_regs *r) {
     }
 
     auto timespec = sched::timespec::ms(timeout);
-
-    util::lock_guard guard{process->fds->lock};
     r->rax = vfs::poll(fds, nfds, process->fds, &timespec);
 }
 
@@ -1016,7 +1011,6 @@ void syscall_ppoll(arch::irq_regs *r) {
     sigset_t original_mask;
     sched::signal::do_sigprocmask(arch::get_thread(), SIG_SETMASK, sigmask, &original_mask);
 
-    util::lock_guard guard{process->fds->lock};
     r->rax = vfs::poll(fds, nfds, process->fds, timespec);
 
     sched::signal::do_sigprocmask(arch::get_thread(), SIG_SETMASK, &original_mask, nullptr);
@@ -48,7 +48,7 @@ static prs::string_view find_name(prs::string_view path) {
     return path.substring(pos + 1);
 }
 
-weak_ptr<vfs::filesystem> ns::mount::resolve_fs(prs::string_view path, 
+weak_ptr<vfs::filesystem> ns::mount::lookup_fs(prs::string_view path, 
     shared_ptr<vfs::node> base, size_t& symlinks_traversed) {
     if (path == '/') {
         return this->resolve_root->fs;
@@ -140,7 +140,7 @@ weak_ptr<vfs::filesystem> ns::mount::resolve_fs(prs::string_view path,
                             } else return current->fs;
                         }
 
-                        next = resolve_at(next->link_target, current, symlinks_traversed);
+                        next = lookup_at(next->link_target, current, true, symlinks_traversed);
                         if (!next) return current->fs;
 
                         symlinks_traversed++;
@@ -204,7 +204,7 @@ weak_ptr<vfs::filesystem> ns::mount::resolve_fs(prs::string_view path,
                 } else return {};
             }
 
-            next = resolve_at(next->link_target, current, symlinks_traversed);
+            next = lookup_at(next->link_target, current, true, symlinks_traversed);
             if (!next) return {};
             return next->fs;
         }
@@ -214,7 +214,7 @@ weak_ptr<vfs::filesystem> ns::mount::resolve_fs(prs::string_view path,
     }
 }
 
-shared_ptr<vfs::node> ns::mount::resolve_at(prs::string_view path, shared_ptr<vfs::node> base, 
+shared_ptr<vfs::node> ns::mount::lookup_at(prs::string_view path, shared_ptr<vfs::node> base, 
     bool follow_symlink, size_t& symlinks_traversed) {
     if (path == '/') {
         return resolve_root;
@@ -298,7 +298,7 @@ shared_ptr<vfs::node> ns::mount::resolve_at(prs::string_view path, shared_ptr<vf
                             } else return {};
                         }
 
-                        next = resolve_at(next->link_target, current, symlinks_traversed);
+                        next = lookup_at(next->link_target, current, true, symlinks_traversed);
 
                         fs = next->fs.lock();
                         if (!next) {
@@ -375,7 +375,7 @@ shared_ptr<vfs::node> ns::mount::resolve_at(prs::string_view path, shared_ptr<vf
                 } else return {};
             }
 
-            next = resolve_at(next->link_target, current, symlinks_traversed);
+            next = lookup_at(next->link_target, current, true, symlinks_traversed);
             fs = next->fs.lock();
             if (!next) {
                 return {};
@@ -391,6 +391,18 @@ shared_ptr<vfs::node> ns::mount::resolve_at(prs::string_view path, shared_ptr<vf
     }
 }
 
+weak_ptr<vfs::filesystem> ns::mount::resolve_fs(prs::string_view path,
+    shared_ptr<vfs::node> base, size_t& symlinks_traversed) {
+    sched::read_guard guard{lock};
+    return lookup_fs(path, base, symlinks_traversed);
+}
+
+shared_ptr<vfs::node> ns::mount::resolve_at(prs::string_view path, shared_ptr<vfs::node> base,
+    bool follow_symlink, size_t& symlinks_traversed) {
+    sched::read_guard guard{lock};
+    return lookup_at(path, base, follow_symlink, symlinks_traversed);
+}
+
 ssize_t vfs::lseek(shared_ptr<fd> fd, off_t off, size_t whence) {
     auto desc = fd->desc;
     if (!desc->node) return -ENOTSUP;
@@ -579,18 +591,22 @@ ssize_t vfs::poll(pollfd *fds, nfds_t nfds, shared_ptr<fd_table> table, sched::t
         arena::create_resource()
     };
 
-    for (size_t i = 0; i < nfds; i++) {
-        auto pollfd = &fds[i];
-        auto fd = table->fd_list[pollfd->fd];
+    {
+        // Descriptors are held by reference once looked up, waiting below runs without the table lock
+        util::lock_guard table_guard{table->lock};
+        for (size_t i = 0; i < nfds; i++) {
+            auto pollfd = &fds[i];
+            auto fd = table->fd_list[pollfd->fd];
+
+            if (!fd) {
+                arch::set_errno(EBADF);
+                return - 1;
+            }
 
-        if (!fd) {
-            arch::set_errno(EBADF);
-            return - 1;
+            auto desc = fd->desc;
+            desc_list.push_back(desc);
+            poll_table->connect(desc->producer);
         }
-
-        auto desc = fd->desc;
-        desc_list.push_back(desc);
-        poll_table->connect(desc->producer);
     }
 
     for (size_t i = 0; i < desc_list.size(); i++) {
@@ -646,6 +662,8 @@ ssize_t vfs::poll(pollfd *fds, nfds_t nfds, shared_ptr<fd_table> table, sched::t
 }
 
 vfs::path ns::mount::resolve_abspath(shared_ptr<vfs::node> node) {
+    sched::read_guard guard{lock};
+
     shared_ptr<vfs::node> current = node;
     vfs::path path{};
     while (current
@@ -980,9 +998,13 @@ ssize_t vfs::close(shared_ptr<fd> fd) {
 
     if (!fd->table.expired()) {
         auto table = fd->table.lock();
-        table->fd_list.remove(fd->fd_number);
-        if (fd->fd_number <= table->last_fd) {
-            table->last_fd = fd->fd_number;
+
+        {
+            util::lock_guard table_guard{table->lock};
+            table->fd_list.remove(fd->fd_number);
+            if (fd->fd_number <= table->last_fd) {
+                table->last_fd = fd->fd_number;
+            }
         }
 
         if (desc->ref <= 0) {
@@ -1215,6 +1237,7 @@ ssize_t vfs::mount(shared_ptr<ns::mount> ns,
     auto src = ns->resolve_at(srcpath, nullptr);
     auto dst = ns->resolve_at(dstpath, nullptr);
 
+    sched::write_guard guard{ns->lock};
     switch (flags) {
         case (mflags::NOSRC | mflags::NODST):
         case mflags::NODST:
@@ -3,7 +3,7 @@
 #include <ipc/link.hpp>
 
 size_t ipc::link::request(ssize_t req, util::function<void(size_t)> exec_callback) {
-    lock.lock();
+    bool state = lock.lock_irqsave();
 
     size_t id = lastId++;
     queue.push({
@@ -16,7 +16,7 @@ size_t ipc::link::request(ssize_t req, util::function<void(size_t)> exec_callbac
         .len = 0
     });
 
-    lock.unlock();
+    lock.unlock_irqrestore(state);
     exec_callback(id);
 
     wire.arise(evtable::NEW_MESSAGE);
@@ -43,6 +43,8 @@ bool ipc::link::sync_wait(ssize_t req, size_t id, bool allow_signals, sched::tim
             if (evt < 0) {
                 if (allow_signals) return false;
             }
+
+            if (evt == evtable::TIME_WAKE) return false;
     }
 }
 
@@ -64,11 +66,13 @@ ipc::message
             if (evt < 0) {
                 if (allow_signals) return {-1};
             }
+
+            if (evt == evtable::TIME_WAKE) return {-1};
     }
 }
 
 void ipc::link::reply(ssize_t req, size_t id, void *data, size_t len) {
-    lock.lock();
+    bool state = lock.lock_irqsave();
 
     queue.push({
         .event = req,
@@ -80,6 +84,6 @@ void ipc::link::reply(ssize_t req, size_t id, void *data, size_t len) {
         .len = len
     });
 
-    lock.unlock();
+    lock.unlock_irqrestore(state);
     wire.arise(evtable::NEW_MESSAGE);
 }
\ No newline at end of file
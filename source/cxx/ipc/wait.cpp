@@ -0,0 +1,184 @@
+#include <cstddef>
+#include <arch/types.hpp>
+#include <ipc/wait.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <sys/sched/workqueue.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+#include <util/log/panic.hpp>
+
+int ipc::wait_queue::wait(bool interruptible, sched::timespec *timeout, bool exclusive, util::spinlock *release,
+    bool release_state) {
+    auto task = arch::get_thread();
+    entry waiter{task, this, exclusive, interruptible};
+
+    // Holding release means interrupts are already off, the state to return to is the one saved with it
+    bool irqs_enabled = release ? release_state : arch::get_irq_state();
+    arch::irq_off();
+
+    // Publish the entry first so a signal racing with us is seen either here or by interrupt()
+    bool state = task->wait_lock.lock_irqsave();
+    task->wait_entry = &waiter;
+    task->wait_lock.unlock_irqrestore(state);
+
+    state = lock.lock_irqsave();
+    if (interruptible && (waiter.interrupted || task->pending_signal)) {
+        lock.unlock_irqrestore(state);
+        if (release) release->unlock_irqrestore(false);
+
+        state = task->wait_lock.lock_irqsave();
+        task->wait_entry = nullptr;
+        task->wait_lock.unlock_irqrestore(state);
+
+        if (irqs_enabled) {
+            arch::irq_on();
+        } else {
+            arch::irq_off();
+        }
+
+        return -EINTR;
+    }
+
+    waiters.push_back(&waiter);
+
+    if (timeout) {
+        waiter.timer_pending = true;
+        waiter.timer.deadline = arch::hrtime() + timeout->to_ns();
+        arch::add_hrtimer(&waiter.timer);
+    }
+
+    arch::stop_thread(task);
+    lock.unlock_irqrestore(state);
+
+    if (release) {
+        release->unlock_irqrestore(false);
+    }
+
+    if (task->worker) {
+        sched::wq::sleeping(task);
+    }
+
+    // Every lock the caller held went with release, anything still holding preemption off can't sleep
+    if (!sched::preemptible()) {
+        panic("[WAIT]: tid %ld sleeping on %lx with preemption disabled", task->tid, this);
+    }
+
+    // Off the run queue now, this switches away once and only comes back when woken
+    arch::irq_on();
+    while (task->state == sched::thread::BLOCKED) arch::tick();
+
+    if (task->worker) {
+        sched::wq::waking(task);
+    }
+
+    // The timer may already be firing on another CPU, it must be done with our stack before we return
+    if (timeout && !arch::remove_hrtimer(&waiter.timer)) {
+        while (__atomic_load_n(&waiter.timer_pending, __ATOMIC_ACQUIRE)) {
+            asm volatile("pause");
+        }
+    }
+
+    state = task->wait_lock.lock_irqsave();
+    task->wait_entry = nullptr;
+    task->wait_lock.unlock_irqrestore(state);
+
+    state = lock.lock_irqsave();
+    if (waiter.hook.in_list) {
+        waiters.erase(&waiter);
+    }
+    lock.unlock_irqrestore(state);
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    } else {
+        arch::irq_off();
+    }
+
+    if (waiter.woken) {
+        return 0;
+    } else if (waiter.timed_out) {
+        return -ETIMEDOUT;
+    } else if (waiter.interrupted || (interruptible && task->pending_signal)) {
+        return -EINTR;
+    }
+
+    // Resumed by something else, e.g. SIGCONT
+    return 0;
+}
+
+void ipc::wait_queue::expire(void *aux) {
+    auto waiter = (entry *) aux;
+    auto queue = waiter->queue;
+
+    bool state = queue->lock.lock_irqsave();
+    if (waiter->hook.in_list) {
+        queue->waiters.erase(waiter);
+        waiter->timed_out = true;
+        arch::start_thread(waiter->task);
+    }
+    queue->lock.unlock_irqrestore(state);
+
+    __atomic_store_n(&waiter->timer_pending, false, __ATOMIC_RELEASE);
+}
+
+size_t ipc::wait_queue::wake(size_t count) {
+    util::lock_guard guard{lock};
+
+    size_t woken = 0;
+    size_t exclusive = 0;
+    auto waiter = waiters.front();
+    while (waiter) {
+        auto next = waiters.next(waiter);
+
+        if (waiter->exclusive) {
+            if (exclusive >= count) {
+                waiter = next;
+                continue;
+            }
+
+            exclusive++;
+        }
+
+        // The waiter takes our lock before returning, so its entry stays valid until we drop it
+        waiters.erase(waiter);
+        waiter->woken = true;
+        arch::start_thread(waiter->task);
+        woken++;
+
+        waiter = next;
+    }
+
+    return woken;
+}
+
+size_t ipc::wait_queue::wake_one() {
+    return wake(1);
+}
+
+size_t ipc::wait_queue::wake_all() {
+    return wake(SIZE_MAX);
+}
+
+bool ipc::wait_queue::empty() {
+    util::lock_guard guard{lock};
+    return waiters.front() == nullptr;
+}
+
+void ipc::wait_queue::interrupt(sched::thread *task) {
+    util::lock_guard guard{task->wait_lock};
+
+    auto waiter = task->wait_entry;
+    if (waiter == nullptr || !waiter->interruptible) {
+        return;
+    }
+
+    auto queue = waiter->queue;
+    util::lock_guard queue_guard{queue->lock};
+
+    waiter->interrupted = true;
+    if (waiter->hook.in_list) {
+        queue->waiters.erase(waiter);
+        arch::start_thread(task);
+    }
+}
@@ -1,69 +1,47 @@
-
 #include <cstddef>
 #include <frg/hash_map.hpp>
 #include <arch/types.hpp>
 #include <mm/mm.hpp>
 #include <sys/sched/time.hpp>
 #include <sys/sched/sched.hpp>
+#include <ipc/evtable.hpp>
 #include <ipc/wire.hpp>
+#include <util/errors.hpp>
 #include <util/lock.hpp>
 
-void ipc::wire::wait_for_wake(sched::thread *thread) {
-    lock.lock();
-    threads.push_back(thread);
-    lock.unlock();
-
-    arch::stop_thread(thread);
-
-    arch::irq_on();
-    while (thread->state == sched::thread::BLOCKED && !thread->pending_signal) arch::tick();
-
-    lock.lock();
-    threads.erase(thread);
-    lock.unlock();
-}
-
 frg::tuple<ssize_t, sched::thread *> 
     ipc::wire::wait(ssize_t event, bool allow_signals, sched::timespec *timeout) {
-    auto thread = arch::get_thread();
-    
+    uint64_t deadline = 0;
     if (timeout) {
-        arch::add_timer({
-            .spec = *timeout,
-            .wire = this
-        });        
+        deadline = arch::hrtime() + timeout->to_ns();
     }
 
-    bool irqs_enabled = arch::get_irq_state();
-    wait_for_event:
-        wait_for_wake(thread);
-
-    if ((!allow_signals && thread->pending_signal) 
-            || latest_event != event) {        
-        goto wait_for_event;
+    for (;;) {
+        sched::timespec remaining{};
+        if (timeout) {
+            uint64_t now = arch::hrtime();
+            remaining = sched::timespec::ns(deadline > now ? deadline - now : 0);
+        }
+
+        auto res = waiters.wait(allow_signals, timeout ? &remaining : nullptr);
+        if (res == -EINTR) {
+            arch::set_errno(EINTR);
+            return {-1, nullptr};
+        }
+
+        if (res == -ETIMEDOUT) {
+            return {evtable::TIME_WAKE, nullptr};
+        }
+
+        if (latest_event == event) {
+            return {latest_event, latest_waker};
+        }
     }
-
-    if (irqs_enabled) {
-        arch::irq_on();
-    } else {
-        arch::irq_off();
-    }
-
-    if (thread->pending_signal) {
-        arch::set_errno(EINTR);
-        return {-1, nullptr};
-    }
-
-    return {latest_event, latest_waker};
 }
 
 void ipc::wire::arise(ssize_t event) {
-    util::lock_guard guard{lock};
-
     latest_waker = arch::get_thread();
     latest_event = event;
 
-    for (auto thread: threads) {
-        arch::start_thread(thread);
-    }
-}
\ No newline at end of file
+    waiters.wake_all();
+}
@@ -0,0 +1,335 @@
+#include <arch/types.hpp>
+#include <arch/x86/smp.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/allocprof.hpp>
+#include <driver/dtable.hpp>
+#include <fs/dev.hpp>
+#include <mm/allocprof.hpp>
+#include <mm/common.hpp>
+#include <mm/kstack.hpp>
+#include <mm/pmm.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <util/errors.hpp>
+#include <util/ksym.hpp>
+#include <util/lock.hpp>
+#include <util/log/nanoprintf.h>
+#include <util/string.hpp>
+
+constexpr size_t MAX_CACHES = 48;
+
+struct live_entry {
+    uintptr_t addr;
+    uint64_t size;
+    uint64_t time;
+    uint16_t site;
+    allocprof::kind type;
+};
+
+static const char *kind_names[allocprof::NR_KINDS] = {
+    "arena",
+    "slab",
+    "pmm"
+};
+
+// Both open addressed. Sites are never removed, code doesn't go away, and an empty one has
+// type NR_KINDS. Live entries are removed by shifting the rest of their run back
+static live_entry *live = nullptr;
+static allocprof::site *sites = nullptr;
+static size_t live_count = 0;
+
+static uint64_t live_bytes[allocprof::NR_KINDS] = {};
+static uint64_t dropped = 0;
+
+static util::spinlock table_lock{};
+
+static uint64_t mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccd;
+    key ^= key >> 33;
+    return key;
+}
+
+// Skips its own frame and track's, so the first address is the allocator's caller. Frames
+// have to go up the stack we're on, a bad rbp stops the walk instead of faulting
+[[gnu::noinline]]
+static size_t walk(uint64_t *stack) {
+    uint64_t rbp = (uint64_t) __builtin_frame_address(0);
+    uint64_t bottom = rbp;
+    uint64_t top = bottom + (x86::initialStackSize + 1) * memory::page_size;
+
+    size_t skip = 2;
+    size_t depth = 0;
+    while (depth < allocprof::STACK_DEPTH) {
+        if (rbp < bottom || rbp + 16 > top || (rbp & 7) || rbp < memory::x86::virtualBase ||
+            kstack::in_guard(rbp) || kstack::in_guard(rbp + 8)) {
+            break;
+        }
+
+        uint64_t *frame = (uint64_t *) rbp;
+        if (frame[1] == 0) {
+            break;
+        }
+
+        if (skip) {
+            skip--;
+        } else {
+            stack[depth++] = frame[1];
+        }
+
+        if (frame[0] <= rbp) {
+            break;
+        }
+
+        bottom = rbp;
+        rbp = frame[0];
+    }
+
+    return depth;
+}
+
+// With table_lock held, -1 once every slot is taken
+static ssize_t find_site(uint64_t *stack, size_t depth, allocprof::kind type) {
+    uint64_t key = type;
+    for (size_t i = 0; i < depth; i++) {
+        key = mix(key ^ stack[i]);
+    }
+
+    size_t slot = key & (allocprof::MAX_SITES - 1);
+    for (size_t i = 0; i < allocprof::MAX_SITES; i++, slot = (slot + 1) & (allocprof::MAX_SITES - 1)) {
+        auto entry = &sites[slot];
+        if (entry->type == allocprof::NR_KINDS) {
+            memcpy(entry->stack, stack, sizeof(entry->stack));
+            entry->depth = depth;
+            entry->type = type;
+            return slot;
+        }
+
+        if (entry->type == type && entry->depth == depth && memcmp(entry->stack, stack, sizeof(entry->stack)) == 0) {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+// With table_lock held
+static void uncharge(live_entry *entry) {
+    auto owner = &sites[entry->site];
+    owner->live--;
+    owner->live_bytes -= entry->size;
+    live_bytes[entry->type] -= entry->size;
+}
+
+static void remove_entry(size_t slot) {
+    size_t mask = allocprof::MAX_LIVE - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; live[next].addr; next = (next + 1) & mask) {
+        // Only entries whose home slot isn't between the hole and where they sit can move into it
+        size_t home = mix(live[next].addr) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            live[hole] = live[next];
+            hole = next;
+        }
+    }
+
+    live[hole].addr = 0;
+    live_count--;
+}
+
+void allocprof::track(void *ptr, size_t size, kind type) {
+    if (ptr == nullptr || __atomic_load_n(&live, __ATOMIC_ACQUIRE) == nullptr) {
+        return;
+    }
+
+    uint64_t stack[STACK_DEPTH] = {};
+    size_t depth = walk(stack);
+    uint64_t now = arch::hrtime();
+
+    util::lock_guard guard{table_lock};
+
+    ssize_t index = find_site(stack, depth, type);
+    if (index < 0 || live_count >= MAX_LIVE / 4 * 3) {
+        dropped++;
+        return;
+    }
+
+    size_t slot = mix((uintptr_t) ptr) & (MAX_LIVE - 1);
+    while (live[slot].addr && live[slot].addr != (uintptr_t) ptr) {
+        slot = (slot + 1) & (MAX_LIVE - 1);
+    }
+
+    // The address came back without us seeing it freed
+    if (live[slot].addr) {
+        uncharge(&live[slot]);
+    } else {
+        live_count++;
+    }
+
+    live[slot] = { (uintptr_t) ptr, size, now, (uint16_t) index, type };
+
+    auto owner = &sites[index];
+    owner->live++;
+    owner->live_bytes += size;
+    owner->allocs++;
+    live_bytes[type] += size;
+}
+
+void allocprof::untrack(void *ptr, kind type) {
+    if (ptr == nullptr || __atomic_load_n(&live, __ATOMIC_ACQUIRE) == nullptr) {
+        return;
+    }
+
+    util::lock_guard guard{table_lock};
+
+    size_t slot = mix((uintptr_t) ptr) & (MAX_LIVE - 1);
+    while (live[slot].addr) {
+        if (live[slot].addr == (uintptr_t) ptr) {
+            if (live[slot].type == type) {
+                uncharge(&live[slot]);
+                remove_entry(slot);
+            }
+
+            return;
+        }
+
+        slot = (slot + 1) & (MAX_LIVE - 1);
+    }
+}
+
+void allocprof::init() {
+    auto table = (site *) pmm::alloc(memory::page_count(MAX_SITES * sizeof(site)));
+    for (size_t i = 0; i < MAX_SITES; i++) {
+        table[i].type = NR_KINDS;
+    }
+
+    sites = table;
+    __atomic_store_n(&live, (live_entry *) pmm::alloc(memory::page_count(MAX_LIVE * sizeof(live_entry))), __ATOMIC_RELEASE);
+}
+
+void allocprof::init_device() {
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::ALLOCPROF, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::ALLOCPROF);
+}
+
+// Sites still holding something, largest first, with their oldest allocation worked out
+static size_t sort_sites(uint16_t *order) {
+    util::lock_guard guard{table_lock};
+
+    size_t count = 0;
+    for (size_t i = 0; i < allocprof::MAX_SITES; i++) {
+        sites[i].oldest = UINT64_MAX;
+        if (sites[i].type == allocprof::NR_KINDS || sites[i].live == 0) {
+            continue;
+        }
+
+        size_t j = count++;
+        for (; j > 0 && sites[order[j - 1]].live_bytes < sites[i].live_bytes; j--) {
+            order[j] = order[j - 1];
+        }
+
+        order[j] = i;
+    }
+
+    for (size_t i = 0; i < allocprof::MAX_LIVE; i++) {
+        auto entry = &live[i];
+        if (entry->addr && entry->time < sites[entry->site].oldest) {
+            sites[entry->site].oldest = entry->time;
+        }
+    }
+
+    return count;
+}
+
+static int format_site(allocprof::site *entry, uint64_t now, char *line, size_t len) {
+    uint64_t oldest = __atomic_load_n(&entry->oldest, __ATOMIC_RELAXED);
+    uint64_t age = oldest < now ? (now - oldest) / sched::NANOS_PER_MILLI : 0;
+
+    int pos = npf_snprintf(line, len, "%-5s %8lu %12lu %10lu %10lu ", kind_names[entry->type],
+        entry->live, entry->live_bytes, entry->allocs, age);
+
+    char sym[96];
+    for (size_t i = 0; i < entry->depth && pos < (int) len; i++) {
+        ksym::format(entry->stack[i], sym, sizeof(sym));
+        pos += npf_snprintf(line + pos, len - pos, i ? " <- %s" : "%s", sym);
+    }
+
+    if (pos < (int) len) {
+        pos += npf_snprintf(line + pos, len - pos, "\n");
+    }
+
+    return pos < (int) len ? pos : len - 1;
+}
+
+static int format_cache(slab::cache_stats *stats, char *line, size_t len) {
+    size_t used = stats->objects - stats->free_objects;
+    return npf_snprintf(line, len, "%8lu %6lu %6lu %7lu %5lu %8lu %8lu %8lu%% %5lu%%\n",
+        stats->object_size, stats->pages, stats->empty, stats->partial, stats->full, used, stats->objects,
+        stats->objects ? used * 100 / stats->objects : 0,
+        stats->partial_objects ? stats->partial_free * 100 / stats->partial_objects : 0);
+}
+
+// Every read builds the whole report again, the callsites first and then the slab caches
+ssize_t allocprof::device::read(void *buf, size_t len, size_t offset) {
+    if (__atomic_load_n(&live, __ATOMIC_ACQUIRE) == nullptr) {
+        return 0;
+    }
+
+    uint16_t order[MAX_SITES];
+    size_t nr_sites = sort_sites(order);
+
+    slab::cache_stats caches[MAX_CACHES];
+    size_t nr_caches = slab::cache::collect_stats(caches, MAX_CACHES);
+    if (nr_caches > MAX_CACHES) {
+        nr_caches = MAX_CACHES;
+    }
+
+    uint64_t now = arch::hrtime();
+    size_t lines = 2 + nr_sites + 2 + nr_caches;
+
+    char line[STACK_DEPTH * 104 + 128];
+
+    return vfs::devfs::copy_lines(buf, len, offset, line, sizeof(line), [&](size_t i, char *out, size_t size) -> ssize_t {
+        if (i >= lines) {
+            return -1;
+        } else if (i == 0) {
+            util::lock_guard guard{table_lock};
+            return npf_snprintf(out, size, "live: arena %lu slab %lu pmm %lu bytes, %lu allocations, %lu dropped\n",
+                live_bytes[ARENA], live_bytes[SLAB], live_bytes[PMM], live_count, dropped);
+        } else if (i == 1) {
+            return npf_snprintf(out, size, "%-5s %8s %12s %10s %10s %s\n",
+                "kind", "live", "live_bytes", "allocs", "oldest_ms", "callsite");
+        } else if (i < 2 + nr_sites) {
+            return format_site(&sites[order[i - 2]], now, out, size);
+        } else if (i == 2 + nr_sites) {
+            return npf_snprintf(out, size, "\n");
+        } else if (i == 3 + nr_sites) {
+            return npf_snprintf(out, size, "%8s %6s %6s %7s %5s %8s %8s %9s %6s\n",
+                "size", "pages", "empty", "partial", "full", "used", "objects", "occupancy", "frag");
+        }
+
+        return format_cache(&caches[i - 4 - nr_sites], out, size);
+    });
+}
+
+ssize_t allocprof::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    if (__atomic_load_n(&live, __ATOMIC_ACQUIRE) == nullptr) {
+        return len;
+    }
+
+    util::lock_guard guard{table_lock};
+    for (size_t i = 0; i < MAX_SITES; i++) {
+        sites[i].allocs = 0;
+    }
+
+    dropped = 0;
+    return len;
+}
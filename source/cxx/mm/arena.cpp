@@ -1,5 +1,6 @@
 #include <cstddef>
 #include <cstdint>
+#include <mm/allocprof.hpp>
 #include <mm/arena.hpp>
 #include <mm/common.hpp>
 #include <mm/mm.hpp>
@@ -112,12 +113,19 @@ void *arena::arena_resource::allocate(size_t size, size_t alignment) {
     header->padding = padding;
     header->block = chosen->block;
 
+#ifdef CONFIG_ALLOCPROF
+    allocprof::track((void *) data_addr, size, allocprof::ARENA);
+#endif
     return (void *) data_addr;
 }
 
 void arena::arena_resource::deallocate(void *ptr) {
     util::lock_guard guard{lock};
 
+#ifdef CONFIG_ALLOCPROF
+    allocprof::untrack(ptr, allocprof::ARENA);
+#endif
+
     uintptr_t current_addr = (uintptr_t) ptr;
     uintptr_t header_addr = current_addr - sizeof(allocation_header);
 
@@ -11,12 +11,14 @@
 #include <mm/mm.hpp>
 #include <mm/pmm.hpp>
 #include <mm/vmm.hpp>
+#include <sys/sched/cgroup.hpp>
+#include <sys/sched/preempt.hpp>
 #include <util/log/log.hpp>
 #include <util/log/panic.hpp>
 
 vmm::vmm_ctx::vmm_ctx(): 
     holes(), page_map(nullptr), 
-    allocator(arena::create_resource()), lock() {}
+    allocator(arena::create_resource()), lock(), pt_lock(), cgrp(nullptr), charged(0) {}
 
 // TODO: update destroy for shared pages
 // TODO: free up the map
@@ -229,6 +231,10 @@ vmm::vmm_ctx::mapping::mapping_perms vmm::vmm_ctx::flags_to_perms(vmm::map_flags
 }
 
 void *vmm::vmm_ctx::create_mapping(void *addr, uint64_t len, map_flags flags, bool fill_now) {
+    if (fill_now && !sched::cgroup::charge_memory(this, memory::page_count(len))) {
+        return nullptr;
+    }
+
     void *dst = this->create_hole(addr, len);
 
     page_flags mapped_flags = to_arch(flags);
@@ -270,8 +276,14 @@ vmm::vmm_ctx::mapping *vmm::vmm_ctx::get_mapping(void *addr) {
     return nullptr;
 }
 
-void vmm::vmm_ctx::unmap_pages(void *addr, size_t len, bool free_pages) {
+// Returns how many pages of [addr, addr + len) were backed, which is what the group gets back
+size_t vmm::vmm_ctx::unmap_pages(void *addr, size_t len, bool free_pages) {
+    size_t present = 0;
     for (void *inner = addr; inner <= ((char *) addr + len); inner = (char *) inner + memory::page_size) {
+        if (inner < (char *) addr + len && resolve_single_4k(inner, page_map)) {
+            present++;
+        }
+
         if (free_pages) {
             void *phys = resolve_single_4k(inner, page_map);
 
@@ -286,6 +298,8 @@ void vmm::vmm_ctx::unmap_pages(void *addr, size_t len, bool free_pages) {
         unmap_single_4k(inner, page_map);
         shootdown(inner);
     }
+
+    return present;
 }
 
 void *vmm::vmm_ctx::delete_mappings(void *addr, uint64_t len) {
@@ -339,11 +353,13 @@ frg::tuple<vmm::vmm_ctx::mapping *, vmm::vmm_ctx::mapping *>vmm::vmm_ctx::split_
             auto left = prs::construct<mapping>(allocator, it->addr, leftSize, page_map);
 
             left->free_pages = it->free_pages;
+            left->fixed_phys = it->fixed_phys;
             left->perms = it->perms;
 
             auto right = prs::construct<mapping>(allocator, at, it->len - leftSize, page_map);
 
             right->free_pages = it->free_pages;
+            right->fixed_phys = it->fixed_phys;
             right->perms = it->perms;
 
             mappings.remove(it);
@@ -376,7 +392,11 @@ void vmm::vmm_ctx::delete_mappings(void *addr, uint64_t len, mapping *start, map
 
         if (mapping->addr >= addr && ((char *) mapping->addr + mapping->len) <= ((char *) addr + len)) {
             delete_hole(mapping->addr, mapping->len);
-            unmap_pages(mapping->addr, mapping->len, mapping->free_pages);
+            size_t present = unmap_pages(mapping->addr, mapping->len, mapping->free_pages);
+            if (!mapping->fixed_phys) {
+                sched::cgroup::uncharge_memory(this, present);
+            }
+
             mappings.remove(mapping);
             prs::destruct(allocator, mapping);
         }
@@ -385,7 +405,11 @@ void vmm::vmm_ctx::delete_mappings(void *addr, uint64_t len, mapping *start, map
 
 void vmm::vmm_ctx::delete_mapping(vmm::vmm_ctx::mapping *node) {
     this->delete_hole(node->addr, node->len);
-    unmap_pages(node->addr, node->len, node->free_pages);
+    size_t present = unmap_pages(node->addr, node->len, node->free_pages);
+    if (!node->fixed_phys) {
+        sched::cgroup::uncharge_memory(this, present);
+    }
+
     this->mappings.remove(node);
 }
 
@@ -397,6 +421,26 @@ void *vmm::vmm_ctx::map(void *virt, uint64_t len, map_flags flags, bool fixed) {
     return create_mapping(virt, len, flags, ((uint64_t) (flags & map_flags::FILL_NOW)));
 }
 
+void *vmm::vmm_ctx::map_phys(void *virt, void *phys, uint64_t len, map_flags flags, bool fixed) {
+    if (virt && fixed) {
+        delete_mappings(virt, len);
+    }
+
+    void *dst = this->create_hole(virt, len);
+
+    page_flags mapped_flags = to_arch(flags);
+    for (size_t i = 0; i < memory::page_count(len); i++) {
+        map_single_4k((char *) dst + (memory::page_size * i), (char *) phys + (memory::page_size * i), mapped_flags, page_map);
+    }
+
+    mapping *node = prs::construct<mapping>(allocator, dst, len, page_map);
+    node->fixed_phys = true;
+    node->perms = flags_to_perms(flags);
+
+    this->mappings.insert(node);
+    return dst;
+}
+
 void *vmm::vmm_ctx::stack(void *virt, uint64_t len, map_flags flags) {
     return (void *) (((uint64_t) map(virt, len, flags)) + len);
 }
@@ -423,9 +467,10 @@ void vmm::vmm_ctx::modify(void *virt, uint64_t len, map_flags flags) {
 }
 
 vmm::vmm_ctx *vmm::vmm_ctx::fork() {
-    util::lock_guard guard{lock};
+    sched::write_guard guard{lock};
 
     auto new_ctx = prs::construct<vmm_ctx>(allocator);
+    new_ctx->cgrp = cgrp;
 
     new_ctx->page_map = new_pagemap();
     new_ctx->setup_hole();
@@ -437,8 +482,19 @@ vmm::vmm_ctx *vmm::vmm_ctx::fork() {
 
         new_ctx->create_hole(current->addr, current->len);
         node->perms = current->perms;
+        node->fixed_phys = current->fixed_phys;
         new_ctx->mappings.insert(node);
 
+        if (current->fixed_phys) {
+            for (size_t i = 0; i < memory::page_count(current->len); i++) {
+                void *inner = (char *) current->addr + (memory::page_size * i);
+                map_single_4k(inner, resolve_single_4k(inner, page_map), resolve_perms_4k(inner, page_map), new_ctx->page_map);
+            }
+
+            current = mappings.successor(current);
+            continue;
+        }
+
         for (void *inner = current->addr; inner <= ((char *) current->addr + current->len); inner = (char *) inner + memory::page_size) {
             void *phys = resolve_single_4k(inner, page_map);
             page_flags perms = resolve_perms_4k(inner, page_map);
@@ -454,9 +510,11 @@ vmm::vmm_ctx *vmm::vmm_ctx::fork() {
                 memcpy(memory::add_virt(new_phys), memory::add_virt(phys), memory::page_size);
 
                 map_single_4k(inner, new_phys, perms, new_ctx->page_map);
+                sched::cgroup::charge_memory(new_ctx, 1, true);
             }
 
             shootdown(inner);
+            sched::cond_resched();
         }
 
         current = mappings.successor(current);
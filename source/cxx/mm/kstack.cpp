@@ -0,0 +1,123 @@
+#include <arch/types.hpp>
+#include <arch/vmm.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <mm/common.hpp>
+#include <mm/kstack.hpp>
+#include <mm/pmm.hpp>
+#include <mm/vmm.hpp>
+#include <util/lock.hpp>
+#include <util/log/panic.hpp>
+
+constexpr size_t stack_pages = x86::initialStackSize;
+constexpr size_t slot_size = (stack_pages + 1) * memory::page_size;
+constexpr size_t region_size = 1ull << 39;
+constexpr size_t max_slots = region_size / slot_size;
+
+constexpr size_t CACHE_DEPTH = 8;
+
+struct stack_cache {
+    uintptr_t stacks[CACHE_DEPTH];
+    size_t count;
+};
+
+// Kept in the lowest word of the free stack itself
+struct free_stack {
+    free_stack *next;
+};
+
+static DEFINE_PER_CPU(stack_cache, caches);
+
+static util::spinlock stacks_lock{};
+static free_stack *free_list = nullptr;
+static size_t next_slot = 0;
+
+static uintptr_t bottom(uintptr_t top) {
+    return top - stack_pages * memory::page_size;
+}
+
+void kstack::init() {
+    // vmm::create copies the top level of the boot map, the region's entry has to be there before
+    // any other address space exists so every one of them sees the stacks mapped later
+    auto map = vmm::boot->get_page_map();
+    size_t idx = (memory::x86::stackBase >> 39) & 0x1FF;
+
+    if (!(map[idx] & (uint64_t) vmm::page_flags::PRESENT)) {
+        map[idx] = (uint64_t) pmm::phys(1) | (uint64_t) vmm::page_flags::PRESENT | (uint64_t) vmm::page_flags::WRITE;
+    }
+}
+
+uintptr_t kstack::alloc() {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    auto cache = &caches.get();
+    if (cache->count) {
+        uintptr_t top = cache->stacks[--cache->count];
+        if (irqs_enabled) {
+            arch::irq_on();
+        }
+
+        return top;
+    }
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    util::lock_guard guard{stacks_lock};
+    if (free_list) {
+        auto node = free_list;
+        free_list = node->next;
+        return (uintptr_t) node + stack_pages * memory::page_size;
+    }
+
+    if (next_slot == max_slots) {
+        panic("[KSTACK]: Out of stack slots");
+    }
+
+    // The first page of every slot is never mapped
+    uintptr_t base = memory::x86::stackBase + (next_slot++ * slot_size) + memory::page_size;
+    uintptr_t phys = (uintptr_t) pmm::phys(stack_pages);
+    for (size_t i = 0; i < stack_pages; i++) {
+        vmm::map_single_4k((void *) (base + i * memory::page_size), (void *) (phys + i * memory::page_size),
+            vmm::page_flags::PRESENT | vmm::page_flags::WRITE | vmm::page_flags::NX, vmm::boot->get_page_map());
+    }
+
+    return base + stack_pages * memory::page_size;
+}
+
+void kstack::free(uintptr_t top) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    auto cache = &caches.get();
+    if (cache->count < CACHE_DEPTH) {
+        cache->stacks[cache->count++] = top;
+        if (irqs_enabled) {
+            arch::irq_on();
+        }
+
+        return;
+    }
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    util::lock_guard guard{stacks_lock};
+
+    auto node = (free_stack *) bottom(top);
+    node->next = free_list;
+    free_list = node;
+}
+
+bool kstack::in_guard(uintptr_t addr) {
+    if (addr < memory::x86::stackBase || addr >= memory::x86::stackBase + next_slot * slot_size) {
+        return false;
+    }
+
+    return (addr - memory::x86::stackBase) % slot_size < memory::page_size;
+}
@@ -1,6 +1,7 @@
 #include "frg/tuple.hpp"
 #include <cstddef>
 #include <cstdint>
+#include <mm/allocprof.hpp>
 #include <mm/common.hpp>
 #include <mm/pmm.hpp>
 #include <util/log/log.hpp>
@@ -284,6 +285,9 @@ void *pmm::alloc(size_t req_pages) {
     memset(alloc, 0, (req_pages + 1) * memory::page_size);
     alloc->reg = region;
 
+#ifdef CONFIG_ALLOCPROF
+    allocprof::track(((char *) alloc) + memory::page_size, req_pages * memory::page_size, allocprof::PMM);
+#endif
     return ((char *) alloc) + memory::page_size;
 }
 
@@ -300,6 +304,9 @@ void pmm::free(void *address) {
 
     util::lock_guard guard{pmm_lock};
 
+#ifdef CONFIG_ALLOCPROF
+    allocprof::untrack(address, allocprof::PMM);
+#endif
     pmm::allocation *alloc = (pmm::allocation *) (((char *) address) - memory::page_size);
     pmm::region *reg = alloc->reg;
     free_block(reg, alloc);
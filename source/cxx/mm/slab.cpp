@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include <cstddef>
 #include <cstdint>
+#include <mm/allocprof.hpp>
 #include <mm/common.hpp>
 #include <mm/slab.hpp>
 #include <mm/pmm.hpp>
@@ -200,15 +201,57 @@ slab::cache *slab::cache::create(size_t object_size) {
     return new_cache;
 }
 
+void slab::cache::get_stats(cache_stats *out) {
+    util::lock_guard guard{lock};
+
+    memset(out, 0, sizeof(cache_stats));
+    out->object_size = object_size;
+
+    slab *heads[] = { head_empty, head_partial, head_full };
+    size_t *counts[] = { &out->empty, &out->partial, &out->full };
+    for (size_t i = 0; i < util::lengthof(heads); i++) {
+        for (slab *current = heads[i]; current; current = current->next) {
+            (*counts[i])++;
+            out->pages += pages_per_slab;
+            out->objects += current->total_objects;
+            out->free_objects += current->free_objects;
+
+            if (counts[i] == &out->partial) {
+                out->partial_objects += current->total_objects;
+                out->partial_free += current->free_objects;
+            }
+        }
+    }
+}
+
+size_t slab::cache::collect_stats(cache_stats *out, size_t max) {
+    size_t count = 0;
+    for (cache *current = root_cache; current; current = current->next, count++) {
+        if (count < max) {
+            current->get_stats(&out[count]);
+        }
+    }
+
+    return count;
+}
+
 void *slab::slab_resource::allocate(size_t size, size_t alignment) {
     auto cache = cache::get_by_size(size);
-    return cache->do_allocate();
+    void *ptr = cache->do_allocate();
+#ifdef CONFIG_ALLOCPROF
+    allocprof::track(ptr, size, allocprof::SLAB);
+#endif
+
+    return ptr;
 }
 
 void slab::slab_resource::deallocate(void *ptr) {
     if (!ptr)
         return;
-    
+
+#ifdef CONFIG_ALLOCPROF
+    allocprof::untrack(ptr, allocprof::SLAB);
+#endif
     cache *current = root_cache;
     while (current) {
         if (current->has_object(ptr))
@@ -242,6 +285,9 @@ void *slab::slab_resource::reallocate(void *p, size_t new_bytes) {
         void *new_p = allocate(new_bytes);
         memcpy(new_p, p, current->object_size);
         current->do_deallocate(p);
+#ifdef CONFIG_ALLOCPROF
+        allocprof::untrack(p, allocprof::SLAB);
+#endif
 
         return new_p;
     } else {
@@ -252,11 +298,17 @@ void *slab::slab_resource::reallocate(void *p, size_t new_bytes) {
 slab::slab_resource *slab::create_resource() {
     auto meta_cache = cache::get_by_size(sizeof(slab_resource));
     auto resource = (slab_resource *) meta_cache->do_allocate();
+#ifdef CONFIG_ALLOCPROF
+    allocprof::track(resource, sizeof(slab_resource), allocprof::SLAB);
+#endif
 
     return resource;
 }
 
 slab::slab_resource::~slab_resource() {
     auto meta_cache = cache::get_by_size(sizeof(slab_resource));
+#ifdef CONFIG_ALLOCPROF
+    allocprof::untrack(this, allocprof::SLAB);
+#endif
     meta_cache->do_deallocate(this);
 }
\ No newline at end of file
@@ -0,0 +1,554 @@
+#include <arch/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <fs/dev.hpp>
+#include <mm/common.hpp>
+#include <mm/slab.hpp>
+#include <mm/vmm.hpp>
+#include <prs/construct.hpp>
+#include <prs/list.hpp>
+#include <sys/sched/cgroup.hpp>
+#include <sys/sched/rcu.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+#include <util/log/nanoprintf.h>
+#include <util/string.hpp>
+
+constexpr size_t PATH_MAX = 128;
+constexpr size_t NANOS_PER_MICRO = 1000;
+
+sched::cgroup::group::group(const char *name, group *parent): parent(parent),
+    memory_current(0), memory_peak(0), memory_max(UNLIMITED), memory_failcnt(0),
+    cpu_weight(DEFAULT_WEIGHT), cpu_lock(), cpu_quota(UNLIMITED), cpu_period(DEFAULT_PERIOD),
+    period_start(0), period_runtime(0), cpu_usage(0), nr_throttled(0),
+    pids_current(0), pids_max(UNLIMITED), nr_procs(0), nr_children(0), rcu_head(), hook() {
+    size_t len = strnlen(name, NAME_MAX - 1);
+    memcpy(this->name, name, len);
+    this->name[len] = '\0';
+}
+
+static sched::cgroup::group root_group{"", nullptr};
+sched::cgroup::group *sched::cgroup::root = &root_group;
+
+// Covers the tree, attachments and every process's cgrp pointer. Counters are atomic instead
+static util::spinlock groups_lock{};
+static prs::list<sched::cgroup::group, &sched::cgroup::group::hook> groups{};
+
+static void add_chain(uint64_t sched::cgroup::group::*field, sched::cgroup::group *grp, int64_t value) {
+    for (auto g = grp; g; g = g->parent) {
+        __atomic_add_fetch(&(g->*field), value, __ATOMIC_RELAXED);
+    }
+}
+
+static sched::cgroup::group *find_child(sched::cgroup::group *parent, const char *name, size_t len) {
+    for (auto grp: groups) {
+        if (grp->parent == parent && strnlen(grp->name, sched::cgroup::NAME_MAX) == len && strncmp(grp->name, name, len) == 0) {
+            return grp;
+        }
+    }
+
+    return nullptr;
+}
+
+// With groups_lock held. leaf is set to the last component when it doesn't exist yet
+static sched::cgroup::group *walk(const char *path, const char **leaf, size_t *leaf_len) {
+    if (path[0] != '/') {
+        return nullptr;
+    }
+
+    auto grp = sched::cgroup::root;
+    while (*path) {
+        while (*path == '/') path++;
+        if (*path == '\0') {
+            break;
+        }
+
+        size_t len = 0;
+        while (path[len] && path[len] != '/') len++;
+
+        auto child = find_child(grp, path, len);
+        if (child == nullptr) {
+            const char *rest = path + len;
+            while (*rest == '/') rest++;
+
+            if (leaf && *rest == '\0') {
+                *leaf = path;
+                *leaf_len = len;
+            }
+
+            return nullptr;
+        }
+
+        grp = child;
+        path += len;
+    }
+
+    return grp;
+}
+
+sched::cgroup::group *sched::cgroup::lookup(const char *path) {
+    util::lock_guard guard{groups_lock};
+    return walk(path, nullptr, nullptr);
+}
+
+sched::cgroup::group *sched::cgroup::create(const char *path) {
+    // The parent is everything up to the last component
+    size_t len = strnlen(path, PATH_MAX);
+    if (len == PATH_MAX) {
+        arch::set_errno(ENAMETOOLONG);
+        return nullptr;
+    }
+
+    while (len > 1 && path[len - 1] == '/') len--;
+
+    size_t split = len;
+    while (split > 0 && path[split - 1] != '/') split--;
+
+    size_t name_len = len - split;
+    if (split == 0 || name_len == 0 || name_len >= NAME_MAX) {
+        arch::set_errno(EINVAL);
+        return nullptr;
+    }
+
+    char parent_path[PATH_MAX];
+    memcpy(parent_path, path, split);
+    parent_path[split] = '\0';
+
+    char name[NAME_MAX];
+    memcpy(name, path + split, name_len);
+    name[name_len] = '\0';
+
+    util::lock_guard guard{groups_lock};
+    auto parent = walk(parent_path, nullptr, nullptr);
+    if (parent == nullptr) {
+        arch::set_errno(ENOENT);
+        return nullptr;
+    }
+
+    if (find_child(parent, name, name_len)) {
+        arch::set_errno(EEXIST);
+        return nullptr;
+    }
+
+    auto grp = prs::construct<group>(prs::allocator{slab::create_resource()}, name, parent);
+    parent->nr_children++;
+    groups.push_back(grp);
+
+    return grp;
+}
+
+static void free_group(sched::rcu::head *node) {
+    auto grp = (sched::cgroup::group *) ((char *) node - offsetof(sched::cgroup::group, rcu_head));
+    prs::destruct(prs::allocator{slab::create_resource()}, grp);
+}
+
+// The scheduler reads groups through running tasks without the lock, so they are freed after a grace period
+bool sched::cgroup::remove(group *grp) {
+    util::lock_guard guard{groups_lock};
+    if (grp == root || grp->nr_procs || grp->nr_children) {
+        arch::set_errno(EBUSY);
+        return false;
+    }
+
+    groups.erase(grp);
+    grp->parent->nr_children--;
+
+    guard.release();
+    rcu::call(&grp->rcu_head, free_group);
+    return true;
+}
+
+void sched::cgroup::attach(process *proc, group *grp) {
+    util::lock_guard guard{groups_lock};
+
+    auto old = proc->cgrp;
+    if (old == grp) {
+        return;
+    }
+
+    // A process entering its first group had its pid charged by whoever created it
+    if (old) {
+        add_chain(&group::pids_current, old, -1);
+        add_chain(&group::pids_current, grp, 1);
+        old->nr_procs--;
+    }
+
+    grp->nr_procs++;
+    proc->cgrp = grp;
+    guard.release();
+
+    if (proc->mem_ctx) {
+        assign(proc->mem_ctx, grp);
+    }
+}
+
+void sched::cgroup::assign(vmm::vmm_ctx *ctx, group *grp) {
+    if (ctx == vmm::boot) {
+        return;
+    }
+
+    sched::write_guard ctx_guard{ctx->lock};
+    util::lock_guard pt_guard{ctx->pt_lock};
+    if (ctx->cgrp == grp) {
+        return;
+    }
+
+    if (ctx->cgrp) {
+        add_chain(&group::memory_current, ctx->cgrp, -(int64_t) ctx->charged);
+    }
+
+    ctx->cgrp = grp;
+    add_chain(&group::memory_current, grp, ctx->charged);
+}
+
+void sched::cgroup::detach(process *proc) {
+    util::lock_guard guard{groups_lock};
+
+    auto grp = proc->cgrp;
+    if (grp == nullptr) {
+        return;
+    }
+
+    uncharge_pid(grp);
+    grp->nr_procs--;
+    proc->cgrp = nullptr;
+}
+
+bool sched::cgroup::charge_pid(group *grp) {
+    for (auto g = grp; g; g = g->parent) {
+        uint64_t pids = __atomic_add_fetch(&g->pids_current, 1, __ATOMIC_RELAXED);
+        if (pids > __atomic_load_n(&g->pids_max, __ATOMIC_RELAXED)) {
+            for (auto u = grp; u != g->parent; u = u->parent) {
+                __atomic_sub_fetch(&u->pids_current, 1, __ATOMIC_RELAXED);
+            }
+
+            arch::set_errno(EAGAIN);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sched::cgroup::uncharge_pid(group *grp) {
+    add_chain(&group::pids_current, grp, -1);
+}
+
+// The caller holds ctx's lock for writing or its pt_lock, attach takes both to move the charge
+bool sched::cgroup::charge_memory(vmm::vmm_ctx *ctx, size_t pages, bool force) {
+    // Pages an address space takes before it belongs to a group are billed once it joins one
+    auto grp = ctx->cgrp;
+    if (grp == nullptr) {
+        ctx->charged += pages;
+        return true;
+    }
+
+    for (auto g = grp; g; g = g->parent) {
+        uint64_t usage = __atomic_add_fetch(&g->memory_current, pages, __ATOMIC_RELAXED);
+        if (!force && usage > __atomic_load_n(&g->memory_max, __ATOMIC_RELAXED)) {
+            for (auto u = grp; u != g->parent; u = u->parent) {
+                __atomic_sub_fetch(&u->memory_current, pages, __ATOMIC_RELAXED);
+            }
+
+            __atomic_add_fetch(&g->memory_failcnt, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        uint64_t peak = __atomic_load_n(&g->memory_peak, __ATOMIC_RELAXED);
+        while (usage > peak && !__atomic_compare_exchange_n(&g->memory_peak, &peak, usage, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    ctx->charged += pages;
+    return true;
+}
+
+// Pages shared copy-on-write are only charged to the address space that copied them, never go below zero
+void sched::cgroup::uncharge_memory(vmm::vmm_ctx *ctx, size_t pages) {
+    if (pages > ctx->charged) {
+        pages = ctx->charged;
+    }
+
+    ctx->charged -= pages;
+    if (ctx->cgrp) {
+        add_chain(&group::memory_current, ctx->cgrp, -(int64_t) pages);
+    }
+}
+
+static sched::cgroup::group *task_group(sched::thread *task) {
+    if (task->proc == nullptr || task->policy != sched::SCHED_OTHER) {
+        return nullptr;
+    }
+
+    return task->proc->cgrp;
+}
+
+// With cpu_lock held
+static void roll_period(sched::cgroup::group *grp, uint64_t now) {
+    if (now - grp->period_start >= grp->cpu_period) {
+        grp->period_start = now;
+        grp->period_runtime = 0;
+    }
+}
+
+// Usage counts every class, only fair class time goes against the quota
+void sched::cgroup::charge_cpu(thread *task, uint64_t ns) {
+    auto now = arch::hrtime();
+    bool fair = task->policy == SCHED_OTHER;
+    for (auto g = task->proc ? task->proc->cgrp : nullptr; g; g = g->parent) {
+        __atomic_add_fetch(&g->cpu_usage, ns, __ATOMIC_RELAXED);
+        if (!fair || g->cpu_quota == UNLIMITED) {
+            continue;
+        }
+
+        bool state = g->cpu_lock.lock_irqsave();
+        roll_period(g, now);
+
+        bool was_throttled = g->period_runtime >= g->cpu_quota;
+        g->period_runtime += ns;
+        if (!was_throttled && g->period_runtime >= g->cpu_quota) {
+            g->nr_throttled++;
+        }
+
+        g->cpu_lock.unlock_irqrestore(state);
+    }
+}
+
+// The tick keeps running while everything is throttled, so the next period is picked up on time
+bool sched::cgroup::throttled(thread *task) {
+    auto now = arch::hrtime();
+    for (auto g = task_group(task); g; g = g->parent) {
+        if (g->cpu_quota == UNLIMITED) {
+            continue;
+        }
+
+        bool state = g->cpu_lock.lock_irqsave();
+        roll_period(g, now);
+        bool over = g->period_runtime >= g->cpu_quota;
+        g->cpu_lock.unlock_irqrestore(state);
+
+        if (over) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t sched::cgroup::weight(thread *task) {
+    auto grp = task_group(task);
+    return grp ? grp->cpu_weight : DEFAULT_WEIGHT;
+}
+
+void sched::cgroup::init() {
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::CGROUP, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::CGROUP);
+}
+
+static size_t build_path(sched::cgroup::group *grp, char *buf, size_t len) {
+    if (grp->parent == nullptr) {
+        return npf_snprintf(buf, len, "/");
+    }
+
+    size_t pos = grp->parent->parent ? build_path(grp->parent, buf, len) : 0;
+    if (pos >= len) {
+        return pos;
+    }
+
+    return pos + npf_snprintf(buf + pos, len - pos, "/%s", grp->name);
+}
+
+static void format_limit(char *buf, size_t len, uint64_t value, uint64_t scale) {
+    if (value == sched::cgroup::UNLIMITED) {
+        npf_snprintf(buf, len, "max");
+    } else {
+        npf_snprintf(buf, len, "%lu", value * scale);
+    }
+}
+
+// Snapshot of the index'th group, the root first, so nothing is dereferenced once the lock is dropped
+static bool describe(size_t index, char *line, size_t len, int *line_len) {
+    char path[PATH_MAX];
+    char memory_max[24], cpu_quota[24], pids_max[24];
+
+    util::lock_guard guard{groups_lock};
+
+    auto grp = sched::cgroup::root;
+    if (index > 0) {
+        grp = nullptr;
+        size_t i = 1;
+        for (auto g: groups) {
+            if (i++ == index) {
+                grp = g;
+                break;
+            }
+        }
+    }
+
+    if (grp == nullptr) {
+        return false;
+    }
+
+    build_path(grp, path, sizeof(path));
+    format_limit(memory_max, sizeof(memory_max), grp->memory_max, memory::page_size);
+    format_limit(cpu_quota, sizeof(cpu_quota), grp->cpu_quota == sched::cgroup::UNLIMITED ? grp->cpu_quota : grp->cpu_quota / NANOS_PER_MICRO, 1);
+    format_limit(pids_max, sizeof(pids_max), grp->pids_max, 1);
+
+    *line_len = npf_snprintf(line, len, "%-24s %12lu %12lu %12s %6lu %6lu %10s %10lu %16lu %8lu %6lu %6s\n",
+        path, grp->memory_current * memory::page_size, grp->memory_peak * memory::page_size, memory_max, grp->memory_failcnt,
+        grp->cpu_weight, cpu_quota, grp->cpu_period / NANOS_PER_MICRO, grp->cpu_usage, grp->nr_throttled,
+        grp->pids_current, pids_max);
+    return true;
+}
+
+// One line per group
+ssize_t sched::cgroup::device::read(void *buf, size_t len, size_t offset) {
+    char line[256];
+
+    return vfs::devfs::copy_lines(buf, len, offset, line, sizeof(line), [](size_t i, char *out, size_t size) -> ssize_t {
+        if (i == 0) {
+            return npf_snprintf(out, size, "%-24s %12s %12s %12s %6s %6s %10s %10s %16s %8s %6s %6s\n",
+                "path", "mem_bytes", "mem_peak", "mem_max", "fails", "weight", "quota_us", "period_us",
+                "cpu_usage_ns", "throttle", "pids", "max");
+        }
+
+        int line_len;
+        if (!describe(i - 1, out, size, &line_len)) {
+            return -1;
+        }
+
+        return line_len;
+    });
+}
+
+static bool parse_value(const char *str, uint64_t *value) {
+    if (strcmp(str, "max") == 0) {
+        *value = sched::cgroup::UNLIMITED;
+        return true;
+    }
+
+    if (*str == '\0') {
+        return false;
+    }
+
+    uint64_t result = 0;
+    for (; *str; str++) {
+        if (*str < '0' || *str > '9') {
+            return false;
+        }
+
+        result = result * 10 + (*str - '0');
+    }
+
+    *value = result;
+    return true;
+}
+
+static bool set_value(sched::cgroup::group *grp, const char *key, uint64_t value) {
+    if (strcmp(key, "memory.max") == 0) {
+        __atomic_store_n(&grp->memory_max, value == sched::cgroup::UNLIMITED ? value : memory::page_count(value), __ATOMIC_RELAXED);
+    } else if (strcmp(key, "pids.max") == 0) {
+        __atomic_store_n(&grp->pids_max, value, __ATOMIC_RELAXED);
+    } else if (strcmp(key, "cpu.weight") == 0) {
+        if (value < sched::cgroup::MIN_WEIGHT || value > sched::cgroup::MAX_WEIGHT) {
+            return false;
+        }
+
+        grp->cpu_weight = value;
+    } else if (strcmp(key, "cpu.max") == 0 || strcmp(key, "cpu.period") == 0) {
+        bool period = strcmp(key, "cpu.period") == 0;
+        if (period && (value == 0 || value == sched::cgroup::UNLIMITED)) {
+            return false;
+        }
+
+        util::lock_guard guard{grp->cpu_lock};
+        if (period) {
+            grp->cpu_period = value * NANOS_PER_MICRO;
+        } else {
+            grp->cpu_quota = value == sched::cgroup::UNLIMITED ? value : value * NANOS_PER_MICRO;
+        }
+
+        grp->period_runtime = 0;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+ssize_t sched::cgroup::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    char cmd[PATH_MAX + 64];
+    if (len >= sizeof(cmd)) {
+        arch::set_errno(EINVAL);
+        return -1;
+    }
+
+    if (arch::copy_from_user(cmd, buf, len) < len) {
+        arch::set_errno(EFAULT);
+        return -1;
+    }
+
+    cmd[len] = '\0';
+
+    // One more slot than any command takes, so trailing junk shows up as a bad argument count
+    constexpr size_t MAX_ARGS = 5;
+    char *args[MAX_ARGS] = {};
+    size_t argc = 0;
+    for (char *c = cmd; *c && argc < MAX_ARGS;) {
+        while (*c == ' ' || *c == '\t' || *c == '\n') c++;
+        if (*c == '\0') {
+            break;
+        }
+
+        args[argc++] = c;
+        while (*c && *c != ' ' && *c != '\t' && *c != '\n') c++;
+        if (*c) {
+            *c++ = '\0';
+        }
+    }
+
+    if (argc < 2) {
+        arch::set_errno(EINVAL);
+        return -1;
+    }
+
+    if (strcmp(args[0], "mkdir") == 0 && argc == 2) {
+        return create(args[1]) ? len : -1;
+    }
+
+    auto grp = lookup(args[1]);
+    if (grp == nullptr) {
+        arch::set_errno(ENOENT);
+        return -1;
+    }
+
+    if (strcmp(args[0], "rmdir") == 0 && argc == 2) {
+        return remove(grp) ? len : -1;
+    }
+
+    uint64_t value;
+    if (strcmp(args[0], "attach") == 0 && argc == 3 && parse_value(args[2], &value)) {
+        auto proc = arch::get_process()->pid_ns->get_process(value);
+        if (proc == nullptr) {
+            arch::set_errno(ESRCH);
+            return -1;
+        }
+
+        attach(proc, grp);
+        return len;
+    }
+
+    // The root only accounts, like on Linux it has no limits of its own
+    if (strcmp(args[0], "set") == 0 && argc == 4 && grp != root && parse_value(args[3], &value) && set_value(grp, args[2], value)) {
+        return len;
+    }
+
+    arch::set_errno(EINVAL);
+    return -1;
+}
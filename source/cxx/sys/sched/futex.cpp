@@ -0,0 +1,551 @@
+#include <arch/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ipc/wait.hpp>
+#include <mm/common.hpp>
+#include <mm/slab.hpp>
+#include <mm/vmm.hpp>
+#include <prs/allocator.hpp>
+#include <prs/construct.hpp>
+#include <prs/list.hpp>
+#include <sys/sched/rtmutex.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+
+constexpr size_t FUTEX_BUCKET_BITS = 8;
+constexpr size_t FUTEX_BUCKETS = 1 << FUTEX_BUCKET_BITS;
+
+// Shared futexes are keyed by physical address, private ones by address space and virtual address
+struct futex_key {
+    uintptr_t addr;
+    vmm::vmm_ctx *ctx;
+
+    bool operator==(const futex_key& other) const {
+        return addr == other.addr && ctx == other.ctx;
+    }
+};
+
+struct futex_bucket;
+
+// Lives on the waiter's stack for as long as it sleeps
+struct futex_q {
+    futex_key key;
+    uint32_t bitset;
+
+    futex_bucket *bucket;
+    ipc::wait_queue queue;
+
+    prs::list_hook hook;
+};
+
+// Kernel side of a contended PI futex, the rt_mutex mirrors the owner recorded in the futex word
+struct futex_pi_state {
+    futex_key key;
+    sched::rt_mutex mutex;
+    size_t refs;
+
+    prs::list_hook hook;
+
+    futex_pi_state(futex_key key, sched::thread *owner):
+        key(key), mutex(owner), refs(0), hook() {}
+};
+
+struct futex_bucket {
+    util::spinlock lock;
+    prs::list<futex_q, &futex_q::hook> waiters;
+    prs::list<futex_pi_state, &futex_pi_state::hook> pi_states;
+};
+
+static futex_bucket buckets[FUTEX_BUCKETS];
+
+static futex_bucket *hash_key(futex_key key) {
+    uint64_t hash = (key.addr >> 2) ^ ((uintptr_t) key.ctx >> 4);
+    hash *= 0x9E3779B97F4A7C15;
+    return &buckets[hash >> (64 - FUTEX_BUCKET_BITS)];
+}
+
+static int get_key(uintptr_t vaddr, bool priv, futex_key *key) {
+    if (vaddr & (sizeof(uint32_t) - 1)) {
+        return -EINVAL;
+    }
+
+    if (vaddr >= 0x7fffffffffff) {
+        return -EFAULT;
+    }
+
+    auto ctx = arch::get_thread()->mem_ctx;
+    if (priv) {
+        *key = {.addr = vaddr, .ctx = ctx};
+        return 0;
+    }
+
+    auto ppage = (uintptr_t) ctx->resolve((void *) (vaddr & ~(memory::page_size - 1)));
+    if (!ppage) {
+        return -EFAULT;
+    }
+
+    *key = {.addr = ppage + (vaddr & (memory::page_size - 1)), .ctx = nullptr};
+    return 0;
+}
+
+// Bucket lock held. Private words are read without taking a fault, -EFAULT means the lock has to be dropped
+// and the page faulted in with fault_in_word before trying again
+static int read_word(futex_key key, uintptr_t vaddr, uint32_t *value) {
+    if (key.ctx) {
+        return arch::load_user_u32((uint32_t *) vaddr, value);
+    }
+
+    *value = __atomic_load_n((uint32_t *) memory::add_virt(key.addr), __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static int fault_in_word(uintptr_t vaddr) {
+    return arch::fault_in_user((uint32_t *) vaddr, false);
+}
+
+// A requeue may move the waiter while we wait for the lock
+static futex_bucket *lock_waiter(futex_q *q, bool *state) {
+    for (;;) {
+        auto bucket = __atomic_load_n(&q->bucket, __ATOMIC_ACQUIRE);
+        *state = bucket->lock.lock_irqsave();
+        if (bucket == q->bucket) {
+            return bucket;
+        }
+
+        bucket->lock.unlock_irqrestore(*state);
+    }
+}
+
+static void wake_waiter(futex_bucket *bucket, futex_q *q) {
+    bucket->waiters.erase(q);
+    q->queue.wake_all();
+}
+
+static ssize_t futex_wait(uintptr_t vaddr, bool priv, uint32_t expected, sched::timespec *timeout, uint32_t bitset) {
+    if (bitset == 0) {
+        return -EINVAL;
+    }
+
+    futex_key key;
+    if (auto err = get_key(vaddr, priv, &key)) {
+        return err;
+    }
+
+    futex_q q{.key = key, .bitset = bitset, .bucket = hash_key(key), .queue = {}, .hook = {}};
+    auto bucket = q.bucket;
+
+    uint32_t value;
+    bool state;
+    for (;;) {
+        state = bucket->lock.lock_irqsave();
+        if (read_word(key, vaddr, &value) == 0) {
+            break;
+        }
+
+        bucket->lock.unlock_irqrestore(state);
+        if (auto err = fault_in_word(vaddr)) {
+            return err;
+        }
+    }
+
+    if (value != expected) {
+        bucket->lock.unlock_irqrestore(state);
+        return -EAGAIN;
+    }
+
+    bucket->waiters.push_back(&q);
+
+    // The bucket lock is dropped only once we are queued, so a wake after the value check can't be lost
+    auto res = q.queue.wait(true, timeout, false, &bucket->lock, state);
+
+    bucket = lock_waiter(&q, &state);
+    bool queued = q.hook.in_list;
+    if (queued) {
+        bucket->waiters.erase(&q);
+    }
+    bucket->lock.unlock_irqrestore(state);
+
+    if (!queued) {
+        return 0;
+    }
+
+    return res ? res : -EINTR;
+}
+
+static ssize_t futex_wake(uintptr_t vaddr, bool priv, int count, uint32_t bitset) {
+    if (bitset == 0) {
+        return -EINVAL;
+    }
+
+    futex_key key;
+    if (auto err = get_key(vaddr, priv, &key)) {
+        return err;
+    }
+
+    auto bucket = hash_key(key);
+    util::lock_guard guard{bucket->lock};
+
+    ssize_t woken = 0;
+    auto q = bucket->waiters.front();
+    while (q) {
+        auto next = bucket->waiters.next(q);
+
+        if (q->key == key && (q->bitset & bitset)) {
+            wake_waiter(bucket, q);
+            if (++woken >= count) {
+                break;
+            }
+        }
+
+        q = next;
+    }
+
+    return woken;
+}
+
+static ssize_t futex_requeue(uintptr_t vaddr, uintptr_t vaddr2, bool priv, int nr_wake, int nr_requeue,
+    bool cmp, uint32_t expected) {
+    if (nr_wake < 0 || nr_requeue < 0) {
+        return -EINVAL;
+    }
+
+    futex_key key, key2;
+    if (auto err = get_key(vaddr, priv, &key)) {
+        return err;
+    }
+
+    if (auto err = get_key(vaddr2, priv, &key2)) {
+        return err;
+    }
+
+    auto bucket = hash_key(key);
+    auto bucket2 = hash_key(key2);
+
+    // Always take the pair in address order
+    auto first = bucket < bucket2 ? bucket : bucket2;
+    auto second = bucket < bucket2 ? bucket2 : bucket;
+
+    ssize_t res = 0;
+    uint32_t value = expected;
+    bool state;
+    for (;;) {
+        state = first->lock.lock_irqsave();
+        if (second != first) {
+            second->lock.lock_noirq();
+        }
+
+        if (!cmp || read_word(key, vaddr, &value) == 0) {
+            break;
+        }
+
+        if (second != first) {
+            second->lock.unlock_noirq();
+        }
+        first->lock.unlock_irqrestore(state);
+
+        if (auto err = fault_in_word(vaddr)) {
+            return err;
+        }
+    }
+
+    if (value != expected) {
+        res = -EAGAIN;
+        goto unlock;
+    }
+
+    {
+        int woken = 0, requeued = 0;
+        auto q = bucket->waiters.front();
+        while (q) {
+            auto next = bucket->waiters.next(q);
+
+            if (q->key == key) {
+                if (woken < nr_wake) {
+                    wake_waiter(bucket, q);
+                    woken++;
+                } else if (requeued < nr_requeue) {
+                    q->key = key2;
+                    if (bucket2 != bucket) {
+                        bucket->waiters.erase(q);
+                        bucket2->waiters.push_back(q);
+                        __atomic_store_n(&q->bucket, bucket2, __ATOMIC_RELEASE);
+                    }
+
+                    requeued++;
+                } else {
+                    break;
+                }
+            }
+
+            q = next;
+        }
+
+        res = woken + requeued;
+    }
+
+    unlock:
+        if (second != first) {
+            second->lock.unlock_noirq();
+        }
+        first->lock.unlock_irqrestore(state);
+
+    return res;
+}
+
+static sched::thread *find_owner(tid_t tid) {
+    auto process = arch::get_process();
+    for (size_t i = 0; i < process->threads.size(); i++) {
+        auto task = process->threads[i];
+        if (task && task->tid == tid && task->state != sched::thread::DEAD) {
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
+static futex_pi_state *find_pi_state(futex_bucket *bucket, futex_key key) {
+    for (auto state = bucket->pi_states.front(); state; state = bucket->pi_states.next(state)) {
+        if (state->key == key) {
+            return state;
+        }
+    }
+
+    return nullptr;
+}
+
+// Bucket lock held
+static void put_pi_state(futex_bucket *bucket, futex_pi_state *state) {
+    if (--state->refs > 0) {
+        return;
+    }
+
+    if (state->hook.in_list) {
+        bucket->pi_states.erase(state);
+    }
+
+    prs::destruct(prs::allocator{slab::create_resource()}, state);
+}
+
+// Bucket lock held. 0 once the caller owns the word, 1 once the owner is forced into FUTEX_UNLOCK_PI,
+// otherwise an error. -EFAULT may only mean the page has to be faulted in first
+static int lock_pi_word(uint32_t *word, sched::thread *task, bool trylock, uint32_t *owner_tid) {
+    for (;;) {
+        uint32_t value;
+        if (auto err = arch::load_user_u32(word, &value)) {
+            return err;
+        }
+
+        *owner_tid = value & sched::FUTEX_TID_MASK;
+        if (*owner_tid == (uint32_t) task->tid) {
+            return -EDEADLK;
+        }
+
+        if (*owner_tid == 0) {
+            uint32_t desired = (uint32_t) task->tid | (value & sched::FUTEX_WAITERS);
+            auto res = arch::cmpxchg_user_u32(word, &value, desired);
+            if (res <= 0) {
+                return res;
+            }
+
+            continue;
+        }
+
+        if (trylock) {
+            return -EAGAIN;
+        }
+
+        // Forces the owner into FUTEX_UNLOCK_PI instead of releasing in user space
+        if (value & sched::FUTEX_WAITERS) {
+            return 1;
+        }
+
+        auto res = arch::cmpxchg_user_u32(word, &value, value | sched::FUTEX_WAITERS);
+        if (res < 0) {
+            return res;
+        } else if (res == 0) {
+            return 1;
+        }
+    }
+}
+
+static ssize_t futex_lock_pi(uintptr_t vaddr, bool priv, sched::timespec *timeout, bool trylock) {
+    futex_key key;
+    if (auto err = get_key(vaddr, priv, &key)) {
+        return err;
+    }
+
+    auto word = (uint32_t *) vaddr;
+    auto task = arch::get_thread();
+    auto bucket = hash_key(key);
+
+    // The word is only touched without faults under the bucket lock, a page that isn't
+    // there (or is still shared copy on write after a fork) is faulted in for writing outside it
+    uint32_t owner_tid = 0;
+    int res;
+    bool irqs;
+    for (;;) {
+        irqs = bucket->lock.lock_irqsave();
+
+        res = lock_pi_word(word, task, trylock, &owner_tid);
+        if (res != -EFAULT) {
+            break;
+        }
+
+        bucket->lock.unlock_irqrestore(irqs);
+        if (auto err = arch::fault_in_user(word, true)) {
+            return err;
+        }
+    }
+
+    if (res <= 0) {
+        bucket->lock.unlock_irqrestore(irqs);
+        return res;
+    }
+
+    auto state = find_pi_state(bucket, key);
+    if (state == nullptr) {
+        auto owner = find_owner(owner_tid);
+        if (owner == nullptr) {
+            bucket->lock.unlock_irqrestore(irqs);
+            return -ESRCH;
+        }
+
+        state = prs::construct<futex_pi_state>(prs::allocator{slab::create_resource()}, key, owner);
+        bucket->pi_states.push_back(state);
+    }
+
+    state->refs++;
+
+    // Queued on the rt_mutex before the bucket lock goes, so an unlock can't slip past us
+    res = state->mutex.lock(true, timeout, &bucket->lock, irqs);
+
+    irqs = bucket->lock.lock_irqsave();
+    put_pi_state(bucket, state);
+    bucket->lock.unlock_irqrestore(irqs);
+
+    return res;
+}
+
+// Bucket lock held. Ownership has already moved on, so on a fault only the store is retried
+static int store_pi_word(futex_bucket *bucket, bool &state, uint32_t *word, uint32_t value) {
+    while (arch::store_user_u32(word, value)) {
+        bucket->lock.unlock_irqrestore(state);
+        auto err = arch::fault_in_user(word, true);
+        state = bucket->lock.lock_irqsave();
+
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+static ssize_t futex_unlock_pi(uintptr_t vaddr, bool priv) {
+    futex_key key;
+    if (auto err = get_key(vaddr, priv, &key)) {
+        return err;
+    }
+
+    auto word = (uint32_t *) vaddr;
+    auto task = arch::get_thread();
+    auto bucket = hash_key(key);
+
+    // Written below, so fault it in for writing before the lock is taken
+    if (auto err = arch::fault_in_user(word, true)) {
+        return err;
+    }
+
+    bool state = bucket->lock.lock_irqsave();
+
+    uint32_t value;
+    while (arch::load_user_u32(word, &value)) {
+        bucket->lock.unlock_irqrestore(state);
+        if (auto err = arch::fault_in_user(word, true)) {
+            return err;
+        }
+
+        state = bucket->lock.lock_irqsave();
+    }
+
+    if ((value & sched::FUTEX_TID_MASK) != (uint32_t) task->tid) {
+        bucket->lock.unlock_irqrestore(state);
+        return -EPERM;
+    }
+
+    auto pi_state = find_pi_state(bucket, key);
+    if (pi_state) {
+        // Ownership passes straight to the top waiter, the word has to name it before user space looks again
+        auto next = pi_state->mutex.unlock();
+        if (next) {
+            uint32_t desired = (uint32_t) next->tid | (pi_state->mutex.has_waiters() ? sched::FUTEX_WAITERS : 0);
+            auto err = store_pi_word(bucket, state, word, desired);
+            bucket->lock.unlock_irqrestore(state);
+            return err;
+        }
+
+        bucket->pi_states.erase(pi_state);
+        if (pi_state->refs == 0) {
+            prs::destruct(prs::allocator{slab::create_resource()}, pi_state);
+        }
+    }
+
+    auto err = store_pi_word(bucket, state, word, 0);
+    bucket->lock.unlock_irqrestore(state);
+    return err;
+}
+
+static bool to_relative(sched::timespec *timeout, bool realtime) {
+    auto now = realtime ? sched::clock_rt() : sched::clock_mono();
+    if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= sched::NANOS_PER_SEC) {
+        return false;
+    }
+
+    *timeout = *timeout - now;
+    return true;
+}
+
+ssize_t sched::do_futex(uintptr_t vaddr, int op, uint32_t val, timespec *timeout,
+    uint32_t val2, uintptr_t vaddr2, uint32_t val3) {
+    bool priv = op & FUTEX_PRIVATE_FLAG;
+    bool realtime = op & FUTEX_CLOCK_REALTIME;
+    int cmd = op & FUTEX_CMD_MASK;
+
+    if (realtime && cmd != FUTEX_WAIT_BITSET) {
+        return -ENOSYS;
+    }
+
+    switch (cmd) {
+        case FUTEX_WAIT:
+            return futex_wait(vaddr, priv, val, timeout, FUTEX_BITSET_MATCH_ANY);
+        case FUTEX_WAIT_BITSET:
+            if (timeout && !to_relative(timeout, realtime)) {
+                return -EINVAL;
+            }
+
+            return futex_wait(vaddr, priv, val, timeout, val3);
+        case FUTEX_WAKE:
+            return futex_wake(vaddr, priv, val, FUTEX_BITSET_MATCH_ANY);
+        case FUTEX_WAKE_BITSET:
+            return futex_wake(vaddr, priv, val, val3);
+        case FUTEX_REQUEUE:
+            return futex_requeue(vaddr, vaddr2, priv, val, val2, false, 0);
+        case FUTEX_CMP_REQUEUE:
+            return futex_requeue(vaddr, vaddr2, priv, val, val2, true, val3);
+        case FUTEX_LOCK_PI:
+            if (timeout && !to_relative(timeout, true)) {
+                return -EINVAL;
+            }
+
+            return futex_lock_pi(vaddr, priv, timeout, false);
+        case FUTEX_TRYLOCK_PI:
+            return futex_lock_pi(vaddr, priv, nullptr, true);
+        case FUTEX_UNLOCK_PI:
+            return futex_unlock_pi(vaddr, priv);
+        default:
+            return -ENOSYS;
+    }
+}
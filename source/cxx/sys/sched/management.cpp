@@ -48,8 +48,9 @@ void ns::pid::remove_session(pid_t sid) {
     session_tree.erase(sid);
 }
 
+// Writers are serialised by their locks, the radix tree itself publishes nodes for lock-free readers
 sched::process *ns::pid::get_process(pid_t pid) {
-    util::lock_guard guard{process_lock};
+    sched::rcu::read_guard guard{};
 
     auto process_ptr = process_tree.find(pid);
     if (process_ptr == nullptr) return nullptr;
@@ -57,7 +58,7 @@ sched::process *ns::pid::get_process(pid_t pid) {
 }
 
 sched::process_group *ns::pid::get_process_group(pid_t pgid) {
-    util::lock_guard guard{process_group_lock};
+    sched::rcu::read_guard guard{};
 
     auto process_group_ptr = process_group_tree.find(pgid);
     if (process_group_ptr == nullptr) return nullptr;
@@ -65,7 +66,7 @@ sched::process_group *ns::pid::get_process_group(pid_t pgid) {
 }
 
 sched::session *ns::pid::get_session(pid_t sid) {
-    util::lock_guard guard{session_lock};
+    sched::rcu::read_guard guard{};
 
     auto session_ptr = session_tree.find(sid);
     if (session_ptr == nullptr) return nullptr;
@@ -0,0 +1,185 @@
+#include <arch/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <sys/sched/mutex.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/lock.hpp>
+#include <util/log/panic.hpp>
+
+bool sched::mutex::try_acquire(thread *task) {
+    thread *expected = nullptr;
+    return __atomic_compare_exchange_n(&owner, &expected, task, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// Worth spinning only while the owner is on a CPU and can release soon
+bool sched::mutex::spin(thread *task) {
+    for (size_t i = 0; i < SPIN_LIMIT; i++) {
+        auto current = __atomic_load_n(&owner, __ATOMIC_RELAXED);
+        if (current == nullptr) {
+            if (try_acquire(task)) {
+                return true;
+            }
+
+            continue;
+        }
+
+        if (!__atomic_load_n(&current->running, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        asm volatile("pause");
+    }
+
+    return false;
+}
+
+void sched::mutex::lock() {
+    auto task = arch::get_thread();
+
+#ifdef CONFIG_LOCK_DEBUG
+    if (__atomic_load_n(&owner, __ATOMIC_RELAXED) == task) {
+        panic("[MUTEX]: recursive lock of %lx by tid %ld", this, task->tid);
+    }
+#endif
+
+    if (try_acquire(task) || spin(task)) {
+        return;
+    }
+
+    bool state = wait_lock.lock_irqsave();
+
+    // waiting is raised before retrying, so an unlock either lets us in here or sees us and wakes us
+    __atomic_add_fetch(&waiting, 1, __ATOMIC_SEQ_CST);
+    while (!try_acquire(task)) {
+        waiters.wait(false, nullptr, true, &wait_lock, state);
+        state = wait_lock.lock_irqsave();
+    }
+
+    __atomic_sub_fetch(&waiting, 1, __ATOMIC_SEQ_CST);
+    wait_lock.unlock_irqrestore(state);
+}
+
+bool sched::mutex::try_lock() {
+    return try_acquire(arch::get_thread());
+}
+
+void sched::mutex::unlock() {
+#ifdef CONFIG_LOCK_DEBUG
+    auto task = arch::get_thread();
+    if (__atomic_load_n(&owner, __ATOMIC_RELAXED) != task) {
+        panic("[MUTEX]: unlock of %lx by tid %ld, which does not own it", this, task->tid);
+    }
+#endif
+
+    __atomic_store_n(&owner, nullptr, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiting, __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+
+    util::lock_guard guard{wait_lock};
+    waiters.wake_one();
+}
+
+bool sched::mutex::is_locked() {
+    return __atomic_load_n(&owner, __ATOMIC_RELAXED) != nullptr;
+}
+
+bool sched::mutex::is_owner() {
+    return __atomic_load_n(&owner, __ATOMIC_RELAXED) == arch::get_thread();
+}
+
+void sched::rwsem::read_lock() {
+    bool state = lock.lock_irqsave();
+
+#ifdef CONFIG_LOCK_DEBUG
+    if (writer == arch::get_thread()) {
+        panic("[RWSEM]: read lock of %lx while holding it for writing", this);
+    }
+#endif
+
+    while (writer || waiting_writers) {
+        read_queue.wait(false, nullptr, false, &lock, state);
+        state = lock.lock_irqsave();
+    }
+
+    readers++;
+    lock.unlock_irqrestore(state);
+}
+
+bool sched::rwsem::try_read_lock() {
+    util::lock_guard guard{lock};
+    if (writer || waiting_writers) {
+        return false;
+    }
+
+    readers++;
+    return true;
+}
+
+void sched::rwsem::read_unlock() {
+    util::lock_guard guard{lock};
+
+#ifdef CONFIG_LOCK_DEBUG
+    if (readers == 0) {
+        panic("[RWSEM]: read unlock of %lx without readers", this);
+    }
+#endif
+
+    readers--;
+    if (readers == 0 && waiting_writers) {
+        write_queue.wake_one();
+    }
+}
+
+void sched::rwsem::write_lock() {
+    auto task = arch::get_thread();
+
+    bool state = lock.lock_irqsave();
+
+#ifdef CONFIG_LOCK_DEBUG
+    if (writer == task) {
+        panic("[RWSEM]: recursive write lock of %lx by tid %ld", this, task->tid);
+    }
+#endif
+
+    waiting_writers++;
+    while (writer || readers) {
+        write_queue.wait(false, nullptr, true, &lock, state);
+        state = lock.lock_irqsave();
+    }
+
+    waiting_writers--;
+    writer = task;
+    lock.unlock_irqrestore(state);
+}
+
+bool sched::rwsem::try_write_lock() {
+    util::lock_guard guard{lock};
+    if (writer || readers) {
+        return false;
+    }
+
+    writer = arch::get_thread();
+    return true;
+}
+
+void sched::rwsem::write_unlock() {
+    util::lock_guard guard{lock};
+
+#ifdef CONFIG_LOCK_DEBUG
+    if (writer != arch::get_thread()) {
+        panic("[RWSEM]: write unlock of %lx by a task that does not hold it", this);
+    }
+#endif
+
+    writer = nullptr;
+    if (waiting_writers) {
+        write_queue.wake_one();
+    } else {
+        read_queue.wake_all();
+    }
+}
+
+bool sched::rwsem::is_writer() {
+    return __atomic_load_n(&writer, __ATOMIC_RELAXED) == arch::get_thread();
+}
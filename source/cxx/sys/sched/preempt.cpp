@@ -0,0 +1,35 @@
+#include <arch/types.hpp>
+#include <arch/x86/percpu.hpp>
+#include <arch/x86/smp.hpp>
+#include <cstddef>
+#include <sys/sched/preempt.hpp>
+
+void sched::preempt_disable() {
+    PERCPU_ADD(preempt_count, 1);
+}
+
+// The tick vector goes through swap_task, which clears the flag once it switches
+void sched::preempt_enable() {
+    PERCPU_ADD(preempt_count, -1);
+    if (PERCPU_READ(preempt_count) == 0 && PERCPU_READ(need_resched) && arch::get_irq_state()) {
+        arch::tick();
+    }
+}
+
+bool sched::preemptible() {
+    return PERCPU_READ(preempt_count) == 0;
+}
+
+void sched::set_need_resched() {
+    PERCPU_WRITE(need_resched, true);
+}
+
+bool sched::need_resched() {
+    return PERCPU_READ(need_resched);
+}
+
+void sched::cond_resched() {
+    if (PERCPU_READ(need_resched) && PERCPU_READ(preempt_count) == 0 && arch::get_irq_state()) {
+        arch::tick();
+    }
+}
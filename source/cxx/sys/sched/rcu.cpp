@@ -0,0 +1,231 @@
+#include <arch/types.hpp>
+#include <arch/x86/percpu.hpp>
+#include <arch/x86/smp.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ipc/wait.hpp>
+#include <sys/sched/rcu.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <util/lock.hpp>
+
+// Callbacks invoked per quiescent state, so a large backlog can't stall a tick
+constexpr size_t BATCH_LIMIT = 64;
+
+struct callback_list {
+    sched::rcu::head *first;
+    sched::rcu::head **tail;
+
+    callback_list(): first(nullptr), tail(&first) {}
+
+    void append(sched::rcu::head *node) {
+        node->next = nullptr;
+        *tail = node;
+        tail = &node->next;
+    }
+
+    void splice(callback_list &other) {
+        if (other.first == nullptr) return;
+
+        *tail = other.first;
+        tail = other.tail;
+
+        other.first = nullptr;
+        other.tail = &other.first;
+    }
+
+    sched::rcu::head *pop() {
+        auto node = first;
+        if (node) {
+            first = node->next;
+            if (first == nullptr) tail = &first;
+        }
+
+        return node;
+    }
+};
+
+// Only touched by its own CPU with interrupts off
+struct rcu_cpu {
+    uint64_t gp_seen;
+
+    // Queued since the last batch started waiting, waiting on wait_gp, and ready to run
+    callback_list next;
+    callback_list waiting;
+    uint64_t wait_gp;
+    callback_list done;
+};
+
+static DEFINE_PER_CPU(rcu_cpu, rcu_cpus);
+
+static util::spinlock gp_lock{};
+static uint64_t gp_seq = 0;
+static uint64_t gp_completed = 0;
+static uint64_t gp_needed = 0;
+static bool gp_active = false;
+static sched::cpu_set gp_pending{};
+static ipc::wait_queue gp_waiters{};
+
+// gp_lock held
+static void start_gp() {
+    gp_pending.zero();
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        gp_pending.set(x86::cpus[i]->cpu_number);
+    }
+
+    gp_active = true;
+    __atomic_store_n(&gp_seq, gp_seq + 1, __ATOMIC_RELEASE);
+}
+
+// gp_lock held. A grace period already running may have started before the caller's
+// update, so the caller always waits for the one after it
+static uint64_t request_gp() {
+    uint64_t target = gp_seq + 1;
+    if (target > gp_needed) {
+        gp_needed = target;
+    }
+
+    if (!gp_active) {
+        start_gp();
+    }
+
+    return target;
+}
+
+// gp_lock held
+static bool report_qs(rcu_cpu &cpu, size_t cpu_number) {
+    if (!gp_active || cpu.gp_seen == gp_seq) {
+        return false;
+    }
+
+    cpu.gp_seen = gp_seq;
+    gp_pending.clear(cpu_number);
+    if (!gp_pending.empty()) {
+        return false;
+    }
+
+    gp_active = false;
+    __atomic_store_n(&gp_completed, gp_seq, __ATOMIC_RELEASE);
+    if (gp_needed > gp_completed) {
+        start_gp();
+    }
+
+    return true;
+}
+
+void sched::rcu::read_lock() {
+    PERCPU_ADD(rcu_nesting, 1);
+}
+
+void sched::rcu::read_unlock() {
+    PERCPU_ADD(rcu_nesting, -1);
+}
+
+bool sched::rcu::in_read_side() {
+    return PERCPU_READ(rcu_nesting) != 0;
+}
+
+void sched::rcu::quiescent() {
+    if (in_read_side()) {
+        return;
+    }
+
+    auto &cpu = rcu_cpus.get();
+
+    if (__atomic_load_n(&gp_seq, __ATOMIC_ACQUIRE) != cpu.gp_seen) {
+        bool state = gp_lock.lock_irqsave();
+        if (report_qs(cpu, x86::get_cpu_number())) {
+            gp_waiters.wake_all();
+        }
+        gp_lock.unlock_irqrestore(state);
+    }
+
+    if (cpu.waiting.first && __atomic_load_n(&gp_completed, __ATOMIC_ACQUIRE) >= cpu.wait_gp) {
+        cpu.done.splice(cpu.waiting);
+    }
+
+    if (cpu.waiting.first == nullptr && cpu.next.first) {
+        cpu.waiting.splice(cpu.next);
+
+        bool state = gp_lock.lock_irqsave();
+        cpu.wait_gp = request_gp();
+        gp_lock.unlock_irqrestore(state);
+    }
+
+    for (size_t i = 0; i < BATCH_LIMIT; i++) {
+        auto node = cpu.done.pop();
+        if (node == nullptr) {
+            break;
+        }
+
+        node->fn(node);
+    }
+}
+
+void sched::rcu::call(head *node, void (*fn)(head *)) {
+    node->fn = fn;
+
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    rcu_cpus->next.append(node);
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+}
+
+static void kick_cpus() {
+    auto self = x86::get_locals();
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto cpu = x86::cpus[i];
+        if (cpu != self) {
+            x86::message_processor(cpu->processor_id, x86::RCU_QS, nullptr);
+        }
+    }
+}
+
+static void wait_gp(uint64_t target, bool expedited) {
+    bool irqs_enabled = arch::get_irq_state();
+
+    while (true) {
+        if (expedited) {
+            kick_cpus();
+        }
+
+        arch::irq_off();
+        sched::rcu::quiescent();
+
+        bool state = gp_lock.lock_irqsave();
+        if (gp_completed >= target) {
+            gp_lock.unlock_irqrestore(state);
+            break;
+        }
+
+        // Expedited waits poll so a grace period queued behind the running one gets kicked too
+        sched::timespec poll = sched::timespec::ms(1);
+        gp_waiters.wait(false, expedited ? &poll : nullptr, false, &gp_lock, state);
+    }
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    } else {
+        arch::irq_off();
+    }
+}
+
+void sched::rcu::synchronize() {
+    bool state = gp_lock.lock_irqsave();
+    auto target = request_gp();
+    gp_lock.unlock_irqrestore(state);
+
+    wait_gp(target, false);
+}
+
+void sched::rcu::synchronize_expedited() {
+    bool state = gp_lock.lock_irqsave();
+    auto target = request_gp();
+    gp_lock.unlock_irqrestore(state);
+
+    wait_gp(target, true);
+}
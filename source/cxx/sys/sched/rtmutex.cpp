@@ -0,0 +1,325 @@
+#include <arch/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <sys/sched/rtmutex.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+
+constexpr size_t MAX_CHAIN_DEPTH = 1024;
+
+// Lock order is a mutex's wait_lock, then a task's pi_lock. The chain walk goes from a task to the lock it
+// is blocked on against that order, so it only ever tries that wait_lock and backs off
+
+static int base_prio(sched::thread *task) {
+    return task->base_policy == sched::SCHED_OTHER ? 0 : task->base_priority;
+}
+
+static sched::thread *owner_of(uintptr_t owner) {
+    return (sched::thread *) (owner & ~((uintptr_t) 1));
+}
+
+// Interrupts stay off until lock() returns, only then do they go back to the state saved with release
+static void drop_release(util::spinlock *release) {
+    if (release) {
+        release->unlock_irqrestore(false);
+    }
+}
+
+static void restore_irqs(bool irqs_enabled) {
+    if (irqs_enabled) {
+        arch::irq_on();
+    } else {
+        arch::irq_off();
+    }
+}
+
+// wait_lock held
+void sched::rt_mutex::queue_waiter(rt_mutex_waiter *waiter) {
+    auto pos = waiters.front();
+    while (pos && pos->prio >= waiter->prio) {
+        pos = waiters.next(pos);
+    }
+
+    waiters.insert(pos, waiter);
+    __atomic_store_n(&top, waiters.front()->prio, __ATOMIC_RELAXED);
+}
+
+// wait_lock held
+void sched::rt_mutex::dequeue_waiter(rt_mutex_waiter *waiter) {
+    waiters.erase(waiter);
+
+    auto first = waiters.front();
+    __atomic_store_n(&top, first ? first->prio : 0, __ATOMIC_RELAXED);
+}
+
+// task's pi_lock held, the tops of the locks it holds are read without their wait_lock.
+// Whoever changes one walks the chain from its owner afterwards
+int sched::rt_mutex::effective_prio(thread *task) {
+    int prio = base_prio(task);
+    for (auto lock = task->pi_held.front(); lock; lock = task->pi_held.next(lock)) {
+        int top = __atomic_load_n(&lock->top, __ATOMIC_RELAXED);
+        if (top > prio) {
+            prio = top;
+        }
+    }
+
+    return prio;
+}
+
+void sched::rt_mutex::apply_prio(thread *task, int prio) {
+    task->pi_priority = prio;
+
+    if (prio == base_prio(task)) {
+        arch::set_scheduler(task, task->base_policy, task->base_priority);
+    } else {
+        arch::set_scheduler(task, task->base_policy == SCHED_OTHER ? SCHED_FIFO : task->base_policy, prio);
+    }
+}
+
+// Carries task's priority down the chain of owners it is blocked behind, holding one task's pi_lock and
+// at most one wait_lock at a time. Called with neither held. With orig set the whole chain is walked, and
+// -EDEADLK is returned if it leads back to orig
+int sched::rt_mutex::adjust_chain(thread *task, thread *orig, bool force) {
+    if (task == nullptr) {
+        return 0;
+    }
+
+    bool state = task->pi_lock.lock_irqsave();
+    for (size_t depth = 0; depth < MAX_CHAIN_DEPTH; depth++) {
+        int prio = effective_prio(task);
+        bool changed = force || prio != task->pi_priority;
+        if (changed) {
+            apply_prio(task, prio);
+        }
+
+        force = false;
+
+        auto waiter = task->pi_blocked_on;
+        if (waiter == nullptr || (!changed && orig == nullptr && waiter->prio == prio)) {
+            break;
+        }
+
+        auto lock = waiter->lock;
+        if (!lock->wait_lock.try_lock_noirq()) {
+            task->pi_lock.unlock_irqrestore(state);
+            asm volatile("pause");
+            state = task->pi_lock.lock_irqsave();
+            continue;
+        }
+
+        if (waiter->prio != prio) {
+            lock->dequeue_waiter(waiter);
+            waiter->prio = prio;
+            lock->queue_waiter(waiter);
+        }
+
+        // The owner can't hand the lock on while we hold its wait_lock
+        task->pi_lock.unlock_noirq();
+
+        task = owner_of(__atomic_load_n(&lock->owner, __ATOMIC_RELAXED));
+        if (task == nullptr || task == orig) {
+            lock->wait_lock.unlock_irqrestore(state);
+            return task ? -EDEADLK : 0;
+        }
+
+        task->pi_lock.lock_noirq();
+        lock->wait_lock.unlock_noirq();
+    }
+
+    task->pi_lock.unlock_irqrestore(state);
+    return 0;
+}
+
+void sched::rt_mutex::lock() {
+    lock(false);
+}
+
+int sched::rt_mutex::lock(bool interruptible, timespec *timeout, util::spinlock *release, bool release_state) {
+    auto task = arch::get_thread();
+    bool irqs_enabled = release ? release_state : arch::get_irq_state();
+
+    uintptr_t expected = 0;
+    if (__atomic_compare_exchange_n(&owner, &expected, (uintptr_t) task, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        drop_release(release);
+        restore_irqs(irqs_enabled);
+        return 0;
+    }
+
+    // Converted once, every pass sleeps for whatever is left of it
+    uint64_t deadline = timeout ? arch::hrtime() + timeout->to_ns() : 0;
+
+    bool state = wait_lock.lock_irqsave();
+
+    // Either take the lock as it is freed, or force the owner's unlock onto the slow path
+    for (;;) {
+        expected = __atomic_load_n(&owner, __ATOMIC_RELAXED);
+        if (expected == 0) {
+            if (__atomic_compare_exchange_n(&owner, &expected, (uintptr_t) task, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                wait_lock.unlock_irqrestore(state);
+                drop_release(release);
+                restore_irqs(irqs_enabled);
+                return 0;
+            }
+        } else if ((expected & HAS_WAITERS) || __atomic_compare_exchange_n(&owner, &expected, expected | HAS_WAITERS,
+                false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    auto holder = owner_of(owner);
+    if (holder == task) {
+        wait_lock.unlock_irqrestore(state);
+        drop_release(release);
+        restore_irqs(irqs_enabled);
+        return -EDEADLK;
+    }
+
+    rt_mutex_waiter waiter{task, this};
+
+    task->pi_lock.lock_noirq();
+    waiter.prio = task->pi_priority;
+    task->pi_blocked_on = &waiter;
+    queue_waiter(&waiter);
+    task->pi_lock.unlock_noirq();
+
+    holder->pi_lock.lock_noirq();
+    if (!pi_hook.in_list) {
+        holder->pi_held.push_back(this);
+    }
+    holder->pi_lock.unlock_noirq();
+
+    wait_lock.unlock_irqrestore(state);
+
+    // Boosts every owner down the chain, and finds a chain that comes back to us before we sleep on it
+    int res = adjust_chain(holder, task);
+
+    drop_release(release);
+
+    // Unlock hands over ownership under wait_lock, which wait() only drops once we are queued
+    state = wait_lock.lock_irqsave();
+    if (owner_of(owner) == task) {
+        res = 0;
+    }
+
+    while (res == 0 && owner_of(owner) != task) {
+        timespec remaining;
+        if (timeout) {
+            uint64_t now = arch::hrtime();
+            if (now >= deadline) {
+                res = -ETIMEDOUT;
+                break;
+            }
+
+            remaining = timespec::ns(deadline - now);
+        }
+
+        res = waiter.queue.wait(interruptible, timeout ? &remaining : nullptr, false, &wait_lock, state);
+        state = wait_lock.lock_irqsave();
+
+        if (owner_of(owner) == task) {
+            res = 0;
+            break;
+        }
+    }
+
+    if (res) {
+        task->pi_lock.lock_noirq();
+        dequeue_waiter(&waiter);
+        task->pi_blocked_on = nullptr;
+        task->pi_lock.unlock_noirq();
+
+        holder = owner_of(owner);
+        if (waiters.front() == nullptr) {
+            __atomic_and_fetch(&owner, ~HAS_WAITERS, __ATOMIC_RELAXED);
+
+            holder->pi_lock.lock_noirq();
+            if (pi_hook.in_list) {
+                holder->pi_held.erase(this);
+            }
+            holder->pi_lock.unlock_noirq();
+        }
+    }
+
+    wait_lock.unlock_irqrestore(state);
+
+    // Our boost has to come off the owner's chain again
+    if (res) {
+        adjust_chain(holder);
+    }
+
+    restore_irqs(irqs_enabled);
+    return res;
+}
+
+bool sched::rt_mutex::try_lock() {
+    uintptr_t expected = 0;
+    return __atomic_compare_exchange_n(&owner, &expected, (uintptr_t) arch::get_thread(), false,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+sched::thread *sched::rt_mutex::unlock() {
+    auto task = arch::get_thread();
+
+    uintptr_t expected = (uintptr_t) task;
+    if (__atomic_compare_exchange_n(&owner, &expected, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return nullptr;
+    }
+
+    bool state = wait_lock.lock_irqsave();
+
+    auto holder = owner_of(owner);
+    holder->pi_lock.lock_noirq();
+    if (pi_hook.in_list) {
+        holder->pi_held.erase(this);
+    }
+    holder->pi_lock.unlock_noirq();
+
+    thread *next_owner = nullptr;
+    auto next = waiters.front();
+    if (next) {
+        next_owner = next->task;
+
+        next_owner->pi_lock.lock_noirq();
+        dequeue_waiter(next);
+        next_owner->pi_blocked_on = nullptr;
+
+        bool contended = waiters.front() != nullptr;
+        __atomic_store_n(&owner, (uintptr_t) next_owner | (contended ? HAS_WAITERS : 0), __ATOMIC_RELEASE);
+        if (contended) {
+            next_owner->pi_held.push_back(this);
+        }
+        next_owner->pi_lock.unlock_noirq();
+
+        next->queue.wake_all();
+    } else {
+        __atomic_store_n(&owner, 0, __ATOMIC_RELEASE);
+    }
+
+    wait_lock.unlock_irqrestore(state);
+
+    adjust_chain(next_owner);
+    adjust_chain(holder);
+    return next_owner;
+}
+
+sched::thread *sched::rt_mutex::get_owner() {
+    return owner_of(__atomic_load_n(&owner, __ATOMIC_ACQUIRE));
+}
+
+bool sched::rt_mutex::has_waiters() {
+    util::lock_guard guard{wait_lock};
+    return waiters.front() != nullptr;
+}
+
+void sched::set_base_scheduler(thread *task, int policy, int priority) {
+    {
+        util::lock_guard guard{task->pi_lock};
+
+        task->base_policy = policy;
+        task->base_priority = policy == SCHED_OTHER ? 0 : priority;
+    }
+
+    rt_mutex::adjust_chain(task, nullptr, true);
+}
@@ -12,9 +12,12 @@
 #include <driver/tty/tty.hpp>
 #include <fs/vfs.hpp>
 #include <prs/construct.hpp>
+#include <mm/kstack.hpp>
 #include <mm/mm.hpp>
 #include <mm/pmm.hpp>
 #include <mm/vmm.hpp>
+#include <sys/sched/cgroup.hpp>
+#include <sys/sched/preempt.hpp>
 #include <sys/sched/sched.hpp>
 #include <sys/namespace.hpp>
 #include <sys/sched/signal.hpp>
@@ -23,18 +26,133 @@
 #include <util/log/panic.hpp>
 #include <util/lock.hpp>
 #include <util/elf.hpp>
+#include <util/trace.hpp>
 
 void sched::init() {
     arch::init_sched();
 }
 
+// Cached threads keep their kernel stacks, so a spawn after an exit touches neither the slab nor the pmm
+constexpr size_t THREAD_CACHE_DEPTH = 16;
+
+struct cached_thread {
+    void *storage;
+    uintptr_t kstack;
+    uintptr_t sig_kstack;
+};
+
+struct thread_cache {
+    cached_thread threads[THREAD_CACHE_DEPTH];
+    size_t count;
+};
+
+static DEFINE_PER_CPU(thread_cache, thread_caches);
+
+static void *alloc_thread(uintptr_t *kstack, uintptr_t *sig_kstack) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    auto cache = &thread_caches.get();
+    if (cache->count) {
+        auto entry = cache->threads[--cache->count];
+        if (irqs_enabled) {
+            arch::irq_on();
+        }
+
+        *kstack = entry.kstack;
+        *sig_kstack = entry.sig_kstack;
+        return entry.storage;
+    }
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    *kstack = kstack::alloc();
+    *sig_kstack = kstack::alloc();
+    return prs::allocator{slab::create_resource()}.allocate(sizeof(sched::thread));
+}
+
+static void free_thread(sched::rcu::head *node) {
+    auto task = (sched::thread *) ((char *) node - offsetof(sched::thread, rcu_head));
+
+    // Killing a thread on another CPU is only a message, it may not have been switched away
+    // from or taken off its run queue yet. Wait another grace period rather than free it under that CPU
+    if (__atomic_load_n(&task->running, __ATOMIC_ACQUIRE) || __atomic_load_n(&task->on_rq, __ATOMIC_ACQUIRE)) {
+        sched::rcu::call(&task->rcu_head, free_thread);
+        return;
+    }
+
+    cached_thread entry{task, task->kstack, task->sig_kstack};
+
+    task->~thread();
+
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    auto cache = &thread_caches.get();
+    if (cache->count < THREAD_CACHE_DEPTH) {
+        cache->threads[cache->count++] = entry;
+        if (irqs_enabled) {
+            arch::irq_on();
+        }
+
+        return;
+    }
+
+    if (irqs_enabled) {
+        arch::irq_on();
+    }
+
+    kstack::free(entry.kstack);
+    kstack::free(entry.sig_kstack);
+    prs::allocator{slab::create_resource()}.deallocate(entry.storage);
+}
+
 sched::thread *sched::create_thread(void (*main)(), uint64_t rsp, vmm::vmm_ctx *ctx, uint8_t privilege, bool assign_tid) {
-    return prs::construct<thread>(prs::allocator{slab::create_resource()},(uintptr_t) pmm::stack(x86::initialStackSize), rsp,
-        (uintptr_t) pmm::stack(x86::initialStackSize), ctx,
+    uintptr_t kstack, sig_kstack;
+    void *storage = alloc_thread(&kstack, &sig_kstack);
+
+    return new (storage) thread(kstack, rsp, sig_kstack, ctx,
         main, rsp, privilege,
         assign_tid);
 }
 
+void sched::destroy_thread(thread *task) {
+    rcu::call(&task->rcu_head, free_thread);
+}
+
+void sched::charge_time(thread *task, bool user) {
+    uint64_t now = x86::tsc();
+    uint64_t delta = now - task->acct_stamp;
+    task->acct_stamp = now;
+
+    if (user) {
+        task->usage.utime += delta;
+    } else {
+        task->usage.stime += delta;
+    }
+}
+
+sched::rusage_counters sched::thread_usage(thread *task) {
+    if (task == arch::get_thread()) {
+        charge_time(task, false);
+    }
+
+    return task->usage;
+}
+
+sched::rusage_counters sched::process_usage(process *proc) {
+    util::lock_guard guard{proc->lock};
+
+    rusage_counters usage = proc->exited_usage;
+    for (size_t i = 0; i < proc->threads.size(); i++) {
+        usage.add(thread_usage(proc->threads[i]));
+    }
+
+    return usage;
+}
+
 sched::process *ns::pid::create_process(char *name, void (*main)(), uint64_t rsp, vmm::vmm_ctx *ctx, uint8_t privilege) {
     sched::process *proc = prs::construct<sched::process>(prs::allocator{slab::create_resource()}, self.lock());
 
@@ -75,6 +193,9 @@ sched::process *ns::pid::create_process(char *name, void (*main)(), uint64_t rsp
     proc->privilege = privilege;
     proc->status = sched::WCONTINUED_CONSTRUCT;
 
+    sched::cgroup::charge_pid(sched::cgroup::root);
+    sched::cgroup::attach(proc, sched::cgroup::root);
+
     return proc;
 }
 
@@ -93,14 +214,30 @@ sched::session *ns::pid::create_session(sched::process *leader, sched::process_g
 }
 
 sched::thread *sched::fork(thread *original, vmm::vmm_ctx *ctx, arch::irq_regs *r) {
-    return prs::construct<thread>(prs::allocator{slab::create_resource()}, original, ctx, r,
-        (uintptr_t) pmm::stack(x86::initialStackSize), (uintptr_t) pmm::stack(x86::initialStackSize));
+    uintptr_t kstack, sig_kstack;
+    void *storage = alloc_thread(&kstack, &sig_kstack);
+
+    return new (storage) thread(original, ctx, r, kstack, sig_kstack);
+}
+
+sched::thread *sched::clone(process *proc, thread *caller, arch::irq_regs *r, uintptr_t stack) {
+    auto task = fork(caller, proc->mem_ctx, r);
+    if (stack) {
+        task->ctx.reg.rsp = stack;
+    }
+
+    proc->add_thread(task);
+    return task;
 }
 
-sched::process *sched::fork(process *original, thread *caller, arch::irq_regs *r) {
+sched::process *sched::fork(process *original, thread *caller, arch::irq_regs *r, uint64_t flags) {
+    if (!cgroup::charge_pid(original->cgrp)) {
+        return nullptr;
+    }
+
     process *proc = prs::construct<sched::process>(prs::allocator{slab::create_resource()});
 
-    proc->fds = vfs::copy_table(original->fds);
+    proc->fds = (flags & CLONE_FILES) ? original->fds : vfs::copy_table(original->fds);
     proc->cwd = original->cwd;
 
     proc->parent = original;
@@ -142,14 +279,13 @@ sched::process *sched::fork(process *original, thread *caller, arch::irq_regs *r
 
     proc->umask  = original->umask;
 
+    // The pid was charged up front, the address space already bills the parent's group
+    cgroup::attach(proc, original->cgrp);
+
     original->children.push_back(proc);
     return proc;
 }
 
-int sched::do_futex(uintptr_t vaddr, int op, uint32_t expected, timespec *timeout) {
-    return arch::do_futex(vaddr, op, expected, timeout);
-}
-
 sched::thread *sched::process::pick_thread(int signum) {
     for (size_t i = 0; i < threads.size(); i++) {
         if (threads[i]->state == thread::DEAD) continue;
@@ -165,20 +301,39 @@ void sched::process::start() {
     main_thread->start();
 }
 
+// With the process lock held. The thread's usage is folded in now, so nothing has to read it
+// once it's gone, and it waits in exited for reap_process
+static void retire_thread(sched::process *proc, sched::thread *task) {
+    proc->exited_usage.add(task->usage);
+    proc->threads.erase(task);
+    proc->exited.push_back(task);
+}
+
 void sched::process::kill(int exit_code) {
     if (this->pid == 0) {
         panic("Init exited.");
     }
 
-    for (size_t i = 0; i < this->threads.size(); i++) {
+    util::lock_guard threads_guard{this->lock};
+
+    size_t first_killed = exited.size();
+    for (size_t i = 0; i < this->threads.size();) {
         auto task = this->threads[i];
         if (task->tid == arch::get_tid()) {
             this->main_thread = task;
+            i++;
             continue;
         };
 
-        arch::kill_thread(task);
-        prs::destruct(prs::allocator{slab::create_resource()}, task);
+        retire_thread(this, task);
+    }
+
+    threads_guard.release();
+
+    // The kill may only be a message to the CPU it runs on, so the thread is only freed by
+    // reap_process through destroy_thread, which waits for it to be off that CPU
+    for (size_t i = first_killed; i < exited.size(); i++) {
+        arch::kill_thread(exited[i]);
     }
 
     arch::cleanup_vmm_ctx(this);
@@ -266,9 +421,60 @@ void sched::process::kill(int exit_code) {
     main_thread->pending_signal = false;
     main_thread->in_syscall = true;
 
+    sched::charge_time(main_thread, false);
+    {
+        util::lock_guard retire_guard{this->lock};
+        retire_thread(this, main_thread);
+    }
+
     arch::kill_thread(main_thread);
 }
 
+void sched::process::exit_thread(thread *task, int exit_code) {
+    // Wake pthread_join before the thread is gone, a joiner may be the one keeping the process alive
+    if (task->clear_child_tid) {
+        uint32_t zero = 0;
+        if (arch::copy_to_user((void *) task->clear_child_tid, &zero, sizeof(zero)) == sizeof(zero)) {
+            // Private and shared keys for the same word differ, the joiner may be waiting on either
+            do_futex(task->clear_child_tid, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, nullptr, 0, 0, 0);
+            do_futex(task->clear_child_tid, FUTEX_WAKE, 1, nullptr, 0, 0, 0);
+        }
+
+        task->clear_child_tid = 0;
+    }
+
+    util::lock_guard guard{this->lock};
+
+    thread *survivor = nullptr;
+    for (size_t i = 0; i < threads.size(); i++) {
+        auto other = threads[i];
+        if (other != task && other->state != thread::DEAD) {
+            survivor = other;
+            break;
+        }
+    }
+
+    if (survivor == nullptr) {
+        guard.release();
+        kill(exit_code);
+        return;
+    }
+
+    // The thread isn't freed until the process is reaped, it is still running on its stack
+    if (main_thread == task) {
+        main_thread = survivor;
+    }
+
+    task->dispatch_ready = false;
+    task->pending_signal = false;
+    task->state = thread::DEAD;
+    sched::charge_time(task, false);
+    retire_thread(this, task);
+    guard.release();
+
+    arch::kill_thread(task);
+}
+
 void sched::process::suspend() {
     for (size_t i = 0; i < threads.size(); i++) {
         auto task = threads[i];
@@ -314,11 +520,25 @@ void sched::process::add_thread(thread *task) {
     this->threads.push_back(task);
 }
 
+// The caller holds the parent's lock
 void reap_process(sched::process *zombie) {
-    auto task = zombie->main_thread;
     zombie->pid_ns->remove_process(zombie->pid);
+    sched::cgroup::detach(zombie);
+
+    // Every thread folded its usage in as it died, none of them is read here
+    if (zombie->parent) {
+        zombie->parent->child_usage.add(zombie->exited_usage);
+        zombie->parent->child_usage.add(zombie->child_usage);
+    }
+
+    for (size_t i = 0; i < zombie->exited.size(); i++) {
+        sched::destroy_thread(zombie->exited[i]);
+    }
+
+    for (size_t i = 0; i < zombie->threads.size(); i++) {
+        sched::destroy_thread(zombie->threads[i]);
+    }
 
-    prs::destruct(prs::allocator{slab::create_resource()}, task);
     prs::destruct(prs::allocator{slab::create_resource()}, zombie);
 }
 
@@ -400,6 +620,24 @@ frg::tuple<int, pid_t> sched::process::waitpid(pid_t pid, thread *waiter, int op
 
 void sched::swap_task(arch::irq_regs *r) {
     auto running_task = arch::get_thread();
+    auto prev_task = running_task;
+    bool preempted = running_task->state == thread::RUNNING;
+
+    // A task inside an RCU read-side section keeps its CPU, every other switch, idle ones included, is a quiescent state
+    if (rcu::in_read_side() && running_task->state == thread::RUNNING) {
+        return;
+    }
+
+    // Same for a held preempt count, the switch happens once it drops back to zero
+    if (!preemptible() && running_task->state == thread::RUNNING) {
+        set_need_resched();
+        return;
+    }
+
+    PERCPU_WRITE(need_resched, false);
+
+    rcu::quiescent();
+
     arch::save_context(r, running_task);
 
     auto [next_tid, next_task] = pick_task(); 
@@ -430,4 +668,16 @@ void sched::swap_task(arch::irq_regs *r) {
             signal::process_signals(next_task->proc, next_task);
         }
     }
+
+    if (arch::get_thread() != prev_task) {
+        TRACE(sched_switch, prev_task->tid, arch::get_thread()->tid, prev_task->state);
+    }
+
+    if (arch::get_thread() != prev_task && prev_task->tid != arch::get_idle_tid()) {
+        if (preempted) {
+            prev_task->usage.nivcsw++;
+        } else {
+            prev_task->usage.nvcsw++;
+        }
+    }
 }
\ No newline at end of file
@@ -118,13 +118,13 @@ int sched::signal::do_kill(pid_t pid, int sig) {
 
 int sched::signal::wait_signal(thread *task, sigset_t sigmask, sched::timespec *time) {
     auto ctx = &task->sig_ctx;
-    ctx->lock.lock();
+    bool state = ctx->lock.lock_irqsave();
 
     for (size_t i = 1; i <= SIGNAL_MAX; i++) {
         if (sigmask & SIGMASK(i)) ctx->sigdelivered &= ~SIGMASK(i);
     }
 
-    ctx->lock.unlock();
+    ctx->lock.unlock_irqrestore(state);
     for (;;) {
         for (size_t i = 1; i <= SIGNAL_MAX; i++) {
             if (ctx->sigdelivered & SIGMASK(i)) {
@@ -190,6 +190,17 @@ bool sched::signal::send_process(process *sender, process *target, int sig) {
     }
 
     ctx->sigpending |= SIGMASK(sig);
+
+    // Blocked threads no longer run to notice signals, kick one that will take it out of its wait
+    for (size_t i = 0; sig != 0 && i < target->threads.size(); i++) {
+        auto task = target->threads[i];
+        if (task->state == thread::DEAD) continue;
+        if (sig != SIGKILL && (task->sig_ctx.sigmask & SIGMASK(sig))) continue;
+
+        ipc::wait_queue::interrupt(task);
+        if (sig != SIGKILL) break;
+    }
+
     return true;
 }
 
@@ -1,5 +1,7 @@
 #include "arch/types.hpp"
 #include "arch/vmm.hpp"
+#include "arch/x86/clocksource.hpp"
+#include "arch/x86/fpu.hpp"
 #include "arch/x86/smp.hpp"
 #include "arch/x86/types.hpp"
 #include "prs/construct.hpp"
@@ -9,6 +11,7 @@
 #include <fs/vfs.hpp>
 #include <mm/common.hpp>
 #include <mm/vmm.hpp>
+#include <sys/sched/cgroup.hpp>
 #include <sys/sched/sched.hpp>
 #include <sys/sched/signal.hpp>
 #include <sys/sched/time.hpp>
@@ -119,17 +122,23 @@ void syscall_exec(arch::irq_regs *r) {
         };
 
         arch::kill_thread(task);
-        prs::destruct(mm::slab<sched::thread>(), task);
+        process->exited_usage.add(task->usage);
+        sched::destroy_thread(task);
     }
 
+    process->threads.clear();
+    process->threads.push_back(current_task);
     process->main_thread = current_task;
 
+    // Nothing may switch away while the old address space is torn down under us
+    x86::irq_off();
     x86::cleanup_vmm_ctx(process);
 
     process->mem_ctx = vmm::create();
     process->mem_ctx->swap_in(); 
     current_task->mem_ctx = process->mem_ctx;
     current_task->ctx.reg.cr3 = x86::get_cr3(process->mem_ctx->get_page_map());
+    x86::irq_on();
     
     current_task->proc->env = sched::process_env{};
     current_task->proc->env.proc = process;
@@ -153,10 +162,13 @@ void syscall_exec(arch::irq_regs *r) {
     }
 
     current_task->ustack = (uint64_t) process->mem_ctx->stack(nullptr, memory::user_stack_size, vmm::map_flags::USER | vmm::map_flags::WRITE | vmm::map_flags::DEMAND);
+    // The image is in place, from here on the new address space is held to the group's limit
+    sched::cgroup::assign(process->mem_ctx, process->cgrp);
 
     arch::init_context(current_task, (void(*)()) process->env.entry, current_task->ustack, 3);
     current_task->pid = process->pid;
     current_task->proc = process;
+    current_task->clear_child_tid = 0;
 
     process->env.load_params(argv, envp);
     process->env.place_params(envp, argv, current_task);
@@ -199,15 +211,15 @@ void syscall_exec(arch::irq_regs *r) {
     allocator.deallocate(argv);
     allocator.deallocate(envp);
 
+    x86::irq_off();
     current_task->state = sched::thread::READY;
     process->did_exec = true;
 
     x86::get_locals()->ustack = current_task->ustack;
     auto iretq_regs = arch::sched_to_irq(&current_task->ctx.reg);
 
-    x86::set_fcw(current_task->ctx.reg.fcw);
-    x86::set_mxcsr(current_task->ctx.reg.mxcsr);
-    x86::load_sse(current_task->ctx.sse_region);
+    x86::fpu::switch_to(current_task);
+    sched::charge_time(current_task, false);
 
     x86::swapgs();
     x86_sigreturn_exit(&iretq_regs);
@@ -215,16 +227,17 @@ void syscall_exec(arch::irq_regs *r) {
 
 void syscall_fork(arch::irq_regs *r) {
     auto child = sched::fork(arch::get_process(), arch::get_thread(), r);
+    if (child == nullptr) {
+        r->rax = -1;
+        return;
+    }
+
     child->start();
     
     r->rax = child->pid;
 }
 
-void syscall_exit(arch::irq_regs *r) {
-    auto process = arch::get_process();
-    
-    process->kill(r->rdi);
-
+static void exit_to_idle(arch::irq_regs *r) {
     arch::set_process(nullptr);
     arch::set_thread(arch::get_idle());
     arch::rstor_context(arch::get_idle(), r);
@@ -234,13 +247,118 @@ void syscall_exit(arch::irq_regs *r) {
     x86_sigreturn_exit(&iretq_regs);
 }
 
+// Threads share the process's fd table and signal handlers, so they can't be cloned apart from it
+void syscall_clone(arch::irq_regs *r) {
+    uint64_t flags = r->rdi;
+    uintptr_t stack = r->rsi;
+    uintptr_t parent_tid = r->rdx;
+    uintptr_t child_tid = r->r10;
+    uint64_t tls = r->r8;
+
+    constexpr uint64_t thread_flags = sched::CLONE_VM | sched::CLONE_FILES | sched::CLONE_SIGHAND;
+    bool is_thread = flags & sched::CLONE_THREAD;
+
+    if ((is_thread && (flags & thread_flags) != thread_flags) ||
+        (!is_thread && (flags & (sched::CLONE_VM | sched::CLONE_SIGHAND | sched::CLONE_CHILD_SETTID)))) {
+        arch::set_errno(EINVAL);
+        r->rax = -1;
+        return;
+    }
+
+    auto process = arch::get_process();
+    auto caller = arch::get_thread();
+
+    sched::process *child = nullptr;
+    sched::thread *task = nullptr;
+    if (is_thread) {
+        task = sched::clone(process, caller, r, stack);
+    } else {
+        child = sched::fork(process, caller, r, flags);
+        if (child == nullptr) {
+            r->rax = -1;
+            return;
+        }
+
+        task = child->main_thread;
+        if (stack) {
+            task->ctx.reg.rsp = stack;
+        }
+    }
+
+    if (flags & sched::CLONE_SETTLS) {
+        task->ctx.reg.fs = tls;
+    }
+
+    if (flags & sched::CLONE_CHILD_CLEARTID) {
+        task->clear_child_tid = child_tid;
+    }
+
+    // Like Linux, a bad tid pointer doesn't undo the clone
+    tid_t tid = is_thread ? task->tid : child->pid;
+    if (flags & sched::CLONE_PARENT_SETTID) {
+        arch::copy_to_user((void *) parent_tid, &tid, sizeof(tid));
+    }
+
+    if (flags & sched::CLONE_CHILD_SETTID) {
+        arch::copy_to_user((void *) child_tid, &tid, sizeof(tid));
+    }
+
+    if (is_thread) {
+        task->start();
+    } else {
+        child->start();
+    }
+
+    r->rax = tid;
+}
+
+void syscall_set_tid_address(arch::irq_regs *r) {
+    auto task = arch::get_thread();
+    task->clear_child_tid = r->rdi;
+
+    r->rax = task->tid;
+}
+
+void syscall_exit(arch::irq_regs *r) {
+    // A dead task that gets switched away from is never resumed to reach exit_to_idle
+    x86::irq_off();
+    auto process = arch::get_process();
+    
+    process->kill(r->rdi);
+    exit_to_idle(r);
+}
+
+void syscall_exit_thread(arch::irq_regs *r) {
+    x86::irq_off();
+    auto process = arch::get_process();
+
+    process->exit_thread(arch::get_thread(), r->rdi);
+    exit_to_idle(r);
+}
+
 void syscall_futex(arch::irq_regs *r) {
     uintptr_t uaddr = (uintptr_t) r->rdi;
     int op = r->rsi;
     uint32_t val = r->rdx;
-    sched::timespec *timeout = (sched::timespec *) r->r10;
+    uintptr_t val2 = r->r10;
+    uintptr_t uaddr2 = (uintptr_t) r->r8;
+    uint32_t val3 = r->r9;
+
+    // The fourth argument is a timeout pointer for waits and a count for requeues
+    sched::timespec timeout{};
+    bool has_timeout = false;
+
+    int cmd = op & sched::FUTEX_CMD_MASK;
+    if ((cmd == sched::FUTEX_WAIT || cmd == sched::FUTEX_WAIT_BITSET || cmd == sched::FUTEX_LOCK_PI) && val2) {
+        if (arch::copy_from_user(&timeout, (void *) val2, sizeof(sched::timespec)) < sizeof(sched::timespec)) {
+            r->rax = -EFAULT;
+            return;
+        }
+
+        has_timeout = true;
+    }
 
-    r->rax = sched::do_futex(uaddr, op, val, timeout);
+    r->rax = sched::do_futex(uaddr, op, val, has_timeout ? &timeout : nullptr, val2, uaddr2, val3);
 } 
 
 void syscall_waitpid(arch::irq_regs *r) {
@@ -276,16 +394,28 @@ void syscall_sleep(arch::irq_regs *r) {
     r->rax = 0;
 }
 
+static sched::timespec cputime(clockid_t clkid) {
+    auto usage = clkid == sched::CLOCK_PROCESS_CPUTIME_ID ?
+        sched::process_usage(arch::get_process()) : sched::thread_usage(arch::get_thread());
+
+    return sched::timespec::ns(clocksource::tsc_to_ns(usage.utime + usage.stime));
+}
+
 void syscall_clock_gettime(arch::irq_regs *r) {
     clockid_t clkid = r->rdi;
     sched::timespec *spec = (sched::timespec *) r->rsi;
 
     switch(clkid) {
         case sched::CLOCK_REALTIME:
-            *spec = sched::clock_rt;
+            *spec = sched::clock_rt();
             break;
         case sched::CLOCK_MONOTONIC:
-            *spec = sched::clock_mono;
+            *spec = sched::clock_mono();
+            break;
+        case sched::CLOCK_PROCESS_CPUTIME_ID:
+        case sched::CLOCK_THREAD_CPUTIME_ID:
+            *spec = cputime(clkid);
+            break;
         default:
             arch::set_errno(EINVAL);
             r->rax = -1;
@@ -300,10 +430,15 @@ void syscall_clock_get(arch::irq_regs *r) {
 
     switch(clkid) {
         case sched::CLOCK_REALTIME:
-            r->rax = sched::clock_rt.tv_nsec;
+            r->rax = sched::clock_rt().tv_nsec;
             break;
         case sched::CLOCK_MONOTONIC:
-            r->rax = sched::clock_mono.tv_nsec;
+            r->rax = sched::clock_mono().tv_nsec;
+            break;
+        case sched::CLOCK_PROCESS_CPUTIME_ID:
+        case sched::CLOCK_THREAD_CPUTIME_ID:
+            r->rax = cputime(clkid).tv_nsec;
+            break;
         default:
             arch::set_errno(EINVAL);
             r->rax = -1;
@@ -311,6 +446,90 @@ void syscall_clock_get(arch::irq_regs *r) {
     }
 }
 
+static sched::timeval to_timeval(uint64_t cycles) {
+    uint64_t ns = clocksource::tsc_to_ns(cycles);
+    return {
+        .tv_sec = (time_t) (ns / sched::NANOS_PER_SEC),
+        .tv_usec = (long) ((ns % sched::NANOS_PER_SEC) / 1000)
+    };
+}
+
+static long to_ticks(uint64_t cycles) {
+    return clocksource::tsc_to_ns(cycles) / (sched::NANOS_PER_SEC / sched::USER_HZ);
+}
+
+// Child totals only include children that have been waited for
+void syscall_getrusage(arch::irq_regs *r) {
+    int who = r->rdi;
+    sched::rusage *user_usage = (sched::rusage *) r->rsi;
+
+    auto process = arch::get_process();
+    sched::rusage_counters counters;
+    switch (who) {
+        case sched::RUSAGE_SELF:
+            counters = sched::process_usage(process);
+            break;
+        case sched::RUSAGE_CHILDREN: {
+            util::lock_guard guard{process->lock};
+            counters = process->child_usage;
+            break;
+        }
+        case sched::RUSAGE_THREAD:
+            counters = sched::thread_usage(arch::get_thread());
+            break;
+        default:
+            arch::set_errno(EINVAL);
+            r->rax = -1;
+            return;
+    }
+
+    sched::rusage usage{};
+    usage.ru_utime = to_timeval(counters.utime);
+    usage.ru_stime = to_timeval(counters.stime);
+    usage.ru_minflt = counters.minflt;
+    usage.ru_majflt = counters.majflt;
+    usage.ru_nvcsw = counters.nvcsw;
+    usage.ru_nivcsw = counters.nivcsw;
+
+    if (arch::copy_to_user(user_usage, &usage, sizeof(usage)) != sizeof(usage)) {
+        arch::set_errno(EFAULT);
+        r->rax = -1;
+        return;
+    }
+
+    r->rax = 0;
+}
+
+void syscall_times(arch::irq_regs *r) {
+    sched::tms *user_tms = (sched::tms *) r->rdi;
+
+    auto process = arch::get_process();
+    auto self = sched::process_usage(process);
+
+    sched::rusage_counters children;
+    {
+        util::lock_guard guard{process->lock};
+        children = process->child_usage;
+    }
+
+    if (user_tms) {
+        sched::tms buf{
+            .tms_utime = to_ticks(self.utime),
+            .tms_stime = to_ticks(self.stime),
+            .tms_cutime = to_ticks(children.utime),
+            .tms_cstime = to_ticks(children.stime)
+        };
+
+        if (arch::copy_to_user(user_tms, &buf, sizeof(buf)) != sizeof(buf)) {
+            arch::set_errno(EFAULT);
+            r->rax = -1;
+            return;
+        }
+    }
+
+    r->rax = sched::clock_mono().to_ns() / (sched::NANOS_PER_SEC / sched::USER_HZ);
+}
+
 void syscall_getpid(arch::irq_regs *r) {
     r->rax = arch::get_process()->pid;
 }
@@ -328,6 +547,212 @@ void syscall_gettid(arch::irq_regs *r) {
     r->rax = arch::get_thread()->tid;
 }
 
+static sched::thread *find_sched_target(pid_t pid) {
+    auto current_process = arch::get_process();
+    if (pid == 0) {
+        return arch::get_thread();
+    }
+
+    for (size_t i = 0; i < current_process->threads.size(); i++) {
+        auto task = current_process->threads[i];
+        if (task && task->tid == pid) {
+            return task;
+        }
+    }
+
+    auto process = current_process->pid_ns->get_process(pid);
+    if (process == nullptr) {
+        return nullptr;
+    }
+
+    return process->main_thread;
+}
+
+static bool can_sched(sched::thread *task) {
+    auto current_process = arch::get_process();
+    if (task->proc == current_process || current_process->effective_uid == 0) {
+        return true;
+    }
+
+    return task->proc && task->proc->real_uid == current_process->effective_uid;
+}
+
+void syscall_sched_setaffinity(arch::irq_regs *r) {
+    pid_t pid = r->rdi;
+    size_t size = r->rsi;
+    void *user_mask = (void *) r->rdx;
+
+    auto task = find_sched_target(pid);
+    if (task == nullptr) {
+        arch::set_errno(ESRCH);
+        r->rax = -1;
+        return;
+    }
+
+    if (!can_sched(task)) {
+        arch::set_errno(EPERM);
+        r->rax = -1;
+        return;
+    }
+
+    sched::cpu_set mask{};
+    size_t copy_size = size < sizeof(mask) ? size : sizeof(mask);
+    if (arch::copy_from_user(&mask, user_mask, copy_size) != copy_size) {
+        arch::set_errno(EFAULT);
+        r->rax = -1;
+        return;
+    }
+
+    for (size_t cpu = arch::get_cpu_count(); cpu < sched::CPU_SETSIZE; cpu++) {
+        mask.clear(cpu);
+    }
+
+    if (mask.empty()) {
+        arch::set_errno(EINVAL);
+        r->rax = -1;
+        return;
+    }
+
+    task->affinity = mask;
+
+    // The scheduler moves the task off a CPU it may no longer use at its next pick
+    if (task == arch::get_thread() && !mask.isset(arch::get_cpu_number())) {
+        arch::tick();
+    }
+
+    r->rax = 0;
+}
+
+void syscall_sched_getaffinity(arch::irq_regs *r) {
+    pid_t pid = r->rdi;
+    size_t size = r->rsi;
+    void *user_mask = (void *) r->rdx;
+
+    auto task = find_sched_target(pid);
+    if (task == nullptr) {
+        arch::set_errno(ESRCH);
+        r->rax = -1;
+        return;
+    }
+
+    if (size * 8 < arch::get_cpu_count()) {
+        arch::set_errno(EINVAL);
+        r->rax = -1;
+        return;
+    }
+
+    size_t copy_size = size < sizeof(sched::cpu_set) ? size : sizeof(sched::cpu_set);
+    sched::cpu_set mask = task->affinity;
+    for (size_t cpu = arch::get_cpu_count(); cpu < sched::CPU_SETSIZE; cpu++) {
+        mask.clear(cpu);
+    }
+
+    if (arch::copy_to_user(user_mask, &mask, copy_size) != copy_size) {
+        arch::set_errno(EFAULT);
+        r->rax = -1;
+        return;
+    }
+
+    r->rax = copy_size;
+}
+
+void syscall_sched_getcpu(arch::irq_regs *r) {
+    r->rax = arch::get_cpu_number();
+}
+
+void syscall_sched_setscheduler(arch::irq_regs *r) {
+    pid_t pid = r->rdi;
+    int policy = r->rsi;
+    sched::sched_param *user_param = (sched::sched_param *) r->rdx;
+
+    auto task = find_sched_target(pid);
+    if (task == nullptr) {
+        arch::set_errno(ESRCH);
+        r->rax = -1;
+        return;
+    }
+
+    sched::sched_param param{};
+    if (arch::copy_from_user(&param, user_param, sizeof(param)) != sizeof(param)) {
+        arch::set_errno(EFAULT);
+        r->rax = -1;
+        return;
+    }
+
+    switch (policy) {
+        case sched::SCHED_OTHER:
+            if (param.sched_priority != 0) {
+                arch::set_errno(EINVAL);
+                r->rax = -1;
+                return;
+            }
+
+            break;
+        case sched::SCHED_FIFO:
+        case sched::SCHED_RR:
+            if (param.sched_priority < sched::RT_PRIORITY_MIN || param.sched_priority > sched::RT_PRIORITY_MAX) {
+                arch::set_errno(EINVAL);
+                r->rax = -1;
+                return;
+            }
+
+            if (arch::get_process()->effective_uid != 0) {
+                arch::set_errno(EPERM);
+                r->rax = -1;
+                return;
+            }
+
+            break;
+        default:
+            arch::set_errno(EINVAL);
+            r->rax = -1;
+            return;
+    }
+
+    if (!can_sched(task)) {
+        arch::set_errno(EPERM);
+        r->rax = -1;
+        return;
+    }
+
+    sched::set_base_scheduler(task, policy, param.sched_priority);
+    r->rax = 0;
+}
+
+void syscall_sched_getscheduler(arch::irq_regs *r) {
+    pid_t pid = r->rdi;
+
+    auto task = find_sched_target(pid);
+    if (task == nullptr) {
+        arch::set_errno(ESRCH);
+        r->rax = -1;
+        return;
+    }
+
+    r->rax = task->base_policy;
+}
+
+void syscall_sched_getparam(arch::irq_regs *r) {
+    pid_t pid = r->rdi;
+    sched::sched_param *user_param = (sched::sched_param *) r->rsi;
+
+    auto task = find_sched_target(pid);
+    if (task == nullptr) {
+        arch::set_errno(ESRCH);
+        r->rax = -1;
+        return;
+    }
+
+    sched::sched_param param{ .sched_priority = task->base_priority };
+    if (arch::copy_to_user(user_param, &param, sizeof(param)) != sizeof(param)) {
+        arch::set_errno(EFAULT);
+        r->rax = -1;
+        return;
+    }
+
+    r->rax = 0;
+}
+
 void syscall_setpgid(arch::irq_regs *r) {
     pid_t pid = r->rdi == 0 ? arch::get_process()->pid : r->rdi;
     pid_t pgid = r->rsi == 0 ? arch::get_process()->pid : r->rsi;
@@ -447,12 +872,12 @@ void syscall_sigreturn(arch::irq_regs *r) {
 
     auto ctx = &current_task->sig_ctx;
 
-    ctx->lock.lock();
+    bool state = ctx->lock.lock_irqsave();
 
     ctx->sigdelivered |= SIGMASK(current_task->ucontext.signum);
     ctx->wire.arise(evtable::SIGNAL);
 
-    ctx->lock.unlock();
+    ctx->lock.unlock_irqrestore(state);
 
     auto regs = &current_task->ucontext.ctx.reg;
     current_task->ctx.reg = *regs;
@@ -471,15 +896,15 @@ void syscall_sigreturn(arch::irq_regs *r) {
 
     auto iretq_regs = arch::sched_to_irq(regs);
 
-    x86::set_fcw(regs->fcw);
-    x86::set_mxcsr(regs->mxcsr);
-    x86::load_sse(current_task->ucontext.ctx.sse_region);
+    x86::fpu::drop(current_task);
+    x86::fpu::copy_area(current_task->ctx.sse_region, current_task->ucontext.ctx.sse_region);
     
     x86::set_user_fs(regs->fs);
     x86::set_user_gs(regs->gs);
 
     current_task->state = sched::thread::READY;
     process->mem_ctx->unmap((void *) current_task->ucontext.stack, 4 * memory::page_size, true);
+    sched::charge_time(current_task, false);
 
     if (regs->cs & 0x3) {
         x86::swapgs();
@@ -555,7 +980,7 @@ void syscall_getcwd(arch::irq_regs *r) {
     auto process = arch::get_process();
     auto node = process->cwd;
 
-    util::lock_guard guard{node->lock};
+    sched::mutex_guard guard{node->lock};
     auto path = vfs::get_abspath(node);
 
     if (path.size() <= size) {
@@ -0,0 +1,481 @@
+#include <arch/types.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/wqstat.hpp>
+#include <fs/dev.hpp>
+#include <ipc/wait.hpp>
+#include <mm/kstack.hpp>
+#include <mm/slab.hpp>
+#include <mm/vmm.hpp>
+#include <prs/construct.hpp>
+#include <prs/list.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/workqueue.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+#include <util/log/nanoprintf.h>
+
+// Idle workers are kept around, so this bounds what a burst of blocking work leaves behind
+constexpr size_t MAX_WORKERS = 16;
+
+struct sched::wq::worker {
+    sched::thread *task;
+    worker_pool *pool;
+
+    // Guarded by the pool lock, blocked is only set while current is
+    work *current;
+    bool blocked;
+    prs::list_hook hook;
+
+    worker(worker_pool *pool): task(nullptr), pool(pool), current(nullptr), blocked(false), hook() {}
+};
+
+struct sched::wq::worker_pool {
+    util::spinlock lock;
+    prs::list<work, &work::hook> worklist;
+    prs::list<worker, &worker::hook> busy;
+
+    // Idle workers sleep on more_work, done is woken whenever an item finishes
+    ipc::wait_queue more_work;
+    ipc::wait_queue done;
+
+    ssize_t cpu;
+    size_t nr_workers;
+    size_t nr_idle;
+    // Busy workers that aren't blocked, new work only wakes an idle worker when this is 0
+    size_t nr_running;
+    bool creating;
+
+    worker_pool(): lock(), worklist(), busy(), more_work(), done(),
+        cpu(-1), nr_workers(0), nr_idle(0), nr_running(0), creating(false) {}
+};
+
+static DEFINE_PER_CPU(sched::wq::worker_pool, bound_pools);
+static sched::wq::worker_pool unbound_pool{};
+
+static util::spinlock queues_lock{};
+static prs::list<sched::wq::workqueue, &sched::wq::workqueue::hook> queues{};
+
+sched::wq::workqueue *sched::wq::system = nullptr;
+sched::wq::workqueue *sched::wq::system_unbound = nullptr;
+
+static void worker_main();
+
+static void create_worker(sched::wq::worker_pool *pool) {
+    auto self = prs::construct<sched::wq::worker>(prs::allocator{slab::create_resource()}, pool);
+    auto task = sched::create_thread(worker_main, kstack::alloc(), vmm::boot, 0);
+
+    task->worker = self;
+    self->task = task;
+
+    // The scheduler moves it over before it first runs
+    if (pool->cpu >= 0) {
+        task->affinity.zero();
+        task->affinity.set(pool->cpu);
+    }
+
+    util::lock_guard guard{pool->lock};
+    pool->nr_workers++;
+    pool->creating = false;
+    guard.release();
+
+    task->start();
+}
+
+static sched::wq::worker_pool *pool_for(sched::wq::workqueue *queue, size_t cpu) {
+    if (queue->flags & sched::wq::WQ_UNBOUND) {
+        return &unbound_pool;
+    }
+
+    return &bound_pools[cpu];
+}
+
+// Pool lock held
+static sched::wq::worker *find_running(sched::wq::worker_pool *pool, sched::wq::work *item) {
+    for (auto self: pool->busy) {
+        if (self->current == item) {
+            return self;
+        }
+    }
+
+    return nullptr;
+}
+
+// Pool lock held
+static void wake_idle(sched::wq::worker_pool *pool) {
+    if (pool->nr_idle == 0) {
+        return;
+    }
+
+    pool->nr_idle--;
+    pool->more_work.wake_one();
+}
+
+// The caller owns item->pending
+static void insert_work(sched::wq::worker_pool *pool, sched::wq::workqueue *queue, sched::wq::work *item) {
+    // Work still running goes back to the pool running it, so fn never runs twice at once
+    auto last = __atomic_load_n(&item->pool, __ATOMIC_ACQUIRE);
+    if (last && last != pool) {
+        util::lock_guard guard{last->lock};
+        if (find_running(last, item)) {
+            pool = last;
+        }
+    }
+
+    util::lock_guard guard{pool->lock};
+
+    item->queue = queue;
+    item->queued_at = arch::hrtime();
+    __atomic_store_n(&item->pool, pool, __ATOMIC_RELEASE);
+    pool->worklist.push_back(item);
+
+    queue->lock.lock_noirq();
+    queue->queued++;
+    queue->depth++;
+    if (queue->depth > queue->max_depth) {
+        queue->max_depth = queue->depth;
+    }
+    queue->lock.unlock_noirq();
+
+    if (pool->nr_running == 0) {
+        wake_idle(pool);
+    }
+}
+
+// Pool and queue lock held
+static void finish_accounting(sched::wq::workqueue *queue) {
+    if (queue->depth == 0 && queue->active == 0) {
+        queue->flushers.wake_all();
+    }
+}
+
+// Entered and left with the pool lock held, state is what its lock_irqsave returned
+static void run_work(sched::wq::worker_pool *pool, sched::wq::worker *self, sched::wq::work *item, bool &state) {
+    pool->worklist.erase(item);
+    __atomic_store_n(&item->pending, false, __ATOMIC_RELEASE);
+
+    // fn may free or requeue the item, nothing reads it once fn has been called
+    auto queue = item->queue;
+    auto fn = item->fn;
+    auto aux = item->aux;
+
+    uint64_t start = arch::hrtime();
+    uint64_t latency = start - item->queued_at;
+
+    self->current = item;
+    pool->busy.push_back(self);
+    pool->nr_running++;
+
+    queue->lock.lock_noirq();
+    queue->depth--;
+    queue->active++;
+    queue->latency_total += latency;
+    if (latency > queue->latency_max) {
+        queue->latency_max = latency;
+    }
+    queue->lock.unlock_noirq();
+
+    // Keep a spare worker for the rest of the list in case fn blocks
+    bool spawn = pool->nr_idle == 0 && !pool->creating && pool->nr_workers < MAX_WORKERS;
+    if (spawn) {
+        pool->creating = true;
+    }
+
+    pool->lock.unlock_irqrestore(state);
+
+    if (spawn) {
+        create_worker(pool);
+    }
+
+    fn(aux);
+    uint64_t ran = arch::hrtime() - start;
+
+    state = pool->lock.lock_irqsave();
+
+    self->current = nullptr;
+    pool->busy.erase(self);
+    pool->nr_running--;
+
+    queue->lock.lock_noirq();
+    queue->active--;
+    queue->executed++;
+    queue->run_total += ran;
+    if (ran > queue->run_max) {
+        queue->run_max = ran;
+    }
+
+    finish_accounting(queue);
+    queue->lock.unlock_noirq();
+
+    pool->done.wake_all();
+}
+
+// Pool lock held. Items running on another worker stay queued until that worker comes back for them
+static sched::wq::work *pick_work(sched::wq::worker_pool *pool) {
+    for (auto item: pool->worklist) {
+        if (!find_running(pool, item)) {
+            return item;
+        }
+    }
+
+    return nullptr;
+}
+
+static void worker_main() {
+    auto self = arch::get_thread()->worker;
+    auto pool = self->pool;
+
+    bool state = pool->lock.lock_irqsave();
+    while (true) {
+        auto item = pick_work(pool);
+        if (item == nullptr) {
+            // Whoever wakes us takes us off the idle count
+            pool->nr_idle++;
+            pool->more_work.wait(false, nullptr, true, &pool->lock, state);
+            state = pool->lock.lock_irqsave();
+            continue;
+        }
+
+        run_work(pool, self, item, state);
+    }
+}
+
+void sched::wq::sleeping(thread *task) {
+    // Only the worker itself changes current and blocked, idle workers waiting for more aren't counted
+    auto self = task->worker;
+    if (self->current == nullptr || self->blocked) {
+        return;
+    }
+
+    auto pool = self->pool;
+    util::lock_guard guard{pool->lock};
+
+    self->blocked = true;
+    pool->nr_running--;
+    if (pool->nr_running == 0 && pool->worklist.front() != nullptr) {
+        wake_idle(pool);
+    }
+}
+
+void sched::wq::waking(thread *task) {
+    auto self = task->worker;
+    if (!self->blocked) {
+        return;
+    }
+
+    auto pool = self->pool;
+    util::lock_guard guard{pool->lock};
+
+    self->blocked = false;
+    pool->nr_running++;
+}
+
+sched::wq::workqueue *sched::wq::create(const char *name, int flags) {
+    auto queue = prs::construct<workqueue>(prs::allocator{slab::create_resource()}, name, flags);
+
+    util::lock_guard guard{queues_lock};
+    queues.push_back(queue);
+
+    return queue;
+}
+
+void sched::wq::init() {
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto pool = &bound_pools[x86::cpus[i]->cpu_number];
+        pool->cpu = x86::cpus[i]->cpu_number;
+        create_worker(pool);
+    }
+
+    create_worker(&unbound_pool);
+
+    system = create("events");
+    system_unbound = create("events_unbound", WQ_UNBOUND);
+}
+
+bool sched::wq::queue_on(size_t cpu, workqueue *queue, work *item) {
+    if (__atomic_exchange_n(&item->pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    insert_work(pool_for(queue, cpu), queue, item);
+    return true;
+}
+
+bool sched::wq::queue(workqueue *queue, work *item) {
+    return queue_on(x86::get_cpu_number(), queue, item);
+}
+
+void sched::wq::delayed_work::expire(void *aux) {
+    auto dwork = (delayed_work *) aux;
+    insert_work(pool_for(dwork->queue, dwork->cpu), dwork->queue, &dwork->item);
+}
+
+bool sched::wq::queue_delayed(workqueue *queue, delayed_work *dwork, timespec delay) {
+    if (__atomic_exchange_n(&dwork->item.pending, true, __ATOMIC_ACQ_REL)) {
+        return false;
+    }
+
+    dwork->queue = queue;
+    dwork->cpu = x86::get_cpu_number();
+
+    if (delay.tv_sec == 0 && delay.tv_nsec == 0) {
+        insert_work(pool_for(queue, dwork->cpu), queue, &dwork->item);
+        return true;
+    }
+
+    dwork->timer.spec = delay;
+    arch::add_timer(&dwork->timer);
+    return true;
+}
+
+// Waits for item to be off the pool's list, unless remove is set, and not running there
+static bool wait_idle(sched::wq::work *item, bool remove) {
+    bool removed = false;
+
+    while (true) {
+        auto pool = __atomic_load_n(&item->pool, __ATOMIC_ACQUIRE);
+        if (pool == nullptr) {
+            // Pending without a pool yet is a first queue that hasn't been inserted
+            if (!__atomic_load_n(&item->pending, __ATOMIC_ACQUIRE)) {
+                return removed;
+            }
+
+            asm volatile("pause");
+            continue;
+        }
+
+        bool state = pool->lock.lock_irqsave();
+        if (item->pool != pool) {
+            pool->lock.unlock_irqrestore(state);
+            continue;
+        }
+
+        bool queued = item->hook.in_list;
+        if (queued && remove) {
+            pool->worklist.erase(item);
+            __atomic_store_n(&item->pending, false, __ATOMIC_RELEASE);
+
+            auto queue = item->queue;
+            queue->lock.lock_noirq();
+            queue->depth--;
+            finish_accounting(queue);
+            queue->lock.unlock_noirq();
+
+            removed = true;
+            queued = false;
+        } else if (!queued && __atomic_load_n(&item->pending, __ATOMIC_ACQUIRE)) {
+            // Claimed by a queuer or a firing timer that hasn't inserted it yet
+            pool->lock.unlock_irqrestore(state);
+            asm volatile("pause");
+            continue;
+        }
+
+        if (!queued && !find_running(pool, item)) {
+            pool->lock.unlock_irqrestore(state);
+            return removed;
+        }
+
+        pool->done.wait(false, nullptr, false, &pool->lock, state);
+    }
+}
+
+bool sched::wq::cancel(work *item) {
+    return wait_idle(item, true);
+}
+
+bool sched::wq::cancel_delayed(delayed_work *dwork) {
+    if (arch::remove_timer(&dwork->timer)) {
+        __atomic_store_n(&dwork->item.pending, false, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    return cancel(&dwork->item);
+}
+
+void sched::wq::flush(work *item) {
+    wait_idle(item, false);
+}
+
+void sched::wq::flush_queue(workqueue *queue) {
+    bool state = queue->lock.lock_irqsave();
+    while (queue->depth || queue->active) {
+        queue->flushers.wait(false, nullptr, false, &queue->lock, state);
+        state = queue->lock.lock_irqsave();
+    }
+
+    queue->lock.unlock_irqrestore(state);
+}
+
+// Queues are never destroyed, so the list only has to be locked while stepping through it
+static sched::wq::workqueue *next_queue(sched::wq::workqueue *queue) {
+    util::lock_guard guard{queues_lock};
+    return queue ? queues.next(queue) : queues.front();
+}
+
+void wqstat::init() {
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::WQSTAT, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::WQSTAT);
+}
+
+// One line per queue, each read in the order the queues were created
+ssize_t wqstat::device::read(void *buf, size_t len, size_t offset) {
+    char line[192];
+    sched::wq::workqueue *queue = nullptr;
+
+    return vfs::devfs::copy_lines(buf, len, offset, line, sizeof(line), [&](size_t i, char *out, size_t size) -> ssize_t {
+        if (i == 0) {
+            return npf_snprintf(out, size, "%-16s %6s %6s %6s %10s %10s %12s %12s %12s %12s\n",
+                "name", "depth", "active", "max", "queued", "executed",
+                "avg_lat_ns", "max_lat_ns", "avg_run_ns", "max_run_ns");
+        }
+
+        queue = next_queue(queue);
+        if (queue == nullptr) {
+            return -1;
+        }
+
+        bool state = queue->lock.lock_irqsave();
+        size_t depth = queue->depth;
+        size_t active = queue->active;
+        size_t max_depth = queue->max_depth;
+        uint64_t queued = queue->queued;
+        uint64_t executed = queue->executed;
+        uint64_t latency_total = queue->latency_total;
+        uint64_t latency_max = queue->latency_max;
+        uint64_t run_total = queue->run_total;
+        uint64_t run_max = queue->run_max;
+        queue->lock.unlock_irqrestore(state);
+
+        // Latency is counted when an item starts, run time when it finishes
+        uint64_t started = executed + active;
+        return npf_snprintf(out, size, "%-16s %6lu %6lu %6lu %10lu %10lu %12lu %12lu %12lu %12lu\n",
+            queue->name, depth, active, max_depth, queued, executed,
+            started ? latency_total / started : 0, latency_max,
+            executed ? run_total / executed : 0, run_max);
+    });
+}
+
+// Resets the running totals, depth and active are live counts and stay
+ssize_t wqstat::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    sched::wq::workqueue *queue = nullptr;
+    while ((queue = next_queue(queue))) {
+        util::lock_guard guard{queue->lock};
+        queue->max_depth = queue->depth;
+        queue->queued = 0;
+        queue->executed = 0;
+        queue->latency_total = 0;
+        queue->latency_max = 0;
+        queue->run_total = 0;
+        queue->run_max = 0;
+    }
+
+    return len;
+}
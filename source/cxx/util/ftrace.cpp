@@ -0,0 +1,426 @@
+#include <arch/types.hpp>
+#include <arch/x86/clocksource.hpp>
+#include <arch/x86/percpu.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/ftrace.hpp>
+#include <fs/dev.hpp>
+#include <mm/common.hpp>
+#include <mm/pmm.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/errors.hpp>
+#include <util/ftrace.hpp>
+#include <util/ksym.hpp>
+#include <util/lock.hpp>
+#include <util/log/nanoprintf.h>
+#include <util/string.hpp>
+
+// Single producer rings, only ever written by their own CPU from the hooks with interrupts off.
+// Readers serialise on reader_lock among themselves, a full ring drops the record
+struct ring {
+    ftrace::record *records;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t lost;
+};
+
+static DEFINE_PER_CPU(ring, rings);
+
+static uint8_t current_mode = ftrace::OFF;
+static uint64_t generation = 0;
+
+// Only changed while tracing is stopped
+static uint64_t filters[ftrace::MAX_FILTERS];
+static size_t nr_filters = 0;
+
+// Covers starting, the filter and the consumer side of every ring
+static util::spinlock reader_lock{};
+
+// The hooks run before anything else in every function, so everything they touch has to be
+// kept out of instrumentation: this file and the per-CPU headers, see meson.build. Interrupts
+// and the TSC are done by hand here rather than going through arch::
+static inline uint64_t save_irqs() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void restore_irqs(uint64_t flags) {
+    if (flags & (1 << 9)) {
+        asm volatile("sti" ::: "memory");
+    }
+}
+
+static inline uint64_t read_tsc() {
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
+static bool in_filter(uint64_t fn) {
+    for (size_t i = 0; i < nr_filters; i++) {
+        if (filters[i] == fn) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void push(ftrace::record_type type, uint64_t fn, uint64_t arg, sched::thread *task, size_t depth, uint64_t now) {
+    auto buffer = &rings.get();
+    if (buffer->records == nullptr) {
+        return;
+    }
+
+    uint64_t head = buffer->head;
+    if (head - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) >= ftrace::RING_SIZE) {
+        __atomic_add_fetch(&buffer->lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    auto rec = &buffer->records[head & (ftrace::RING_SIZE - 1)];
+    rec->tsc = now;
+    rec->fn = fn;
+    rec->arg = arg;
+    rec->tid = task ? task->tid : -1;
+    rec->depth = depth;
+    rec->type = type;
+    rec->cpu = PERCPU_READ(cpu_number);
+
+    __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef CONFIG_FTRACE
+extern "C" {
+    [[gnu::no_instrument_function]]
+    void __cyg_profile_func_enter(void *fn, void *site) {
+        uint8_t how = __atomic_load_n(&current_mode, __ATOMIC_ACQUIRE);
+        if (__builtin_expect(how == ftrace::OFF, 1)) {
+            return;
+        }
+
+        uint64_t flags = save_irqs();
+        uint64_t now = read_tsc();
+        auto task = PERCPU_READ(current_task);
+
+        if (how == ftrace::FUNCTION) {
+            if (nr_filters == 0 || in_filter((uint64_t) fn)) {
+                push(ftrace::CALL, (uint64_t) fn, (uint64_t) site, task, 0, now);
+            }
+        } else if (task) {
+            auto calls = &task->calls;
+            if (calls->generation != generation) {
+                calls->generation = generation;
+                calls->depth = 0;
+                calls->inside = 0;
+            }
+
+            // Past the limit calls are only counted, so their returns keep the depth right
+            uint32_t depth = calls->depth++;
+            if (depth < ftrace::GRAPH_DEPTH) {
+                calls->fn[depth] = (uint64_t) fn;
+                calls->start[depth] = now;
+
+                if (calls->inside == 0 && nr_filters && in_filter((uint64_t) fn)) {
+                    calls->inside = depth + 1;
+                }
+
+                if (nr_filters == 0 || calls->inside) {
+                    push(ftrace::ENTRY, (uint64_t) fn, (uint64_t) site, task, depth, now);
+                }
+            }
+        }
+
+        restore_irqs(flags);
+    }
+
+    [[gnu::no_instrument_function]]
+    void __cyg_profile_func_exit(void *fn, void *site) {
+        if (__builtin_expect(__atomic_load_n(&current_mode, __ATOMIC_ACQUIRE) != ftrace::GRAPH, 1)) {
+            return;
+        }
+
+        uint64_t flags = save_irqs();
+        uint64_t now = read_tsc();
+        auto task = PERCPU_READ(current_task);
+        if (task == nullptr || task->calls.generation != generation || task->calls.depth == 0) {
+            restore_irqs(flags);
+            return;
+        }
+
+        auto calls = &task->calls;
+        if (calls->depth > ftrace::GRAPH_DEPTH) {
+            calls->depth--;
+            restore_irqs(flags);
+            return;
+        }
+
+        // Calls that never came back are dropped along with it, and a return from something
+        // entered before the run started matches nothing
+        ssize_t depth = calls->depth - 1;
+        while (depth >= 0 && calls->fn[depth] != (uint64_t) fn) {
+            depth--;
+        }
+
+        if (depth >= 0) {
+            calls->depth = depth;
+            if (nr_filters == 0 || calls->inside) {
+                push(ftrace::EXIT, (uint64_t) fn, now - calls->start[depth], task, depth, now);
+            }
+
+            if (calls->inside == (uint32_t) depth + 1) {
+                calls->inside = 0;
+            }
+        }
+
+        restore_irqs(flags);
+    }
+}
+#endif
+
+bool ftrace::running() {
+    return __atomic_load_n(&current_mode, __ATOMIC_ACQUIRE) != OFF;
+}
+
+bool ftrace::start(mode how) {
+    util::lock_guard guard{reader_lock};
+    if (rings.get().records == nullptr) {
+        arch::set_errno(EINVAL);
+        return false;
+    }
+
+    // Switching modes starts a new run, call stacks from the last one would only mismatch
+    __atomic_store_n(&current_mode, OFF, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&current_mode, how, __ATOMIC_RELEASE);
+    return true;
+}
+
+void ftrace::stop() {
+    __atomic_store_n(&current_mode, OFF, __ATOMIC_RELEASE);
+}
+
+bool ftrace::filter(const char *name) {
+    util::lock_guard guard{reader_lock};
+    if (running()) {
+        arch::set_errno(EBUSY);
+        return false;
+    }
+
+    size_t count = ksym::find(name, filters + nr_filters, MAX_FILTERS - nr_filters);
+    if (count == 0) {
+        arch::set_errno(EINVAL);
+        return false;
+    }
+
+    if (nr_filters + count > MAX_FILTERS) {
+        arch::set_errno(ENOMEM);
+        return false;
+    }
+
+    nr_filters += count;
+    return true;
+}
+
+bool ftrace::clear_filter() {
+    util::lock_guard guard{reader_lock};
+    if (running()) {
+        arch::set_errno(EBUSY);
+        return false;
+    }
+
+    nr_filters = 0;
+    return true;
+}
+
+// With reader_lock held
+static bool peek(size_t cpu, ftrace::record **out) {
+    auto buffer = &rings[cpu];
+    if (buffer->records == nullptr) {
+        return false;
+    }
+
+    uint64_t tail = buffer->tail;
+    if (tail == __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    *out = &buffer->records[tail & (ftrace::RING_SIZE - 1)];
+    return true;
+}
+
+// TSCs are synchronised across CPUs on anything with an invariant TSC, which the clock needs anyway
+bool ftrace::pop(record *out) {
+    util::lock_guard guard{reader_lock};
+
+    ssize_t oldest = -1;
+    record *candidate = nullptr;
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        record *next;
+        size_t cpu = x86::cpus[i]->cpu_number;
+        if (peek(cpu, &next) && (oldest < 0 || next->tsc < candidate->tsc)) {
+            oldest = cpu;
+            candidate = next;
+        }
+    }
+
+    if (oldest < 0) {
+        return false;
+    }
+
+    // The slot is the producer's again once tail moves past it
+    memcpy(out, candidate, sizeof(record));
+    auto buffer = &rings[oldest];
+    __atomic_store_n(&buffer->tail, buffer->tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void ftrace::reset() {
+    util::lock_guard guard{reader_lock};
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto buffer = &rings[x86::cpus[i]->cpu_number];
+        __atomic_store_n(&buffer->tail, __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        __atomic_store_n(&buffer->lost, 0, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t ftrace::lost() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        total += __atomic_load_n(&rings[x86::cpus[i]->cpu_number].lost, __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+// Every CPU has to be up
+void ftrace::init() {
+    size_t pages = memory::page_count(RING_SIZE * sizeof(record));
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto records = (record *) pmm::alloc(pages);
+        __atomic_store_n(&rings[x86::cpus[i]->cpu_number].records, records, __ATOMIC_RELEASE);
+    }
+
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::FTRACE, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::FTRACE);
+}
+
+// The function's name without its parameter list, or its address
+static void function_name(uint64_t fn, char *buf, size_t len) {
+    auto sym = ksym::lookup(fn);
+    if (sym == nullptr) {
+        npf_snprintf(buf, len, "%lx", fn);
+        return;
+    }
+
+    size_t i = 0;
+    for (; i < len - 1 && sym->name[i] && sym->name[i] != '('; i++) {
+        buf[i] = sym->name[i];
+    }
+
+    buf[i] = '\0';
+}
+
+static int format_record(ftrace::record *rec, char *line, size_t len) {
+    char name[96];
+    char site[96];
+    function_name(rec->fn, name, sizeof(name));
+
+    int indent = (rec->depth < ftrace::GRAPH_DEPTH ? rec->depth : ftrace::GRAPH_DEPTH) * 2;
+    int pos = npf_snprintf(line, len, "%lu [%02u] %6d ", rec->tsc, rec->cpu, rec->tid);
+    switch (rec->type) {
+        case ftrace::CALL:
+            ksym::format(rec->arg, site, sizeof(site));
+            pos += npf_snprintf(line + pos, len - pos, "%s <- %s\n", name, site);
+            break;
+        case ftrace::ENTRY:
+            pos += npf_snprintf(line + pos, len - pos, "%*s%s() {\n", indent, "", name);
+            break;
+        case ftrace::EXIT:
+            pos += npf_snprintf(line + pos, len - pos, "%*s} %lu ns %s\n", indent, "",
+                clocksource::tsc_to_ns(rec->arg), name);
+            break;
+    }
+
+    return pos < (int) len ? pos : len - 1;
+}
+
+// Consumes records like a pipe, the offset doesn't matter. A line that doesn't fit the
+// buffer is left for the next read unless nothing else was returned
+ssize_t ftrace::device::read(void *buf, size_t len, size_t offset) {
+    char line[GRAPH_DEPTH * 2 + 256];
+    size_t copied = 0;
+
+    record rec;
+    while (copied < len && pop(&rec)) {
+        int line_len = format_record(&rec, line, sizeof(line));
+        size_t count = line_len;
+        if (count > len - copied) {
+            if (copied) {
+                // Records are consumed once popped, better lose the line than split it
+                break;
+            }
+
+            count = len;
+        }
+
+        if (arch::copy_to_user((char *) buf + copied, line, count) < count) {
+            return -1;
+        }
+
+        copied += count;
+    }
+
+    return copied;
+}
+
+ssize_t ftrace::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    char cmd[128];
+    if (len >= sizeof(cmd)) {
+        arch::set_errno(EINVAL);
+        return -1;
+    }
+
+    if (arch::copy_from_user(cmd, buf, len) < len) {
+        arch::set_errno(EFAULT);
+        return -1;
+    }
+
+    cmd[len] = '\0';
+    if (len && cmd[len - 1] == '\n') {
+        cmd[len - 1] = '\0';
+    }
+
+    bool ok;
+    if (strcmp(cmd, "function") == 0) {
+        ok = start(FUNCTION);
+    } else if (strcmp(cmd, "graph") == 0) {
+        ok = start(GRAPH);
+    } else if (strcmp(cmd, "stop") == 0) {
+        stop();
+        ok = true;
+    } else if (strncmp(cmd, "filter ", 7) == 0) {
+        ok = filter(cmd + 7);
+    } else if (strcmp(cmd, "clear") == 0) {
+        ok = clear_filter();
+    } else if (strcmp(cmd, "reset") == 0) {
+        reset();
+        ok = true;
+    } else {
+        arch::set_errno(EINVAL);
+        ok = false;
+    }
+
+    return ok ? len : -1;
+}
@@ -0,0 +1,207 @@
+#include <cstddef>
+#include <cstdint>
+#include <mm/common.hpp>
+#include <mm/pmm.hpp>
+#include <util/ksym.hpp>
+#include <util/log/log.hpp>
+#include <util/log/nanoprintf.h>
+#include <util/stivale.hpp>
+#include <util/string.hpp>
+
+static log::subsystem logger = log::make_subsystem("KSYM");
+
+static ksym::symbol *symbols = nullptr;
+static size_t nr_symbols = 0;
+
+static bool is_hex(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static uint64_t parse_hex(const char *str, size_t len) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = str[i];
+        value = (value << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+
+    return value;
+}
+
+// One line of `nm -n -S -C`: "addr [size] type name", the size is missing for symbols without one
+static bool parse_line(const char *line, const char *end, ksym::symbol *sym, const char **name, size_t *name_len) {
+    const char *c = line;
+    size_t len = 0;
+    while (c + len < end && is_hex(c[len])) len++;
+    if (len == 0 || c + len == end || c[len] != ' ') {
+        return false;
+    }
+
+    sym->addr = parse_hex(c, len);
+    sym->size = 0;
+    c += len + 1;
+
+    len = 0;
+    while (c + len < end && is_hex(c[len])) len++;
+    if (len > 1 && c + len < end && c[len] == ' ') {
+        sym->size = parse_hex(c, len);
+        c += len + 1;
+    }
+
+    if (end - c < 3 || c[1] != ' ') {
+        return false;
+    }
+
+    // Only code, anything else would only ever show up as a bad match
+    char type = c[0] | 0x20;
+    if (type != 't' && type != 'w') {
+        return false;
+    }
+
+    *name = c + 2;
+    *name_len = end - *name;
+    return *name_len > 0;
+}
+
+// nm -n already sorts by address, so this is a single pass in the usual case
+static void sort_symbols() {
+    for (size_t i = 1; i < nr_symbols; i++) {
+        ksym::symbol sym = symbols[i];
+
+        size_t j = i;
+        while (j > 0 && symbols[j - 1].addr > sym.addr) {
+            symbols[j] = symbols[j - 1];
+            j--;
+        }
+
+        symbols[j] = sym;
+    }
+}
+
+void ksym::init(stivale::boot::tags::modules *modules) {
+    if (modules == nullptr) {
+        kmsg(logger, log::level::WARN, "No boot modules, traces won't be symbolized");
+        return;
+    }
+
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    for (size_t i = 0; i < modules->module_count; i++) {
+        auto module = &modules->modules[i];
+        if (strncmp(module->string, "ksyms", sizeof(module->string)) == 0) {
+            begin = (const char *) memory::add_virt(module->begin);
+            end = (const char *) memory::add_virt(module->end);
+            break;
+        }
+    }
+
+    if (begin == nullptr) {
+        kmsg(logger, log::level::WARN, "No ksyms module, traces won't be symbolized");
+        return;
+    }
+
+    // Count first so the table and the names fit in one allocation
+    size_t count = 0;
+    size_t names = 0;
+    for (const char *line = begin; line < end;) {
+        const char *eol = line;
+        while (eol < end && *eol != '\n') eol++;
+
+        symbol sym;
+        const char *name;
+        size_t name_len;
+        if (parse_line(line, eol, &sym, &name, &name_len)) {
+            count++;
+            names += name_len + 1;
+        }
+
+        line = eol + 1;
+    }
+
+    size_t table_size = count * sizeof(symbol);
+    symbols = (symbol *) pmm::alloc(memory::page_count(table_size + names));
+    char *name_buf = (char *) symbols + table_size;
+
+    for (const char *line = begin; line < end;) {
+        const char *eol = line;
+        while (eol < end && *eol != '\n') eol++;
+
+        symbol sym;
+        const char *name;
+        size_t name_len;
+        if (parse_line(line, eol, &sym, &name, &name_len)) {
+            memcpy(name_buf, name, name_len);
+            name_buf[name_len] = '\0';
+
+            sym.name = name_buf;
+            symbols[nr_symbols++] = sym;
+            name_buf += name_len + 1;
+        }
+
+        line = eol + 1;
+    }
+
+    sort_symbols();
+    kmsg(logger, "Loaded %lu kernel symbols", nr_symbols);
+}
+
+const ksym::symbol *ksym::lookup(uint64_t addr) {
+    if (nr_symbols == 0 || addr < symbols[0].addr) {
+        return nullptr;
+    }
+
+    // The last symbol starting at or below addr
+    size_t low = 0;
+    size_t high = nr_symbols;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (symbols[mid].addr <= addr) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    auto sym = &symbols[low];
+    if (sym->size) {
+        return addr < sym->addr + sym->size ? sym : nullptr;
+    }
+
+    // Without a size the last symbol could claim anything past the end of the kernel
+    return low + 1 < nr_symbols ? sym : nullptr;
+}
+
+uint64_t ksym::address(const char *name) {
+    for (size_t i = 0; i < nr_symbols; i++) {
+        if (strcmp(symbols[i].name, name) == 0) {
+            return symbols[i].addr;
+        }
+    }
+
+    return 0;
+}
+
+size_t ksym::find(const char *name, uint64_t *addrs, size_t max) {
+    size_t len = strlen(name);
+    size_t count = 0;
+    for (size_t i = 0; i < nr_symbols; i++) {
+        const char *candidate = symbols[i].name;
+        if (strncmp(candidate, name, len) == 0 && (candidate[len] == '\0' || candidate[len] == '(')) {
+            if (count < max) {
+                addrs[count] = symbols[i].addr;
+            }
+
+            count++;
+        }
+    }
+
+    return count;
+}
+
+size_t ksym::format(uint64_t addr, char *buf, size_t len) {
+    auto sym = lookup(addr);
+    if (sym == nullptr) {
+        return npf_snprintf(buf, len, "%lx", addr);
+    }
+
+    return npf_snprintf(buf, len, "%s+0x%lx", sym->name, addr - sym->addr);
+}
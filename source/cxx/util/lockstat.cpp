@@ -0,0 +1,131 @@
+#include <arch/types.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/lockstat.hpp>
+#include <fs/dev.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/errors.hpp>
+#include <util/ksym.hpp>
+#include <util/lockstat.hpp>
+#include <util/log/nanoprintf.h>
+
+static lockstat::entry entries[lockstat::MAX_LOCKS];
+// Handed out once the table is full, so locks that didn't get a slot don't rescan it on every acquisition
+static lockstat::entry overflow{};
+
+lockstat::entry *lockstat::get(void *lock, void *site) {
+    size_t start = ((uintptr_t) lock >> 3) % MAX_LOCKS;
+    for (size_t i = 0; i < MAX_LOCKS; i++) {
+        auto stats = &entries[(start + i) % MAX_LOCKS];
+
+        void *expected = nullptr;
+        if (__atomic_compare_exchange_n(&stats->lock, &expected, lock, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            stats->site = site;
+            return stats;
+        }
+    }
+
+    return &overflow;
+}
+
+void lockstat::put(entry *stats) {
+    if (stats == nullptr || stats == &overflow) {
+        return;
+    }
+
+    stats->site = nullptr;
+    __atomic_store_n(&stats->acquisitions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->contentions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->max_hold, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->lock, nullptr, __ATOMIC_RELEASE);
+}
+
+void lockstat::acquired(entry *stats, bool contended) {
+    if (stats == nullptr) {
+        return;
+    }
+
+    __atomic_add_fetch(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_add_fetch(&stats->contentions, 1, __ATOMIC_RELAXED);
+    }
+
+    stats->acquired_at = x86::tsc();
+}
+
+void lockstat::released(entry *stats) {
+    // Overflow's acquired_at is shared by every lock using it, so it has no hold time
+    if (stats == nullptr || stats == &overflow) {
+        return;
+    }
+
+    uint64_t held = x86::tsc() - stats->acquired_at;
+    uint64_t max = __atomic_load_n(&stats->max_hold, __ATOMIC_RELAXED);
+    while (held > max) {
+        if (__atomic_compare_exchange_n(&stats->max_hold, &max, held, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+void lockstat::reset() {
+    for (size_t i = 0; i < MAX_LOCKS; i++) {
+        __atomic_store_n(&entries[i].acquisitions, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entries[i].contentions, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entries[i].max_hold, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&overflow.acquisitions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&overflow.contentions, 0, __ATOMIC_RELAXED);
+}
+
+void lockstat::init() {
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::LOCKSTAT, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::LOCKSTAT);
+}
+
+// One line per tracked lock, then the locks that didn't fit in the table
+ssize_t lockstat::device::read(void *buf, size_t len, size_t offset) {
+    char line[192];
+    char site[64];
+
+    return vfs::devfs::copy_lines(buf, len, offset, line, sizeof(line), [&](size_t i, char *out, size_t size) -> ssize_t {
+        if (i == 0) {
+            return npf_snprintf(out, size, "%-18s %-40s %12s %12s %14s\n",
+                "lock", "site", "acquisitions", "contentions", "max_hold_tsc");
+        } else if (i == MAX_LOCKS + 1) {
+            if (overflow.acquisitions == 0) {
+                return 0;
+            }
+
+            return npf_snprintf(out, size, "%-18s %-40s %12lu %12lu %14s\n",
+                "overflow", "-", overflow.acquisitions, overflow.contentions, "-");
+        } else if (i > MAX_LOCKS + 1) {
+            return -1;
+        }
+
+        auto stats = &entries[i - 1];
+        void *lock = __atomic_load_n(&stats->lock, __ATOMIC_ACQUIRE);
+        if (lock == nullptr || stats->acquisitions == 0) {
+            return 0;
+        }
+
+        ksym::format((uint64_t) stats->site, site, sizeof(site));
+        return npf_snprintf(out, size, "%-18p %-40s %12lu %12lu %14lu\n",
+            lock, site, stats->acquisitions, stats->contentions, stats->max_hold);
+    });
+}
+
+ssize_t lockstat::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    reset();
+    return len;
+}
@@ -0,0 +1,386 @@
+#include <arch/types.hpp>
+#include <arch/vmm.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/prof.hpp>
+#include <fs/dev.hpp>
+#include <mm/common.hpp>
+#include <mm/kstack.hpp>
+#include <mm/pmm.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <sys/sched/sched.hpp>
+#include <sys/sched/time.hpp>
+#include <util/errors.hpp>
+#include <util/ksym.hpp>
+#include <util/lock.hpp>
+#include <util/log/nanoprintf.h>
+#include <util/prof.hpp>
+#include <util/string.hpp>
+
+constexpr uint64_t USER_END = 0x800000000000;
+
+// Single producer rings, only ever written by their own CPU's timer interrupt. Readers serialise
+// on reader_lock among themselves and never block the producer, a full ring drops the sample
+struct ring {
+    prof::sample *samples;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t lost;
+};
+
+struct cpu_state {
+    sched::hrtimer timer;
+    bool armed;
+    ring buffer;
+
+    cpu_state(): timer(nullptr, nullptr), armed(false), buffer() {}
+};
+
+static DEFINE_PER_CPU(cpu_state, states);
+
+static bool enabled = false;
+static uint64_t period = 0;
+
+// Covers starting and the consumer side of every ring
+static util::spinlock reader_lock{};
+
+bool prof::running() {
+    return __atomic_load_n(&enabled, __ATOMIC_ACQUIRE);
+}
+
+// Frames have to stay on the interrupted stack and go up it, so a bad rbp can't walk off somewhere unmapped
+static size_t walk_kernel(arch::irq_regs *r, uint64_t *chain) {
+    uint64_t bottom = r->rsp;
+    uint64_t top = bottom + (x86::initialStackSize + 1) * memory::page_size;
+
+    size_t depth = 0;
+    uint64_t rbp = r->rbp;
+    while (depth < prof::MAX_DEPTH) {
+        if (rbp < bottom || rbp + 16 > top || (rbp & 7) || rbp < memory::x86::virtualBase ||
+            kstack::in_guard(rbp) || kstack::in_guard(rbp + 8)) {
+            break;
+        }
+
+        uint64_t *frame = (uint64_t *) rbp;
+        if (frame[1] == 0) {
+            break;
+        }
+
+        chain[depth++] = frame[1];
+        if (frame[0] <= rbp) {
+            break;
+        }
+
+        bottom = rbp;
+        rbp = frame[0];
+    }
+
+    return depth;
+}
+
+// Read through the page tables rather than the user mapping, a fault can't be taken from here
+static bool peek_user(vmm::vmm_ctx_map map, uint64_t addr, uint64_t *value) {
+    if ((addr & 7) || addr >= USER_END) {
+        return false;
+    }
+
+    void *page = (void *) (addr & ~(memory::page_size - 1));
+    auto perms = vmm::resolve_perms_4k(page, map);
+    if (!((uint64_t) (perms & vmm::page_flags::PRESENT)) || !((uint64_t) (perms & vmm::page_flags::USER))) {
+        return false;
+    }
+
+    uint64_t phys = (uint64_t) vmm::resolve_single_4k(page, map);
+    *value = *(uint64_t *) memory::add_virt(phys + (addr & (memory::page_size - 1)));
+    return true;
+}
+
+static size_t walk_user(arch::irq_regs *r, uint64_t *chain) {
+    auto map = (vmm::vmm_ctx_map) memory::add_virt(x86::read_cr3() & x86::addr_mask);
+
+    size_t depth = 0;
+    uint64_t rbp = r->rbp;
+    while (depth < prof::MAX_DEPTH) {
+        uint64_t next, ret;
+        if (!peek_user(map, rbp, &next) || !peek_user(map, rbp + 8, &ret) || ret == 0) {
+            break;
+        }
+
+        chain[depth++] = ret;
+        if (next <= rbp) {
+            break;
+        }
+
+        rbp = next;
+    }
+
+    return depth;
+}
+
+static void take_sample(cpu_state *state, arch::irq_regs *r) {
+    auto buffer = &state->buffer;
+
+    uint64_t head = buffer->head;
+    if (head - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) >= prof::RING_SIZE) {
+        __atomic_add_fetch(&buffer->lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    auto task = x86::get_thread();
+    auto sample = &buffer->samples[head & (prof::RING_SIZE - 1)];
+
+    sample->time = arch::hrtime();
+    sample->pid = task ? task->pid : -1;
+    sample->tid = task ? task->tid : -1;
+    sample->cpu = x86::get_cpu_number();
+    sample->user = r->cs & 0x3;
+    sample->ip = r->rip;
+    sample->depth = sample->user ? walk_user(r, sample->callchain) : walk_kernel(r, sample->callchain);
+
+    __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void timer_fn(void *aux) {
+    auto state = (cpu_state *) aux;
+    if (!prof::running()) {
+        state->armed = false;
+        return;
+    }
+
+    auto r = x86::hrtimer_regs();
+    if (r) {
+        take_sample(state, r);
+    }
+
+    // Like the tick, skip samples that were missed rather than firing back to back
+    uint64_t now = arch::hrtime();
+    state->timer.deadline += period;
+    if (state->timer.deadline <= now) {
+        state->timer.deadline = now + period;
+    }
+
+    arch::add_hrtimer(&state->timer);
+}
+
+void prof::arm() {
+    auto state = &states.get();
+    if (!running() || state->armed) {
+        return;
+    }
+
+    state->armed = true;
+    state->timer.fn = timer_fn;
+    state->timer.aux = state;
+    state->timer.deadline = arch::hrtime() + period;
+    arch::add_hrtimer(&state->timer);
+}
+
+bool prof::start(uint64_t hz) {
+    if (hz == 0 || hz > MAX_HZ) {
+        arch::set_errno(EINVAL);
+        return false;
+    }
+
+    util::lock_guard guard{reader_lock};
+    if (running()) {
+        arch::set_errno(EBUSY);
+        return false;
+    }
+
+    period = sched::NANOS_PER_SEC / hz;
+    __atomic_store_n(&enabled, true, __ATOMIC_RELEASE);
+
+    // A timer still pending from a run that was just stopped picks the new period up as it goes
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto cpu = x86::cpus[i];
+        if (cpu == x86::get_locals()) {
+            arm();
+        } else {
+            x86::message_processor(cpu->processor_id, x86::PROF_START, nullptr);
+        }
+    }
+
+    return true;
+}
+
+void prof::stop() {
+    __atomic_store_n(&enabled, false, __ATOMIC_RELEASE);
+}
+
+// With reader_lock held
+static bool peek(size_t cpu, prof::sample **out) {
+    auto buffer = &states[cpu].buffer;
+
+    uint64_t tail = buffer->tail;
+    if (tail == __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    *out = &buffer->samples[tail & (prof::RING_SIZE - 1)];
+    return true;
+}
+
+bool prof::pop(sample *out) {
+    util::lock_guard guard{reader_lock};
+
+    ssize_t oldest = -1;
+    sample *candidate = nullptr;
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        sample *next;
+        size_t cpu = x86::cpus[i]->cpu_number;
+        if (peek(cpu, &next) && (oldest < 0 || next->time < candidate->time)) {
+            oldest = cpu;
+            candidate = next;
+        }
+    }
+
+    if (oldest < 0) {
+        return false;
+    }
+
+    // The slot is the producer's again once tail moves past it
+    memcpy(out, candidate, sizeof(sample));
+    auto buffer = &states[oldest].buffer;
+    __atomic_store_n(&buffer->tail, buffer->tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void prof::reset() {
+    util::lock_guard guard{reader_lock};
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto buffer = &states[x86::cpus[i]->cpu_number].buffer;
+        __atomic_store_n(&buffer->tail, __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        __atomic_store_n(&buffer->lost, 0, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t prof::lost() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        total += __atomic_load_n(&states[x86::cpus[i]->cpu_number].buffer.lost, __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+// Every CPU has to be up
+void prof::init() {
+    size_t pages = memory::page_count(RING_SIZE * sizeof(sample));
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        states[x86::cpus[i]->cpu_number].buffer.samples = (sample *) pmm::alloc(pages);
+    }
+
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::PROF, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::PROF);
+}
+
+static int format_sample(prof::sample *sample, char *line, size_t len) {
+    char sym[96];
+    if (sample->user) {
+        npf_snprintf(sym, sizeof(sym), "%lx", sample->ip);
+    } else {
+        ksym::format(sample->ip, sym, sizeof(sym));
+    }
+
+    int pos = npf_snprintf(line, len, "%lu cpu %u pid %d tid %d %c %s",
+        sample->time, sample->cpu, sample->pid, sample->tid, sample->user ? 'U' : 'K', sym);
+
+    for (size_t i = 0; i < sample->depth && pos < (int) len; i++) {
+        if (sample->user) {
+            npf_snprintf(sym, sizeof(sym), "%lx", sample->callchain[i]);
+        } else {
+            ksym::format(sample->callchain[i], sym, sizeof(sym));
+        }
+
+        pos += npf_snprintf(line + pos, len - pos, " <- %s", sym);
+    }
+
+    if (pos < (int) len) {
+        pos += npf_snprintf(line + pos, len - pos, "\n");
+    }
+
+    return pos < (int) len ? pos : len - 1;
+}
+
+// Consumes samples like a pipe, the offset doesn't matter. A line that doesn't fit the
+// buffer is left for the next read unless nothing else was returned
+ssize_t prof::device::read(void *buf, size_t len, size_t offset) {
+    char line[MAX_DEPTH * 104 + 128];
+    size_t copied = 0;
+
+    sample sample;
+    while (copied < len && pop(&sample)) {
+        int line_len = format_sample(&sample, line, sizeof(line));
+        size_t count = line_len;
+        if (count > len - copied) {
+            if (copied) {
+                // Samples are consumed once popped, better lose the line than split it
+                break;
+            }
+
+            count = len;
+        }
+
+        if (arch::copy_to_user((char *) buf + copied, line, count) < count) {
+            return -1;
+        }
+
+        copied += count;
+    }
+
+    return copied;
+}
+
+ssize_t prof::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    char cmd[32];
+    if (len >= sizeof(cmd)) {
+        arch::set_errno(EINVAL);
+        return -1;
+    }
+
+    if (arch::copy_from_user(cmd, buf, len) < len) {
+        arch::set_errno(EFAULT);
+        return -1;
+    }
+
+    cmd[len] = '\0';
+    if (len && cmd[len - 1] == '\n') {
+        cmd[len - 1] = '\0';
+    }
+
+    if (strcmp(cmd, "stop") == 0) {
+        stop();
+        return len;
+    }
+
+    if (strcmp(cmd, "reset") == 0) {
+        reset();
+        return len;
+    }
+
+    if (strncmp(cmd, "start", 5) == 0 && (cmd[5] == '\0' || cmd[5] == ' ')) {
+        uint64_t hz = cmd[5] ? 0 : DEFAULT_HZ;
+        for (const char *c = cmd + 5 + (cmd[5] != '\0'); *c; c++) {
+            if (*c < '0' || *c > '9') {
+                arch::set_errno(EINVAL);
+                return -1;
+            }
+
+            hz = hz * 10 + (*c - '0');
+        }
+
+        return start(hz) ? len : -1;
+    }
+
+    arch::set_errno(EINVAL);
+    return -1;
+}
@@ -0,0 +1,155 @@
+#include <arch/types.hpp>
+#include <arch/x86/clocksource.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/syscall.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/sysstat.hpp>
+#include <fs/dev.hpp>
+#include <mm/common.hpp>
+#include <mm/pmm.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/errors.hpp>
+#include <util/ksym.hpp>
+#include <util/log/nanoprintf.h>
+#include <util/string.hpp>
+#include <util/sysstat.hpp>
+
+// One counters entry per syscall number, only ever updated by its own CPU with interrupts off.
+// Readers and reset go without a lock, at worst a reset loses a call that was being counted
+static DEFINE_PER_CPU(sysstat::counters *, tables);
+
+void sysstat::record(uint64_t nr, uint64_t cycles, bool failed) {
+    auto table = tables.get();
+    if (table == nullptr) {
+        return;
+    }
+
+    size_t bucket = cycles ? 64 - __builtin_clzll(cycles) : 0;
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+
+    auto entry = &table[nr];
+    entry->calls++;
+    entry->errors += failed;
+    entry->cycles += cycles;
+    entry->hist[bucket]++;
+}
+
+void sysstat::reset() {
+    size_t words = x86::syscall_count() * sizeof(counters) / sizeof(uint64_t);
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto table = (uint64_t *) tables[x86::cpus[i]->cpu_number];
+        for (size_t j = 0; j < words; j++) {
+            __atomic_store_n(&table[j], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Every CPU has to be up, syscalls made before this aren't counted
+void sysstat::init() {
+    size_t pages = memory::page_count(x86::syscall_count() * sizeof(counters));
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto table = (counters *) pmm::alloc(pages);
+        memset(table, 0, pages * memory::page_size);
+        __atomic_store_n(&tables[x86::cpus[i]->cpu_number], table, __ATOMIC_RELEASE);
+    }
+
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::SYSSTAT, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::SYSSTAT);
+}
+
+static void sum(size_t nr, sysstat::counters *out) {
+    memset(out, 0, sizeof(sysstat::counters));
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto entry = &tables[x86::cpus[i]->cpu_number][nr];
+        out->calls += __atomic_load_n(&entry->calls, __ATOMIC_RELAXED);
+        out->errors += __atomic_load_n(&entry->errors, __ATOMIC_RELAXED);
+        out->cycles += __atomic_load_n(&entry->cycles, __ATOMIC_RELAXED);
+        for (size_t b = 0; b < sysstat::BUCKETS; b++) {
+            out->hist[b] += __atomic_load_n(&entry->hist[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// The handler's name without its parameter list
+static void syscall_name(size_t nr, char *buf, size_t len) {
+    auto sym = ksym::lookup((uint64_t) x86::get_syscall(nr));
+    if (sym == nullptr) {
+        npf_snprintf(buf, len, "-");
+        return;
+    }
+
+    size_t i = 0;
+    for (; i < len - 1 && sym->name[i] && sym->name[i] != '('; i++) {
+        buf[i] = sym->name[i];
+    }
+
+    buf[i] = '\0';
+}
+
+// Buckets are labelled by the nanoseconds they end at, only the ones that were hit are listed
+static int format_entry(size_t nr, sysstat::counters *entry, char *line, size_t len) {
+    char name[32];
+    syscall_name(nr, name, sizeof(name));
+
+    int pos = npf_snprintf(line, len, "%-4lu %-28s %10lu %10lu %12lu",
+        nr, name, entry->calls, entry->errors, clocksource::tsc_to_ns(entry->cycles / entry->calls));
+
+    for (size_t b = 0; b < sysstat::BUCKETS && pos < (int) len; b++) {
+        if (entry->hist[b] == 0) {
+            continue;
+        }
+
+        if (b == sysstat::BUCKETS - 1) {
+            pos += npf_snprintf(line + pos, len - pos, " >=%lu:%lu",
+                clocksource::tsc_to_ns(1ul << (b - 1)), entry->hist[b]);
+        } else {
+            pos += npf_snprintf(line + pos, len - pos, " <%lu:%lu",
+                clocksource::tsc_to_ns(1ul << b), entry->hist[b]);
+        }
+    }
+
+    if (pos < (int) len) {
+        pos += npf_snprintf(line + pos, len - pos, "\n");
+    }
+
+    return pos < (int) len ? pos : len - 1;
+}
+
+// One line per syscall that was made
+ssize_t sysstat::device::read(void *buf, size_t len, size_t offset) {
+    char line[BUCKETS * 32 + 128];
+
+    return vfs::devfs::copy_lines(buf, len, offset, line, sizeof(line), [](size_t i, char *out, size_t size) -> ssize_t {
+        if (i == 0) {
+            return npf_snprintf(out, size, "%-4s %-28s %10s %10s %12s %s\n",
+                "nr", "name", "calls", "errors", "avg_ns", "latency_ns:calls");
+        } else if (i > x86::syscall_count()) {
+            return -1;
+        }
+
+        counters entry;
+        sum(i - 1, &entry);
+        if (entry.calls == 0) {
+            return 0;
+        }
+
+        return format_entry(i - 1, &entry, out, size);
+    });
+}
+
+ssize_t sysstat::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    reset();
+    return len;
+}
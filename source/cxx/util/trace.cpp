@@ -0,0 +1,240 @@
+#include <arch/types.hpp>
+#include <arch/x86/smp.hpp>
+#include <arch/x86/types.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <driver/dtable.hpp>
+#include <driver/trace.hpp>
+#include <fs/dev.hpp>
+#include <mm/common.hpp>
+#include <mm/pmm.hpp>
+#include <mm/slab.hpp>
+#include <prs/construct.hpp>
+#include <sys/sched/sched.hpp>
+#include <util/errors.hpp>
+#include <util/lock.hpp>
+#include <util/string.hpp>
+#include <util/trace.hpp>
+
+// Kept apart from anything written often, every tracepoint reads these
+alignas(64) bool tracing::keys[NR_EVENTS] = {};
+
+const char *tracing::names[NR_EVENTS] = {
+    "sched_switch",
+    "sched_wakeup",
+    "sched_migrate",
+    "sys_enter",
+    "sys_exit",
+    "page_fault",
+    "block_submit",
+    "block_complete",
+    "irq_entry",
+    "irq_exit",
+    "net_rx",
+    "net_tx"
+};
+
+// seq is odd while the slot is being written and 2 * (index + 1) once record index is complete,
+// so a reader racing the writer can tell it copied a torn or newer record
+struct slot {
+    uint64_t seq;
+    tracing::record rec;
+};
+
+// Written only by the owning CPU with interrupts off, read under reader_lock from anywhere
+struct ring {
+    slot *slots;
+    uint64_t head;
+    uint64_t read;
+    uint64_t overwritten;
+};
+
+static DEFINE_PER_CPU(ring, rings);
+static util::spinlock reader_lock{};
+
+void tracing::write(event id, const void *payload, size_t size) {
+    bool irqs_enabled = arch::get_irq_state();
+    arch::irq_off();
+
+    auto buffer = &rings.get();
+    if (buffer->slots == nullptr) {
+        if (irqs_enabled) arch::irq_on();
+        return;
+    }
+
+    uint64_t index = buffer->head;
+    auto entry = &buffer->slots[index & (RING_SIZE - 1)];
+
+    __atomic_store_n(&entry->seq, 2 * index + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    auto task = x86::get_thread();
+    entry->rec.time = arch::hrtime();
+    entry->rec.id = id;
+    entry->rec.size = size;
+    entry->rec.cpu = x86::get_cpu_number();
+    entry->rec.tid = task ? task->tid : -1;
+    memcpy(entry->rec.payload, payload, size);
+
+    __atomic_store_n(&entry->seq, 2 * index + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&buffer->head, index + 1, __ATOMIC_RELEASE);
+
+    if (irqs_enabled) arch::irq_on();
+}
+
+bool tracing::enable(const char *name, bool on) {
+    bool all = strcmp(name, "all") == 0;
+    bool found = false;
+    for (size_t i = 0; i < NR_EVENTS; i++) {
+        if (all || strcmp(name, names[i]) == 0) {
+            __atomic_store_n(&keys[i], on, __ATOMIC_RELAXED);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// With reader_lock held. Copies the oldest record still intact without consuming it
+static bool peek(ring *buffer, tracing::record *out) {
+    while (true) {
+        uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+        if (head - buffer->read > tracing::RING_SIZE) {
+            buffer->overwritten += head - tracing::RING_SIZE - buffer->read;
+            buffer->read = head - tracing::RING_SIZE;
+        }
+
+        if (buffer->read == head) {
+            return false;
+        }
+
+        auto entry = &buffer->slots[buffer->read & (tracing::RING_SIZE - 1)];
+        uint64_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (seq == 2 * buffer->read + 2) {
+            memcpy(out, &entry->rec, sizeof(tracing::record));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq) {
+                return true;
+            }
+        }
+
+        // The writer lapped us on this slot
+        buffer->overwritten++;
+        buffer->read++;
+    }
+}
+
+bool tracing::pop(record *out) {
+    util::lock_guard guard{reader_lock};
+
+    ring *oldest = nullptr;
+    record candidate;
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto buffer = &rings[x86::cpus[i]->cpu_number];
+        if (buffer->slots == nullptr || !peek(buffer, &candidate)) {
+            continue;
+        }
+
+        if (oldest == nullptr || candidate.time < out->time) {
+            oldest = buffer;
+            memcpy(out, &candidate, sizeof(record));
+        }
+    }
+
+    if (oldest == nullptr) {
+        return false;
+    }
+
+    oldest->read++;
+    return true;
+}
+
+uint64_t tracing::overwritten() {
+    util::lock_guard guard{reader_lock};
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        total += rings[x86::cpus[i]->cpu_number].overwritten;
+    }
+
+    return total;
+}
+
+void tracing::reset() {
+    util::lock_guard guard{reader_lock};
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto buffer = &rings[x86::cpus[i]->cpu_number];
+        buffer->read = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+        buffer->overwritten = 0;
+    }
+}
+
+// Every CPU has to be up, points hit before this record nothing
+void tracing::init() {
+    size_t pages = memory::page_count(RING_SIZE * sizeof(slot));
+    for (size_t i = 0; i < x86::cpus.size(); i++) {
+        auto slots = (slot *) pmm::alloc(pages);
+        memset(slots, 0, pages * memory::page_size);
+        __atomic_store_n(&rings[x86::cpus[i]->cpu_number].slots, slots, __ATOMIC_RELEASE);
+    }
+
+    device *dev = prs::construct<device>(prs::allocator{slab::create_resource()}, vfs::devfs::mainbus, dtable::majors::TRACE, -1, nullptr);
+    vfs::devfs::append_device(dev, dtable::majors::TRACE);
+}
+
+// Only whole records, the offset doesn't matter since reading consumes them
+ssize_t tracing::device::read(void *buf, size_t len, size_t offset) {
+    if (len < sizeof(record)) {
+        arch::set_errno(EINVAL);
+        return -1;
+    }
+
+    size_t copied = 0;
+    record rec;
+    while (len - copied >= sizeof(record) && pop(&rec)) {
+        if (arch::copy_to_user((char *) buf + copied, &rec, sizeof(record)) < sizeof(record)) {
+            arch::set_errno(EFAULT);
+            return -1;
+        }
+
+        copied += sizeof(record);
+    }
+
+    return copied;
+}
+
+ssize_t tracing::device::write(void *buf, size_t len, size_t offset) {
+    if (arch::get_process()->effective_uid != 0) {
+        arch::set_errno(EPERM);
+        return -1;
+    }
+
+    char cmd[64];
+    if (len >= sizeof(cmd)) {
+        arch::set_errno(EINVAL);
+        return -1;
+    }
+
+    if (arch::copy_from_user(cmd, buf, len) < len) {
+        arch::set_errno(EFAULT);
+        return -1;
+    }
+
+    cmd[len] = '\0';
+    if (len && cmd[len - 1] == '\n') {
+        cmd[len - 1] = '\0';
+    }
+
+    if (strcmp(cmd, "reset") == 0) {
+        reset();
+        return len;
+    }
+
+    bool on = strncmp(cmd, "enable ", 7) == 0;
+    if ((on || strncmp(cmd, "disable ", 8) == 0) && enable(cmd + (on ? 7 : 8), on)) {
+        return len;
+    }
+
+    arch::set_errno(EINVAL);
+    return -1;
+}
@@ -0,0 +1,143 @@
+#include <cstddef>
+#include <cstdint>
+#include <arch/x86/vvar.hpp>
+
+// Built as its own shared object and mapped into every process right after the vvar page,
+// see source/vdso/vdso.ld. Nothing here may use the GOT, data or bss
+
+// Indices into the kernel's syscall table
+constexpr long SYS_CLOCK_GETTIME = 53;
+constexpr long SYS_SCHED_GETCPU = 68;
+
+constexpr int CLOCK_REALTIME = 0;
+constexpr int CLOCK_MONOTONIC = 1;
+
+constexpr uint64_t NANOS_PER_SEC = 1000000000;
+constexpr uint64_t NANOS_PER_MICRO = 1000;
+
+struct timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+struct timeval {
+    long tv_sec;
+    long tv_usec;
+};
+
+extern "C" const vdso::vvar hades_vvar [[gnu::visibility("hidden")]];
+
+static long syscall2(long num, long arg0, long arg1) {
+    long ret;
+    asm volatile("syscall" : "=a"(ret) : "a"(num), "D"(arg0), "S"(arg1) : "rcx", "r11", "memory");
+    return ret;
+}
+
+static bool read_ns(uint64_t *ns, bool realtime) {
+    auto page = &hades_vvar;
+
+    while (true) {
+        uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            asm volatile("pause");
+            continue;
+        }
+
+        if (__atomic_load_n(&page->clock_mode, __ATOMIC_RELAXED) != vdso::CLOCK_MODE_TSC) {
+            return false;
+        }
+
+        uint32_t low, high, aux;
+        int64_t offset = 0;
+        if (__atomic_load_n(&page->rdtscp, __ATOMIC_RELAXED)) {
+            asm volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+            offset = __atomic_load_n(&page->tsc_offsets[aux % vdso::VVAR_CPUS], __ATOMIC_RELAXED);
+        } else {
+            asm volatile("lfence; rdtsc" : "=a"(low), "=d"(high) :: "memory");
+        }
+
+        uint64_t tsc = (((uint64_t) high << 32) | low) + offset;
+        uint64_t mult = __atomic_load_n(&page->mult, __ATOMIC_RELAXED);
+        uint64_t base = __atomic_load_n(&page->base, __ATOMIC_RELAXED);
+        uint64_t value = (uint64_t) (((unsigned __int128) (tsc - base) * mult) >> 32);
+
+        if (realtime) {
+            value += __atomic_load_n(&page->realtime_offset, __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+            *ns = value;
+            return true;
+        }
+    }
+}
+
+// The exported entry points are interposable, calling them from each other would go through a PLT
+static int clock_gettime(int clock, timespec *spec) {
+    uint64_t ns;
+    if ((clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) || !read_ns(&ns, clock == CLOCK_REALTIME)) {
+        return syscall2(SYS_CLOCK_GETTIME, clock, (long) spec);
+    }
+
+    spec->tv_sec = ns / NANOS_PER_SEC;
+    spec->tv_nsec = ns % NANOS_PER_SEC;
+    return 0;
+}
+
+extern "C" {
+    int __vdso_clock_gettime(int clock, timespec *spec) {
+        return clock_gettime(clock, spec);
+    }
+
+    int __vdso_gettimeofday(timeval *tv, void *tz) {
+        if (tv == nullptr) {
+            return 0;
+        }
+
+        timespec spec;
+        int res = clock_gettime(CLOCK_REALTIME, &spec);
+        if (res != 0) {
+            return res;
+        }
+
+        tv->tv_sec = spec.tv_sec;
+        tv->tv_usec = spec.tv_nsec / NANOS_PER_MICRO;
+        return 0;
+    }
+
+    long __vdso_time(long *t) {
+        timespec spec;
+        if (clock_gettime(CLOCK_REALTIME, &spec) != 0) {
+            return -1;
+        }
+
+        if (t) {
+            *t = spec.tv_sec;
+        }
+
+        return spec.tv_sec;
+    }
+
+    // TSC_AUX holds the cpu number whenever rdtscp exists, there is a single node
+    int __vdso_getcpu(unsigned *cpu, unsigned *node, void *unused) {
+        unsigned number;
+        if (__atomic_load_n(&hades_vvar.rdtscp, __ATOMIC_RELAXED)) {
+            uint32_t low, high, aux;
+            asm volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+            number = aux;
+        } else {
+            number = syscall2(SYS_SCHED_GETCPU, 0, 0);
+        }
+
+        if (cpu) {
+            *cpu = number;
+        }
+
+        if (node) {
+            *node = 0;
+        }
+
+        return 0;
+    }
+}